@@ -0,0 +1,113 @@
+#include <3ds.h>
+#include <string.h>
+#include "arena.h"
+#include "exheader.h"
+#include "stats.h"
+
+#define ALIGN8(x) (((x) + 7) & ~7)
+
+typedef struct{
+    u32 size;
+    u32 object_size; // 0 for an arena
+} arena_pool_t;
+
+static const arena_pool_t g_pools[ARENA_COUNT] = {
+    [ARENA_SCRATCH_0] = {ARENA_SCRATCH_SIZE, 0},
+    [ARENA_SCRATCH_1] = {ARENA_SCRATCH_SIZE, 0},
+    [ARENA_EXHEADERS] = {ARENA_EXHEADER_SLOTS * ARENA_EXHEADER_SIZE, ARENA_EXHEADER_SIZE},
+};
+
+static u8 g_budget[ARENA_BUDGET] __attribute__((aligned(8)));
+static arena_t g_arenas[ARENA_COUNT];
+static slab_t g_slabs[ARENA_COUNT];
+
+static void note_used(stats_pool_t *stats, u32 used){
+    if (stats == NULL) return;
+    stats->used = used;
+    if (used > stats->high) stats->high = used;
+}
+
+void arenaInit(void){
+    u8 *base = g_budget;
+    u32 i, n;
+
+    if (ARENA_COUNT > STATS_MAX_POOLS || sizeof(exheader_header) > ARENA_EXHEADER_SIZE) svcBreak(USERBREAK_ASSERT);
+    for (i = 0; i < ARENA_COUNT; i++){
+        g_stats->pools[i].quota = g_pools[i].size;
+        if (g_pools[i].object_size == 0){
+            arena_init(&g_arenas[i], base, g_pools[i].size);
+            g_arenas[i].stats = &g_stats->pools[i];
+        }
+        else{
+            g_slabs[i].object_size = g_pools[i].object_size;
+            g_slabs[i].stats = NULL;
+            g_slabs[i].free = NULL;
+            for (n = g_pools[i].size / g_pools[i].object_size; n > 0; n--) slab_free(&g_slabs[i], base + (n - 1) * g_pools[i].object_size);
+            g_slabs[i].stats = &g_stats->pools[i];
+        }
+        base += g_pools[i].size;
+    }
+    statsRegisterFootprint(STAT_MODULE_ARENA, sizeof(g_budget));
+}
+
+arena_t *arena_get(arena_id_t id){
+    return &g_arenas[id];
+}
+
+slab_t *slab_get(arena_id_t id){
+    return &g_slabs[id];
+}
+
+void arena_init(arena_t *arena, void *base, u32 size){
+    arena->base = base;
+    arena->size = size;
+    arena->used = 0;
+    arena->stats = NULL;
+}
+
+// 8 byte aligned, NULL once the quota is used up
+void *arena_alloc(arena_t *arena, u32 size){
+    void *p;
+
+    size = ALIGN8(size);
+    if (size > arena->size - arena->used){
+        if (arena->stats) arena->stats->failures++;
+        return NULL;
+    }
+    p = arena->base + arena->used;
+    arena->used += size;
+    note_used(arena->stats, arena->used);
+    return p;
+}
+
+u32 arena_mark(arena_t *arena){
+    return arena->used;
+}
+
+// frees everything allocated since the mark
+void arena_rewind(arena_t *arena, u32 mark){
+    arena->used = mark;
+    note_used(arena->stats, mark);
+}
+
+void arena_reset(arena_t *arena){
+    arena_rewind(arena, 0);
+}
+
+void *slab_alloc(slab_t *slab){
+    void *object = slab->free;
+
+    if (object == NULL){
+        if (slab->stats) slab->stats->failures++;
+        return NULL;
+    }
+    slab->free = *(void **)object;
+    if (slab->stats) note_used(slab->stats, slab->stats->used + slab->object_size);
+    return object;
+}
+
+void slab_free(slab_t *slab, void *object){
+    *(void **)object = slab->free;
+    slab->free = object;
+    if (slab->stats) note_used(slab->stats, slab->stats->used - slab->object_size);
+}
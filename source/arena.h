@@ -0,0 +1,61 @@
+#pragma once
+
+#include <3ds/types.h>
+#include "stats.h"
+
+// The loader's memory budget for caches and scratch, fixed at build time and
+// split into per-subsystem pools. An arena hands out memory by bumping a
+// pointer and is reset in bulk, a slab keeps fixed-size objects on a free
+// list. Every operation is O(1) and a pool never grows past its quota, so a
+// new cache has to be given a share of ARENA_BUDGET here. Usage is published
+// in the stats block.
+
+#define ARENA_WORKERS 2 // at least NUM_WORKERS in loader.c
+#define ARENA_EXHEADER_SLOTS 8 // at least MAX_SESSIONS*BATCH_DEPTH in loader.c
+#define ARENA_EXHEADER_SIZE 0x800
+#ifdef LOADER_FUSED_PATCH
+#define ARENA_SCRATCH_SIZE 0x1C00 // a patch_set_t and patch_memory's tables
+#else
+#define ARENA_SCRATCH_SIZE 0x800 // patch_memory's tables
+#endif
+
+// raise it (make LOADER_ARENA_BUDGET=...) to leave room for a cache
+#ifndef ARENA_BUDGET
+#define ARENA_BUDGET (ARENA_WORKERS*ARENA_SCRATCH_SIZE + ARENA_EXHEADER_SLOTS*ARENA_EXHEADER_SIZE)
+#endif
+#if ARENA_WORKERS*ARENA_SCRATCH_SIZE + ARENA_EXHEADER_SLOTS*ARENA_EXHEADER_SIZE > ARENA_BUDGET
+#error "arena quotas do not fit in ARENA_BUDGET"
+#endif
+
+typedef enum{
+    ARENA_SCRATCH_0 = 0, // per-load scratch of worker 0, reset when its load ends
+    ARENA_SCRATCH_1,
+    ARENA_EXHEADERS, // slab, exheader copies of the jobs in flight
+    ARENA_COUNT
+} arena_id_t;
+
+typedef struct{
+    u8 *base;
+    u32 size;
+    u32 used;
+    stats_pool_t *stats; // NULL outside the budget
+} arena_t;
+
+typedef struct{
+    void *free;
+    u32 object_size;
+    stats_pool_t *stats;
+} slab_t;
+
+void arenaInit(void);
+arena_t *arena_get(arena_id_t id);
+slab_t *slab_get(arena_id_t id);
+
+void arena_init(arena_t *arena, void *base, u32 size);
+void *arena_alloc(arena_t *arena, u32 size);
+u32 arena_mark(arena_t *arena);
+void arena_rewind(arena_t *arena, u32 mark);
+void arena_reset(arena_t *arena);
+
+void *slab_alloc(slab_t *slab);
+void slab_free(slab_t *slab, void *object);
@@ -0,0 +1,121 @@
+#include <3ds.h>
+#include <string.h>
+#include "depgraph.h"
+#include "stats.h"
+
+// Groups a set of titles into levels so that everything a title depends on
+// sits in an earlier level. Titles within one level can be started together.
+// Dependencies on titles outside the set are taken as already satisfied.
+
+typedef struct{
+    u64 progid;
+    u16 dep_start;
+    u16 dep_count;
+} depgraph_node_t;
+
+static depgraph_node_t g_nodes[DEPGRAPH_MAX_TITLES];
+static u8 g_sorted[DEPGRAPH_MAX_TITLES]; // node indices ordered by progid
+static u64 g_deps[DEPGRAPH_MAX_DEPS]; // progids first, resolved to node indices in place
+static LightLock g_lock;
+
+void depgraphInit(void){
+    LightLock_Init(&g_lock);
+    statsRegisterFootprint(STAT_MODULE_DEPGRAPH, sizeof(g_nodes) + sizeof(g_sorted) + sizeof(g_deps));
+}
+
+static int find_node(u64 progid, u32 count){
+    int lo, hi, mid;
+
+    lo = 0;
+    hi = count - 1;
+    while (lo <= hi){
+        mid = (lo + hi) / 2;
+        if (g_nodes[g_sorted[mid]].progid == progid) return g_sorted[mid];
+        if (g_nodes[g_sorted[mid]].progid < progid) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return -1;
+}
+
+static void sort_nodes(u32 count){
+    u32 i, j;
+    u8 idx;
+
+    // insertion sort, the set is small and usually close to boot order already
+    for (i = 0; i < count; i++) g_sorted[i] = i;
+    for (i = 1; i < count; i++){
+        idx = g_sorted[i];
+        for (j = i; j > 0 && g_nodes[g_sorted[j - 1]].progid > g_nodes[idx].progid; j--) g_sorted[j] = g_sorted[j - 1];
+        g_sorted[j] = idx;
+    }
+}
+
+static Result build(const u64 *prog_handles, u32 count, exheader_header *scratch, depgraph_fetch_t fetch, u8 *levels, u32 *level_count){
+    depgraph_node_t *node;
+    u32 i, d, used, placed, level;
+    u64 dep;
+    int idx, ready;
+    Result res;
+
+    // one exheader fetch per title, only the dependency list is kept
+    used = 0;
+    for (i = 0; i < count; i++){
+        if (R_FAILED(res = fetch(scratch, prog_handles[i]))) return res;
+        node = &g_nodes[i];
+        node->progid = scratch->arm11systemlocalcaps.programid;
+        node->dep_start = used;
+        node->dep_count = 0;
+        for (d = 0; d < sizeof(scratch->deplist.programid) / sizeof(u64); d++){
+            dep = scratch->deplist.programid[d];
+            if (dep == 0) continue;
+            if (used == DEPGRAPH_MAX_DEPS) return MAKERESULT(RL_PERMANENT, RS_OUTOFRESOURCE, RM_LDR, RD_OUT_OF_MEMORY);
+            g_deps[used++] = dep;
+            node->dep_count++;
+        }
+    }
+
+    // drop edges that leave the set, the rest become node indices
+    sort_nodes(count);
+    for (i = 0; i < count; i++){
+        node = &g_nodes[i];
+        used = node->dep_start;
+        for (d = 0; d < node->dep_count; d++){
+            idx = find_node(g_deps[node->dep_start + d], count);
+            if (idx >= 0 && (u32)idx != i) g_deps[used++] = idx;
+        }
+        node->dep_count = used - node->dep_start;
+        levels[i] = DEPGRAPH_NO_LEVEL;
+    }
+
+    // a title joins a level once all of its dependencies sit in earlier levels
+    placed = 0;
+    for (level = 0; placed < count && level < DEPGRAPH_NO_LEVEL; level++){
+        d = placed;
+        for (i = 0; i < count; i++){
+            if (levels[i] != DEPGRAPH_NO_LEVEL) continue;
+            node = &g_nodes[i];
+            ready = 1;
+            for (used = 0; used < node->dep_count && ready; used++){
+                if (levels[g_deps[node->dep_start + used]] >= level) ready = 0;
+            }
+            if (ready){
+                levels[i] = level;
+                placed++;
+            }
+        }
+        if (placed == d) break; // whatever is left depends on itself somewhere
+    }
+    *level_count = level;
+    return 0;
+}
+
+Result depgraph_levels(const u64 *prog_handles, u32 count, exheader_header *scratch, depgraph_fetch_t fetch, u8 *levels, u32 *level_count){
+    Result res;
+
+    if (count == 0 || count > DEPGRAPH_MAX_TITLES) return MAKERESULT(RL_PERMANENT, RS_INVALIDARG, RM_LDR, RD_OUT_OF_RANGE);
+
+    LightLock_Lock(&g_lock);
+    res = build(prog_handles, count, scratch, fetch, levels, level_count);
+    LightLock_Unlock(&g_lock);
+    return res;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <3ds/types.h>
+#include "exheader.h"
+
+#define DEPGRAPH_MAX_TITLES 128
+#define DEPGRAPH_MAX_DEPS 1024 // dependency entries across the whole set
+#define DEPGRAPH_NO_LEVEL 0xFF // part of a dependency cycle
+
+typedef Result (*depgraph_fetch_t)(exheader_header *exheader, u64 prog_handle);
+
+void depgraphInit(void);
+Result depgraph_levels(const u64 *prog_handles, u32 count, exheader_header *scratch, depgraph_fetch_t fetch, u8 *levels, u32 *level_count);
@@ -2,11 +2,16 @@
 #include "fsldr.h"
 #include "fsreg.h"
 #include "srvsys.h"
+#include "stats.h"
 
 #define SDK_VERSION 0x70200C8
 
 static Handle fsldrHandle;
 static int fsldrRefCount;
+static LightLock fsldrLock;
+static LightLock fsldrPriorityLock;
+static u32 fsldrPriorityUsers[FSLDR_PRIORITY_COUNT]; // reads in progress per class
+static u32 fsldrPriority = FSLDR_PRIORITY_INTERACTIVE; // what the session is set to
 
 // MAKE SURE fsreg has been init before calling this
 static Result fsldrPatchPermissions(void)
@@ -29,30 +34,67 @@ static Result fsldrPatchPermissions(void)
 
 Result fsldrInit(void)
 {
-  Result ret = 0;
-
   if (AtomicPostIncrement(&fsldrRefCount)) return 0;
 
-  ret = srvSysGetServiceHandle(&fsldrHandle, "fs:LDR");
-  if (R_SUCCEEDED(ret))
-  {
-    fsldrPatchPermissions();
-    ret = FSLDR_InitializeWithSdkVersion(fsldrHandle, SDK_VERSION);
-    ret = FSLDR_SetPriority(0);
-    if (R_FAILED(ret)) svcBreak(USERBREAK_ASSERT);
-  }
-  else
+  // the session is opened on the first file access so it stays off the boot path
+  LightLock_Init(&fsldrLock);
+  LightLock_Init(&fsldrPriorityLock);
+  return 0;
+}
+
+void fsldrExit(void)
+{
+  if (AtomicDecrement(&fsldrRefCount)) return;
+  if (fsldrHandle != 0) svcCloseHandle(fsldrHandle);
+  fsldrHandle = 0;
+}
+
+static Result fsldrConnect(void)
+{
+  Result ret = 0;
+  Handle session;
+
+  LightLock_Lock(&fsldrLock);
+  if (fsldrHandle == 0)
   {
-    AtomicDecrement(&fsldrRefCount);
+    ret = srvSysGetServiceHandle(&session, "fs:LDR");
+    if (R_SUCCEEDED(ret))
+    {
+      fsldrPatchPermissions();
+      ret = FSLDR_InitializeWithSdkVersion(session, SDK_VERSION);
+      fsldrHandle = session;
+      ret = FSLDR_SetPriority(FSLDR_PRIORITY_INTERACTIVE);
+      if (R_FAILED(ret)) svcBreak(USERBREAK_ASSERT);
+    }
   }
-
+  LightLock_Unlock(&fsldrLock);
   return ret;
 }
 
-void fsldrExit(void)
+// only talks to FS when the most urgent class in progress changes
+static void fsldrApplyPriority(void)
 {
-  if (AtomicDecrement(&fsldrRefCount)) return;
-  svcCloseHandle(fsldrHandle);
+  u32 priority;
+
+  for (priority = 0; priority < FSLDR_PRIORITY_COUNT && fsldrPriorityUsers[priority] == 0; priority++);
+  if (priority == FSLDR_PRIORITY_COUNT) priority = FSLDR_PRIORITY_INTERACTIVE;
+  if (priority != fsldrPriority && R_SUCCEEDED(FSLDR_SetPriority(priority))) fsldrPriority = priority;
+}
+
+void fsldr_priority_begin(u32 priority)
+{
+  LightLock_Lock(&fsldrPriorityLock);
+  fsldrPriorityUsers[priority]++;
+  fsldrApplyPriority();
+  LightLock_Unlock(&fsldrPriorityLock);
+}
+
+void fsldr_priority_end(u32 priority)
+{
+  LightLock_Lock(&fsldrPriorityLock);
+  fsldrPriorityUsers[priority]--;
+  fsldrApplyPriority();
+  LightLock_Unlock(&fsldrPriorityLock);
 }
 
 Result FSLDR_InitializeWithSdkVersion(Handle session, u32 version)
@@ -64,26 +106,31 @@ Result FSLDR_InitializeWithSdkVersion(Handle session, u32 version)
   cmdbuf[2] = 32;
 
   Result ret = 0;
-  if(R_FAILED(ret = svcSendSyncRequest(session))) return ret;
+  if(R_FAILED(ret = statsSendSyncRequest(STAT_IPC_FSLDR_INITIALIZEWITHSDKVERSION, session))) return ret;
 
   return cmdbuf[1];
 }
 
 Result FSLDR_SetPriority(u32 priority)
 {
+	Result ret = 0;
+	if (fsldrHandle == 0 && R_FAILED(ret = fsldrConnect())) return ret;
+
 	u32 *cmdbuf = getThreadCommandBuffer();
 
 	cmdbuf[0] = IPC_MakeHeader(0x862,1,0); // 0x8620040
 	cmdbuf[1] = priority;
 
-	Result ret = 0;
-	if(R_FAILED(ret = svcSendSyncRequest(fsldrHandle))) return ret;
+	if(R_FAILED(ret = statsSendSyncRequest(STAT_IPC_FSLDR_SETPRIORITY, fsldrHandle))) return ret;
 
 	return cmdbuf[1];
 }
 
 Result FSLDR_OpenFileDirectly(Handle* out, FS_ArchiveID archiveId, FS_Path archivePath, FS_Path filePath, u32 openFlags, u32 attributes)
 {
+	Result ret = 0;
+	if (fsldrHandle == 0 && R_FAILED(ret = fsldrConnect())) return ret;
+
 	u32 *cmdbuf = getThreadCommandBuffer();
 
 	cmdbuf[0] = IPC_MakeHeader(0x803,8,4); // 0x8030204
@@ -100,8 +147,7 @@ Result FSLDR_OpenFileDirectly(Handle* out, FS_ArchiveID archiveId, FS_Path archi
 	cmdbuf[11] = IPC_Desc_StaticBuffer(filePath.size, 0);
 	cmdbuf[12] = (u32) filePath.data;
 
-	Result ret = 0;
-	if(R_FAILED(ret = svcSendSyncRequest(fsldrHandle))) return ret;
+	if(R_FAILED(ret = statsSendSyncRequest(STAT_IPC_FSLDR_OPENFILEDIRECTLY, fsldrHandle))) return ret;
 
 	if(out) *out = cmdbuf[3];
 
@@ -110,6 +156,9 @@ Result FSLDR_OpenFileDirectly(Handle* out, FS_ArchiveID archiveId, FS_Path archi
 
 Result FSLDR_OpenDirectory(Handle* out, FS_Archive archive, FS_Path path)
 {
+	Result ret = 0;
+	if (fsldrHandle == 0 && R_FAILED(ret = fsldrConnect())) return ret;
+
 	u32 *cmdbuf = getThreadCommandBuffer();
 
 	cmdbuf[0] = IPC_MakeHeader(0x80B,4,2); // 0x80B0102
@@ -120,8 +169,7 @@ Result FSLDR_OpenDirectory(Handle* out, FS_Archive archive, FS_Path path)
 	cmdbuf[5] = IPC_Desc_StaticBuffer(path.size, 0);
 	cmdbuf[6] = (u32) path.data;
 
-	Result ret = 0;
-	if(R_FAILED(ret = svcSendSyncRequest(fsldrHandle))) return ret;
+	if(R_FAILED(ret = statsSendSyncRequest(STAT_IPC_FSLDR_OPENDIRECTORY, fsldrHandle))) return ret;
 
 	if(out) *out = cmdbuf[3];
 
@@ -132,6 +180,9 @@ Result FSLDR_OpenArchive(FS_Archive* archive, FS_ArchiveID id, FS_Path path)
 {
 	if(!archive) return -2;
 
+	Result ret = 0;
+	if (fsldrHandle == 0 && R_FAILED(ret = fsldrConnect())) return ret;
+
 	u32 *cmdbuf = getThreadCommandBuffer();
 
 	cmdbuf[0] = IPC_MakeHeader(0x80C,3,2); // 0x80C00C2
@@ -141,8 +192,7 @@ Result FSLDR_OpenArchive(FS_Archive* archive, FS_ArchiveID id, FS_Path path)
 	cmdbuf[4] = IPC_Desc_StaticBuffer(path.size, 0);
 	cmdbuf[5] = (u32) path.data;
 
-	Result ret = 0;
-	if(R_FAILED(ret = svcSendSyncRequest(fsldrHandle))) return ret;
+	if(R_FAILED(ret = statsSendSyncRequest(STAT_IPC_FSLDR_OPENARCHIVE, fsldrHandle))) return ret;
 
 	if(archive) *archive = cmdbuf[2] | ((u64) cmdbuf[3] << 32);
 
@@ -153,14 +203,16 @@ Result FSLDR_CloseArchive(FS_Archive archive)
 {
 	if(!archive) return -2;
 
+	Result ret = 0;
+	if (fsldrHandle == 0 && R_FAILED(ret = fsldrConnect())) return ret;
+
 	u32 *cmdbuf = getThreadCommandBuffer();
 
 	cmdbuf[0] = IPC_MakeHeader(0x80E,2,0); // 0x80E0080
 	cmdbuf[1] = (u32) archive;
 	cmdbuf[2] = (u32) (archive >> 32);
 
-	Result ret = 0;
-	if(R_FAILED(ret = svcSendSyncRequest(fsldrHandle))) return ret;
+	if(R_FAILED(ret = statsSendSyncRequest(STAT_IPC_FSLDR_CLOSEARCHIVE, fsldrHandle))) return ret;
 
 	return cmdbuf[1];
 }
\ No newline at end of file
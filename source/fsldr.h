@@ -12,8 +12,20 @@
 #define MAX_FILES 255
 #endif
 
+// Every loader read goes through the one fs:LDR session and FS serves it at
+// the priority last set on it. Reads say which class they are for between
+// fsldr_priority_begin and fsldr_priority_end, and the session runs at the
+// most urgent class in progress, lower is more urgent. Reads outside any
+// class get FSLDR_PRIORITY_INTERACTIVE, the one priority the loader always used.
+#define FSLDR_PRIORITY_INTERACTIVE 0 // application and applet launches
+#define FSLDR_PRIORITY_SYSTEM 1 // sysmodules and anything else nobody is looking at yet
+#define FSLDR_PRIORITY_BACKGROUND 2 // speculative, boot prefetch, DryRun, patch reloads
+#define FSLDR_PRIORITY_COUNT 3
+
 Result fsldrInit(void);
 void fsldrExit(void);
+void fsldr_priority_begin(u32 priority);
+void fsldr_priority_end(u32 priority);
 Result FSLDR_InitializeWithSdkVersion(Handle session, u32 version);
 Result FSLDR_SetPriority(u32 priority);
 Result FSLDR_OpenFileDirectly(Handle* out, FS_ArchiveID archiveId, FS_Path archivePath, FS_Path filePath, u32 openFlags, u32 attributes);
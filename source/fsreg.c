@@ -2,6 +2,7 @@
 #include <string.h>
 #include "fsreg.h"
 #include "srvsys.h"
+#include "stats.h"
 
 static Handle fsregHandle;
 static int fsregRefCount;
@@ -33,7 +34,7 @@ Result FSREG_CheckHostLoadId(u64 prog_handle)
   cmdbuf[2] = (u32)(prog_handle >> 32);
 
   Result ret = 0;
-  if(R_FAILED(ret = svcSendSyncRequest(fsregHandle))) return ret;
+  if(R_FAILED(ret = statsSendSyncRequest(STAT_IPC_FSREG_CHECKHOSTLOADID, fsregHandle))) return ret;
 
   return cmdbuf[1];
 }
@@ -48,7 +49,7 @@ Result FSREG_LoadProgram(u64 *prog_handle, const FS_ProgramInfo *title)
   memcpy(((u8*)&cmdbuf[3])+1, &title->padding, 7);
 
   Result ret = 0;
-  if(R_FAILED(ret = svcSendSyncRequest(fsregHandle))) return ret;
+  if(R_FAILED(ret = statsSendSyncRequest(STAT_IPC_FSREG_LOADPROGRAM, fsregHandle))) return ret;
   *prog_handle = *(u64 *)&cmdbuf[2];
 
   return cmdbuf[1];
@@ -65,7 +66,7 @@ Result FSREG_GetProgramInfo(ExHeader_Info *exheader, u32 entry_count, u64 prog_h
   cmdbuf[65] = (u32)exheader;
 
   Result ret = 0;
-  if(R_FAILED(ret = svcSendSyncRequest(fsregHandle))) return ret;
+  if(R_FAILED(ret = statsSendSyncRequest(STAT_IPC_FSREG_GETPROGRAMINFO, fsregHandle))) return ret;
 
   return cmdbuf[1];
 }
@@ -79,7 +80,7 @@ Result FSREG_UnloadProgram(u64 prog_handle)
   cmdbuf[2] = (u32)(prog_handle >> 32);
 
   Result ret = 0;
-  if(R_FAILED(ret = svcSendSyncRequest(fsregHandle))) return ret;
+  if(R_FAILED(ret = statsSendSyncRequest(STAT_IPC_FSREG_UNLOADPROGRAM, fsregHandle))) return ret;
 
   return cmdbuf[1];
 }
@@ -92,7 +93,7 @@ Result FSREG_Unregister(u32 pid)
   cmdbuf[1] = pid;
 
   Result ret = 0;
-  if(R_FAILED(ret = svcSendSyncRequest(fsregHandle))) return ret;
+  if(R_FAILED(ret = statsSendSyncRequest(STAT_IPC_FSREG_UNREGISTER, fsregHandle))) return ret;
 
   return cmdbuf[1];
 }
@@ -110,7 +111,7 @@ Result FSREG_Register(u32 pid, u64 prog_handle, const FS_ProgramInfo *info, cons
   memcpy((u8*)&cmdbuf[8], storageinfo, 32);
 
   Result ret = 0;
-  if(R_FAILED(ret = svcSendSyncRequest(fsregHandle))) return ret;
+  if(R_FAILED(ret = statsSendSyncRequest(STAT_IPC_FSREG_REGISTER, fsregHandle))) return ret;
 
   return cmdbuf[1];
 }
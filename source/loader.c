@@ -8,8 +8,44 @@
 #include "fsreg.h"
 #include "pxipm.h"
 #include "srvsys.h"
+#include "trace.h"
+#include "stats.h"
+#include "prefetch.h"
+#include "depgraph.h"
+#include "overrides.h"
+#include "patchdb.h"
+#include "arena.h"
 
-#define MAX_SESSIONS 1
+#define MAX_SESSIONS 4
+#define NUM_WORKERS 2
+#define MAX_BATCH 16
+#define BATCH_DEPTH NUM_WORKERS // titles of one batch in flight at a time, enough to overlap I/O and lzss
+#define MAX_TEARDOWNS 4 // unregisters acknowledged but not yet run, more are answered once they are done
+#define MAX_JOBS (MAX_SESSIONS*BATCH_DEPTH + MAX_TEARDOWNS)
+#define MAX_REGISTRATIONS 32
+
+#if NUM_WORKERS > ARENA_WORKERS || MAX_SESSIONS*BATCH_DEPTH > ARENA_EXHEADER_SLOTS
+#error "arena.h does not give every worker and job its share"
+#endif
+#if 1 + NUM_WORKERS > STATS_STACK_PREFETCH
+#error "the worker stacks would share a stats slot with the prefetcher"
+#endif
+#define WORKER_STACK_SIZE 0x1000
+#define LZSS_CHUNK_SIZE 0x2000 // fused patch scans run per chunk, small enough to still be in L1
+
+// must match StackSize in loader.rsf
+#define MAIN_STACK_TOP 0x10000000
+#define MAIN_STACK_SIZE 0x1000
+
+// wait set layout, sessions follow the fixed handles
+#define HANDLE_NOTIFICATION 0
+#define HANDLE_PORT 1
+#define HANDLE_COMPLETION 2
+#define HANDLE_FIRST_SESSION 3
+
+// process images are staged in the free window between our stack and our code
+#define SHARED_MEM_BASE 0x10000000
+#define SHARED_MEM_END 0x14000000
 
 const char CODE_PATH[] = {0x01, 0x00, 0x00, 0x00, 0x2E, 0x63, 0x6F, 0x64, 0x65, 0x00, 0x00, 0x00};
 
@@ -23,13 +59,110 @@ typedef struct{
     u32 total_size;
 } prog_addrs_t;
 
-static Handle g_handles[MAX_SESSIONS+2];
+// the titles of a LoadProcess or LoadProcessBatch request, single loads are a batch of one
+typedef struct{
+    u16 cmdid;
+    u32 count;
+    u32 next; // next title to hand to a worker
+    u32 inflight;
+    u64 prog_handles[MAX_BATCH];
+    Result results[MAX_BATCH];
+    Handle processes[MAX_BATCH];
+} loader_batch_t;
+
+typedef struct{
+    Handle handle;
+    u64 cached_prog_handle;
+    exheader_header exheader; // also used as the GetProgramInfo reply buffer
+    loader_batch_t batch;
+    int register_waiting; // RegisterProgram held until the title's teardown is done
+    FS_ProgramInfo register_title;
+    FS_ProgramInfo register_update;
+#ifdef LOADER_TRACE
+    // the command being served, traced with its reply
+    u16 trace_cmdid;
+    u64 trace_prog_handle;
+    u64 trace_progid;
+    u64 trace_received;
+    u32 trace_size;
+#endif
+} loader_session_t;
+
+typedef enum{
+    LOADER_JOB_LOAD = 0,
+    LOADER_JOB_LAUNCHORDER,
+    LOADER_JOB_DRYRUN, // LoadProcess up to patching, then the image is thrown away
+    LOADER_JOB_UNREGISTER, // acknowledged already unless reply is set
+    LOADER_JOB_REGISTER,
+    LOADER_JOB_GETINFO, // an exheader the session does not have cached
+    LOADER_JOB_RELOADPATCHES
+} loader_job_t;
+
+typedef struct{
+    u64 prog_handle;
+    u64 progid;
+} loader_registration_t;
+
+// everything a single request needs, so requests can run concurrently
+typedef struct loader_ctx{
+    struct loader_ctx *next;
+    loader_session_t *session;
+    loader_job_t kind;
+    u32 index; // position in the session's batch
+    u32 count; // GetLaunchOrder titles
+    const u64 *prog_handles;
+    u8 *levels;
+    u32 level_count;
+    u64 prog_handle;
+    u64 progid; // title being torn down
+    int reply; // UNREGISTER: the session is parked until the unload is done
+    int stale; // GETINFO: unregistered while it was fetched, not to be cached
+    int exheader_valid;
+    exheader_header *exheader; // from the exheader slab, NULL for jobs that don't read one
+    prog_addrs_t shared;
+    Handle process;
+    Result res;
+#ifdef LOADER_TRACE
+    u32 trace_seq;
+#endif
+    u64 stage_start;
+    u32 stage_ticks[TRACE_STAGE_COUNT]; // reported by DryRun
+    u32 bytes_read;
+    u32 bytes_decompressed;
+    u32 patch_records; // ReloadPatches
+    u32 patch_bad_offset;
+    arena_t *scratch; // the running worker's, reset once the load is done
+#ifdef LOADER_FUSED_PATCH
+    patch_set_t *patches; // in scratch
+#endif
+} loader_ctx_t;
+
+typedef struct{
+    LightLock lock;
+    loader_ctx_t *head;
+    loader_ctx_t *tail;
+} loader_queue_t;
+
+static Handle g_handles[HANDLE_FIRST_SESSION+MAX_SESSIONS];
+static loader_session_t *g_handle_sessions[HANDLE_FIRST_SESSION+MAX_SESSIONS];
 static int g_active_handles;
-static u64 g_cached_prog_handle;
-static exheader_header g_exheader;
-static char g_ret_buf[1024];
+static loader_session_t g_sessions[MAX_SESSIONS];
+
+static loader_ctx_t g_ctx[MAX_JOBS];
+static int g_jobs_inflight;
+static int g_teardowns_inflight;
+static loader_registration_t g_registrations[MAX_REGISTRATIONS];
+static int g_registration_count;
+static loader_queue_t g_pending;
+static loader_queue_t g_done;
+static Handle g_job_sem;
+static LightLock g_shared_lock;
 
-static int lzss_decompress(u8 *end){
+static Handle g_workers[NUM_WORKERS];
+static u8 g_worker_stacks[NUM_WORKERS][WORKER_STACK_SIZE] __attribute__((aligned(8)));
+
+// hook, if set, gets each LZSS_CHUNK_SIZE of output as soon as the decoder moves below it
+static int lzss_decompress(u8 *end, void (*hook)(void *, u8 *, u8 *), void *arg){
     unsigned int v1; // r1@2
     u8 *v2; // r2@2
     u8 *v3; // r3@2
@@ -44,15 +177,21 @@ static int lzss_decompress(u8 *end){
     int v14; // t1@8
     unsigned int v15; // r7@8
     int v16; // r12@8
+    u8 *top;
     int ret;
 
     ret = 0;
     if ( end ){
         v1 = *((u32 *)end - 2);
         v2 = &end[*((u32 *)end - 1)];
-        v3 = &end[-(v1 >> 24)];
-        v4 = &end[-(v1 & 0xFFFFFF)];
+        v3 = end - (v1 >> 24);
+        v4 = end - (v1 & 0xFFFFFF);
+        top = v2;
         while ( v3 > v4 ){
+            if ( hook && top - v2 >= LZSS_CHUNK_SIZE ){
+                hook(arg, v2, top);
+                top = v2;
+            }
             v6 = *(v3-- - 1);
             v5 = v6;
             v7 = 8;
@@ -78,62 +217,161 @@ static int lzss_decompress(u8 *end){
                 *(v2-- - 1) = v9;
             }
             v5 *= 2;
-            if ( v3 <= v4 ) return ret;
+            if ( v3 <= v4 ) goto done;
             }
         }
+    done:
+        if ( hook && v2 < top ) hook(arg, v2, top);
     }
     return ret;
 }
 
+// first fit inside the staging window, skipping images of in-flight loads
+static u32 find_shared_addr(u32 size){
+    prog_addrs_t *used;
+    u32 addr;
+    int i, moved;
+
+    addr = SHARED_MEM_BASE;
+    do{
+        moved = 0;
+        for (i = 0; i < MAX_JOBS; i++){
+            used = &g_ctx[i].shared;
+            if (used->total_size == 0) continue;
+            if (addr < used->text_addr + (used->total_size << 12) && used->text_addr < addr + size){
+                addr = used->text_addr + (used->total_size << 12);
+                moved = 1;
+            }
+        }
+    } while (moved);
+    if (addr + size > SHARED_MEM_END || addr + size < addr) return 0;
+    return addr;
+}
+
 static Result allocate_shared_mem(prog_addrs_t *shared, prog_addrs_t *vaddr, int flags){
     u32 dummy;
+    u32 addr;
+    Result res;
 
+    LightLock_Lock(&g_shared_lock);
+    addr = find_shared_addr(vaddr->total_size << 12);
+    if (addr == 0){
+        LightLock_Unlock(&g_shared_lock);
+        return MAKERESULT(RL_PERMANENT, RS_OUTOFRESOURCE, RM_LDR, RD_OUT_OF_MEMORY);
+    }
     memcpy(shared, vaddr, sizeof(prog_addrs_t));
-    shared->text_addr = 0x10000000;
+    shared->text_addr = addr;
     shared->ro_addr = shared->text_addr + (shared->text_size << 12);
     shared->data_addr = shared->ro_addr + (shared->ro_size << 12);
-    return svcControlMemory(&dummy, shared->text_addr, 0, shared->total_size << 12, (flags & 0xF00) | MEMOP_ALLOC, MEMPERM_READ | MEMPERM_WRITE);
+    res = svcControlMemory(&dummy, shared->text_addr, 0, shared->total_size << 12, (flags & 0xF00) | MEMOP_ALLOC, MEMPERM_READ | MEMPERM_WRITE);
+    if (res < 0) shared->total_size = 0;
+    LightLock_Unlock(&g_shared_lock);
+    return res;
+}
+
+static void free_shared_mem(prog_addrs_t *shared){
+    u32 dummy;
+
+    LightLock_Lock(&g_shared_lock);
+    svcControlMemory(&dummy, shared->text_addr, 0, shared->total_size << 12, MEMOP_FREE, 0);
+    shared->total_size = 0;
+    LightLock_Unlock(&g_shared_lock);
+}
+
+// the code set took ownership of the pages, only give back the address range
+static void release_shared_mem(prog_addrs_t *shared){
+    LightLock_Lock(&g_shared_lock);
+    shared->total_size = 0;
+    LightLock_Unlock(&g_shared_lock);
 }
 
-static Result load_code(u64 progid, prog_addrs_t *shared, u64 prog_handle, int is_compressed){
+// ends a LoadProcess stage, timed for DryRun and recorded with LOADER_TRACE,
+// a plain load in a build without tracing does not even read the clock
+static void end_stage(loader_ctx_t *ctx, u64 progid, trace_stage_t stage){
+    u64 now;
+
+#ifndef LOADER_TRACE
+    if (ctx->kind != LOADER_JOB_DRYRUN) return;
+#endif
+    now = svcGetSystemTick();
+    if (stage == TRACE_STAGE_BEGIN) ctx->stage_start = now;
+    ctx->stage_ticks[stage] = now - ctx->stage_start;
+    ctx->stage_start = now;
+    TRACE_STAGE(ctx->trace_seq, progid, stage);
+}
+
+static Result load_code(loader_ctx_t *ctx, u64 progid, int is_compressed){
+    prog_addrs_t *shared = &ctx->shared;
     IFile file;
     FS_Path archivePath;
     FS_Path filePath;
     Result res;
     u64 size;
     u64 total = 0;
+    u64 start;
+    u32 decompressed;
 
-    archivePath.type = PATH_BINARY;
-    archivePath.data = &prog_handle;
-    archivePath.size = 8;
+    // the boot prefetcher may already have this title's .code
+    start = svcGetSystemTick();
+    // dry runs leave the prefetched copy and the boot manifest alone
+    if (ctx->kind == LOADER_JOB_DRYRUN || !prefetch_take_code(progid, (void *)shared->text_addr, (u64)shared->total_size << 12, &size)){
+        archivePath.type = PATH_BINARY;
+        archivePath.data = &ctx->prog_handle;
+        archivePath.size = 8;
 
-    filePath.type = PATH_BINARY;
-    filePath.data = CODE_PATH;
-    filePath.size = sizeof(CODE_PATH);
-    if (R_FAILED(IFile_Open(&file, ARCHIVE_SAVEDATA_AND_CONTENT2, archivePath, filePath, FS_OPEN_READ))) svcBreak(USERBREAK_ASSERT);
+        filePath.type = PATH_BINARY;
+        filePath.data = CODE_PATH;
+        filePath.size = sizeof(CODE_PATH);
+        if (R_FAILED(IFile_Open(&file, ARCHIVE_SAVEDATA_AND_CONTENT2, archivePath, filePath, FS_OPEN_READ))) svcBreak(USERBREAK_ASSERT);
 
-    // get file size
-    if (R_FAILED(IFile_GetSize(&file, &size))){
-        IFile_Close(&file);
-        svcBreak(USERBREAK_ASSERT);
-    }
+        // get file size
+        if (R_FAILED(IFile_GetSize(&file, &size))){
+            IFile_Close(&file);
+            svcBreak(USERBREAK_ASSERT);
+        }
 
-    // check size
-    if (size > (u64)shared->total_size << 12){
-        IFile_Close(&file);
-        return 0xC900464F;
-    }
+        // check size
+        if (size > (u64)shared->total_size << 12){
+            IFile_Close(&file);
+            return 0xC900464F;
+        }
 
-    // read code
-    res = IFile_Read(&file, &total, (void *)shared->text_addr, size);
-    IFile_Close(&file); // done reading
-    if (R_FAILED(res)) svcBreak(USERBREAK_ASSERT);
+        // read code
+        res = IFile_Read(&file, &total, (void *)shared->text_addr, size);
+        IFile_Close(&file); // done reading
+        if (R_FAILED(res)) svcBreak(USERBREAK_ASSERT);
+        // a prefetch hit records itself, with what the read cost before
+        if (ctx->kind != LOADER_JOB_DRYRUN) prefetch_record(progid, size, svcGetSystemTick() - start);
+    }
+    STATS_ADD(g_stats->bytes_read, total);
+    ctx->bytes_read = total;
+    end_stage(ctx, progid, TRACE_STAGE_READ);
 
     // decompress
-    if (is_compressed) lzss_decompress((u8 *)shared->text_addr + size);
+    if (is_compressed){
+        decompressed = size + *((u32 *)(shared->text_addr + size) - 1);
+#ifdef LOADER_FUSED_PATCH
+        // match patterns against the output while it is still in cache, everything above the decoder's start is final
+        ctx->patches = arena_alloc(ctx->scratch, sizeof(patch_set_t));
+        if (ctx->patches == NULL) svcBreak(USERBREAK_ASSERT); // ARENA_SCRATCH_SIZE is too small
+        patch_prepare(ctx->patches, ctx->scratch, progid, (u8 *)shared->text_addr, shared->total_size << 12, (u8 *)shared->text_addr + decompressed);
+        lzss_decompress((u8 *)shared->text_addr + size, patch_scan, ctx->patches);
+#else
+        lzss_decompress((u8 *)shared->text_addr + size, NULL, NULL);
+#endif
+        STATS_ADD(g_stats->bytes_decompressed, decompressed);
+        ctx->bytes_decompressed = decompressed;
+    }
+    end_stage(ctx, progid, TRACE_STAGE_DECOMPRESS);
 
     // patch
-    patch_code(progid, (u8 *)shared->text_addr, shared->total_size << 12);
+#ifdef LOADER_FUSED_PATCH
+    if (is_compressed) patch_apply(ctx->patches);
+    else patch_code(progid, (u8 *)shared->text_addr, shared->total_size << 12, ctx->scratch);
+#else
+    patch_code(progid, (u8 *)shared->text_addr, shared->total_size << 12, ctx->scratch);
+#endif
+    end_stage(ctx, progid, TRACE_STAGE_PATCH);
     return 0;
 }
 
@@ -154,52 +392,84 @@ static Result loader_GetProgramInfo(exheader_header *exheader, u64 prog_handle){
     }
 }
 
-static Result loader_LoadProcess(Handle *process, u64 prog_handle){
+// exheaders prefetched at boot are handed out once, everything else goes to fs:REG or PxiPM
+static Result loader_FetchProgramInfo(exheader_header *exheader, u64 prog_handle, int use_prefetched){
+    Result res = 0;
+
+    if (!(use_prefetched && prefetch_take_exheader(prog_handle, exheader)) && R_FAILED(res = loader_GetProgramInfo(exheader, prog_handle))) return res;
+    overrides_apply(exheader);
+    return res;
+}
+
+// the fs:LDR class of a load's .code and patch reads
+static u32 load_priority(loader_ctx_t *ctx, exheader_header *exheader){
+    if (ctx->kind == LOADER_JOB_DRYRUN) return FSLDR_PRIORITY_BACKGROUND;
+    switch (exheader->arm11systemlocalcaps.resourcelimitcategory){
+        case 0: // APPLICATION
+        case 1: // SYS_APPLET
+        case 2: // LIB_APPLET
+            return FSLDR_PRIORITY_INTERACTIVE;
+        default: // OTHER, sysmodules
+            return FSLDR_PRIORITY_SYSTEM;
+    }
+}
+
+static Result loader_LoadProcess(loader_ctx_t *ctx){
     Result res;
     int count;
     u32 flags;
     u32 desc;
-    u32 dummy;
-    prog_addrs_t shared_addr;
     prog_addrs_t vaddr;
     Handle codeset;
     CodeSetHeader codesetinfo;
     u32 data_mem_size;
+    u32 priority;
     u64 progid;
+    exheader_header *exheader;
 
     // make sure the cached info corrosponds to the current prog_handle
-    if (g_cached_prog_handle != prog_handle){
-        res = loader_GetProgramInfo(&g_exheader, prog_handle);
-        g_cached_prog_handle = prog_handle;
-        if (res < 0){
-          g_cached_prog_handle = 0;
-          return res;
-        }
+    TRACE_BEGIN(ctx->trace_seq);
+    end_stage(ctx, 0, TRACE_STAGE_BEGIN);
+    exheader = ctx->exheader;
+    if (!ctx->exheader_valid){
+        res = loader_FetchProgramInfo(exheader, ctx->prog_handle, ctx->kind != LOADER_JOB_DRYRUN);
+        if (res < 0) return res;
+        ctx->exheader_valid = 1;
     }
+    progid = exheader->arm11systemlocalcaps.programid;
+    end_stage(ctx, progid, TRACE_STAGE_GETPROGRAMINFO);
 
     // get kernel flags
     flags = 0;
     for (count = 0; count < 28; count++){
-        desc = g_exheader.arm11kernelcaps.descriptors[count];
+        desc = exheader->arm11kernelcaps.descriptors[count];
         if (0x1FE == desc >> 23) flags = desc & 0xF00;
     }
     if (flags == 0) return MAKERESULT(RL_PERMANENT, RS_INVALIDARG, 1, 2);
 
     // allocate process memory
-    vaddr.text_addr = g_exheader.codesetinfo.text.address;
-    vaddr.text_size = (g_exheader.codesetinfo.text.codesize + 4095) >> 12;
-    vaddr.ro_addr = g_exheader.codesetinfo.ro.address;
-    vaddr.ro_size = (g_exheader.codesetinfo.ro.codesize + 4095) >> 12;
-    vaddr.data_addr = g_exheader.codesetinfo.data.address;
-    vaddr.data_size = (g_exheader.codesetinfo.data.codesize + 4095) >> 12;
-    data_mem_size = (g_exheader.codesetinfo.data.codesize + g_exheader.codesetinfo.bsssize + 4095) >> 12;
+    vaddr.text_addr = exheader->codesetinfo.text.address;
+    vaddr.text_size = (exheader->codesetinfo.text.codesize + 4095) >> 12;
+    vaddr.ro_addr = exheader->codesetinfo.ro.address;
+    vaddr.ro_size = (exheader->codesetinfo.ro.codesize + 4095) >> 12;
+    vaddr.data_addr = exheader->codesetinfo.data.address;
+    vaddr.data_size = (exheader->codesetinfo.data.codesize + 4095) >> 12;
+    data_mem_size = (exheader->codesetinfo.data.codesize + exheader->codesetinfo.bsssize + 4095) >> 12;
     vaddr.total_size = vaddr.text_size + vaddr.ro_size + vaddr.data_size;
-    if ((res = allocate_shared_mem(&shared_addr, &vaddr, flags)) < 0) return res;
+    if ((res = allocate_shared_mem(&ctx->shared, &vaddr, flags)) < 0) return res;
+    end_stage(ctx, progid, TRACE_STAGE_ALLOCATE);
 
     // load code
-    progid = g_exheader.arm11systemlocalcaps.programid;
-    if ((res = load_code(progid, &shared_addr, prog_handle, g_exheader.codesetinfo.flags.flag & 1)) >= 0){
-        memcpy(&codesetinfo.name, g_exheader.codesetinfo.name, 8);
+    priority = load_priority(ctx, exheader);
+    fsldr_priority_begin(priority);
+    res = load_code(ctx, progid, exheader->codesetinfo.flags.flag & 1);
+    fsldr_priority_end(priority);
+    if (res >= 0 && ctx->kind == LOADER_JOB_DRYRUN){
+        free_shared_mem(&ctx->shared);
+        return 0;
+    }
+    if (res >= 0){
+        memcpy(&codesetinfo.name, exheader->codesetinfo.name, 8);
         codesetinfo.program_id = progid;
         codesetinfo.text_addr = vaddr.text_addr;
         codesetinfo.text_size = vaddr.text_size;
@@ -210,15 +480,20 @@ static Result loader_LoadProcess(Handle *process, u64 prog_handle){
         codesetinfo.rw_addr = vaddr.data_addr;
         codesetinfo.rw_size = vaddr.data_size;
         codesetinfo.rw_size_total = data_mem_size;
-        res = svcCreateCodeSet(&codeset, &codesetinfo, shared_addr.text_addr, shared_addr.ro_addr, shared_addr.data_addr);
+        res = svcCreateCodeSet(&codeset, &codesetinfo, ctx->shared.text_addr, ctx->shared.ro_addr, ctx->shared.data_addr);
+        end_stage(ctx, progid, TRACE_STAGE_CREATECODESET);
         if (res >= 0){
-          res = svcCreateProcess(process, codeset, g_exheader.arm11kernelcaps.descriptors, count);
+          res = svcCreateProcess(&ctx->process, codeset, exheader->arm11kernelcaps.descriptors, count);
+          end_stage(ctx, progid, TRACE_STAGE_CREATEPROCESS);
           svcCloseHandle(codeset);
-          if (res >= 0) return 0;
+          if (res >= 0){
+            release_shared_mem(&ctx->shared);
+            return 0;
+          }
         }
   }
 
-  svcControlMemory(&dummy, shared_addr.text_addr, 0, shared_addr.total_size << 12, MEMOP_FREE, 0);
+  free_shared_mem(&ctx->shared);
   return res;
 }
 
@@ -268,63 +543,475 @@ static Result loader_UnregisterProgram(u64 prog_handle){
     }
 }
 
-static void handle_commands(void){
-    FS_ProgramInfo title;
-    FS_ProgramInfo update;
+static void queue_push(loader_queue_t *queue, loader_ctx_t *ctx){
+    LightLock_Lock(&queue->lock);
+    ctx->next = NULL;
+    if (queue->tail) queue->tail->next = ctx;
+    else queue->head = ctx;
+    queue->tail = ctx;
+    LightLock_Unlock(&queue->lock);
+}
+
+static loader_ctx_t *queue_pop(loader_queue_t *queue){
+    loader_ctx_t *ctx;
+
+    LightLock_Lock(&queue->lock);
+    ctx = queue->head;
+    if (ctx){
+        queue->head = ctx->next;
+        if (queue->head == NULL) queue->tail = NULL;
+    }
+    LightLock_Unlock(&queue->lock);
+    return ctx;
+}
+
+static loader_ctx_t *alloc_ctx(loader_session_t *session, u64 prog_handle){
+    loader_ctx_t *ctx;
+    int i;
+
+    for (i = 0; i < MAX_JOBS; i++){
+        ctx = &g_ctx[i];
+        if (ctx->session == NULL){
+            ctx->session = session;
+            ctx->kind = LOADER_JOB_LOAD;
+            ctx->prog_handle = prog_handle;
+            ctx->exheader_valid = 0;
+            ctx->exheader = NULL;
+            ctx->process = 0;
+            ctx->res = 0;
+            ctx->bytes_read = 0;
+            ctx->bytes_decompressed = 0;
+            ctx->reply = 0;
+            ctx->stale = 0;
+            memset(ctx->stage_ticks, 0, sizeof(ctx->stage_ticks));
+            return ctx;
+        }
+    }
+    return NULL;
+}
+
+// for the jobs that fetch an exheader, they are too big to give every ctx one
+static void attach_exheader(loader_ctx_t *ctx){
+    ctx->exheader = slab_alloc(slab_get(ARENA_EXHEADERS));
+    if (ctx->exheader == NULL) svcBreak(USERBREAK_ASSERT);
+}
+
+static void free_ctx(loader_ctx_t *ctx){
+    if (ctx->exheader){
+        slab_free(slab_get(ARENA_EXHEADERS), ctx->exheader);
+        ctx->exheader = NULL;
+    }
+    ctx->session = NULL;
+}
+
+// takes the session out of the wait set until its deferred request is answered
+static void park_session(int index){
+    g_active_handles--;
+    g_handles[index] = g_handles[g_active_handles];
+    g_handle_sessions[index] = g_handle_sessions[g_active_handles];
+}
+
+static void unpark_session(loader_session_t *session){
+    g_handles[g_active_handles] = session->handle;
+    g_handle_sessions[g_active_handles] = session;
+    g_active_handles++;
+}
+
+static void worker_main(void *arg){
+    loader_ctx_t *ctx;
+    s32 count;
+
+    while (1){
+        svcWaitSynchronization(g_job_sem, U64_MAX);
+        ctx = queue_pop(&g_pending);
+        if (ctx == NULL) break; // woken up without work, time to exit
+        switch (ctx->kind){
+            case LOADER_JOB_LOAD:
+            case LOADER_JOB_DRYRUN:
+            {
+                ctx->scratch = arena_get(ARENA_SCRATCH_0 + (u32)arg);
+                ctx->res = loader_LoadProcess(ctx);
+                arena_reset(ctx->scratch); // whatever the load left there is dead now
+                if (ctx->kind == LOADER_JOB_DRYRUN) break;
+                STATS_INC(g_stats->loads);
+                if (R_FAILED(ctx->res)) STATS_INC(g_stats->load_failures);
+                break;
+            }
+            case LOADER_JOB_LAUNCHORDER:
+            {
+                ctx->res = depgraph_levels(ctx->prog_handles, ctx->count, ctx->exheader, loader_GetProgramInfo, ctx->levels, &ctx->level_count);
+                break;
+            }
+            case LOADER_JOB_UNREGISTER:
+            {
+                ctx->res = loader_UnregisterProgram(ctx->prog_handle);
+                break;
+            }
+            case LOADER_JOB_REGISTER:
+            {
+                ctx->res = loader_RegisterProgram(&ctx->prog_handle, &ctx->session->register_title, &ctx->session->register_update);
+                break;
+            }
+            case LOADER_JOB_GETINFO:
+            {
+                ctx->res = loader_FetchProgramInfo(ctx->exheader, ctx->prog_handle, 1);
+                break;
+            }
+            case LOADER_JOB_RELOADPATCHES:
+            {
+                fsldr_priority_begin(FSLDR_PRIORITY_BACKGROUND);
+                ctx->res = patchdb_reload(&ctx->patch_records, &ctx->patch_bad_offset);
+                fsldr_priority_end(FSLDR_PRIORITY_BACKGROUND);
+                break;
+            }
+        }
+        queue_push(&g_done, ctx);
+        svcReleaseSemaphore(&count, g_handles[HANDLE_COMPLETION], 1);
+        TRACE_FLUSH(); // after the reply is on its way
+        prefetch_commit();
+    }
+    svcExitThread();
+}
+
+static Result start_workers(void){
+    Result res;
+    s32 priority;
+    int i;
+
+    LightLock_Init(&g_pending.lock);
+    LightLock_Init(&g_done.lock);
+    LightLock_Init(&g_shared_lock);
+    if (R_FAILED(res = svcCreateSemaphore(&g_job_sem, 0, MAX_JOBS))) return res;
+    if (R_FAILED(res = svcCreateSemaphore(&g_handles[HANDLE_COMPLETION], 0, MAX_JOBS))) return res;
+
+    // run below the receive loop so cheap commands are answered while loads are in progress
+    if (R_FAILED(res = svcGetThreadPriority(&priority, CUR_THREAD_HANDLE))) return res;
+    for (i = 0; i < NUM_WORKERS; i++){
+        statsPaintStack((u32)g_worker_stacks[i], WORKER_STACK_SIZE);
+        statsRegisterStack(1 + i, (u32)g_worker_stacks[i], WORKER_STACK_SIZE);
+        res = svcCreateThread(&g_workers[i], worker_main, i, (u32 *)(g_worker_stacks[i] + WORKER_STACK_SIZE), priority + 1, -2);
+        if (R_FAILED(res)) return res;
+    }
+
+    // boot prefetch is best effort, below the workers so it never delays a real request
+    prefetchInit(priority + 2);
+    return 0;
+}
+
+static void stop_workers(void){
+    s32 count;
+    int i;
+
+    svcReleaseSemaphore(&count, g_job_sem, NUM_WORKERS);
+    for (i = 0; i < NUM_WORKERS; i++){
+        svcWaitSynchronization(g_workers[i], U64_MAX);
+        svcCloseHandle(g_workers[i]);
+    }
+    svcCloseHandle(g_handles[HANDLE_COMPLETION]);
+    svcCloseHandle(g_job_sem);
+    prefetchExit();
+}
+
+static void invalidate_cached_exheader(u64 prog_handle){
+    int i;
+
+    for (i = 0; i < MAX_SESSIONS; i++){
+        if (g_sessions[i].cached_prog_handle == prog_handle) g_sessions[i].cached_prog_handle = 0;
+    }
+    for (i = 0; i < MAX_JOBS; i++){
+        if (g_ctx[i].session && g_ctx[i].kind == LOADER_JOB_GETINFO && g_ctx[i].prog_handle == prog_handle) g_ctx[i].stale = 1;
+    }
+}
+
+// remembers which title a handle belongs to so its teardown can be ordered against later registers
+static void note_registration(u64 prog_handle, u64 progid){
+    prefetch_note_registered(prog_handle, progid);
+    if (g_registration_count == MAX_REGISTRATIONS) return;
+    g_registrations[g_registration_count].prog_handle = prog_handle;
+    g_registrations[g_registration_count].progid = progid;
+    g_registration_count++;
+}
+
+static int take_registration(u64 prog_handle, u64 *progid){
+    int i;
+
+    for (i = 0; i < g_registration_count; i++){
+        if (g_registrations[i].prog_handle == prog_handle){
+            *progid = g_registrations[i].progid;
+            g_registrations[i] = g_registrations[--g_registration_count];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+#ifdef LOADER_TRACE
+// what the LOADER_TRACE command record needs from the request, before the reply overwrites it
+static void trace_request(loader_session_t *session, u32 *cmdbuf){
+    int i;
+
+    session->trace_cmdid = cmdbuf[0] >> 16;
+    session->trace_received = svcGetSystemTick();
+    session->trace_prog_handle = 0;
+    session->trace_progid = 0;
+    session->trace_size = 0;
+    switch (session->trace_cmdid){
+        case 1: // LoadProcess
+        case 3: // UnregisterProgram
+        case 4: // GetProgramInfo
+        case 0x104: // DryRun
+        {
+            session->trace_prog_handle = *(u64 *)&cmdbuf[1];
+            for (i = 0; i < g_registration_count; i++){
+                if (g_registrations[i].prog_handle == session->trace_prog_handle) session->trace_progid = g_registrations[i].progid;
+            }
+            break;
+        }
+        case 2: // RegisterProgram
+        {
+            session->trace_progid = *(u64 *)&cmdbuf[1];
+            break;
+        }
+        case 0x103: // GetLaunchOrder
+        {
+            session->trace_size = cmdbuf[1];
+            break;
+        }
+    }
+}
+
+static void trace_reply(loader_session_t *session, u32 *cmdbuf){
+    if (session->trace_cmdid == 2 && cmdbuf[0] == 0x200C0) session->trace_prog_handle = *(u64 *)&cmdbuf[2];
+    TRACE_COMMAND(session->trace_cmdid, session->trace_prog_handle, session->trace_progid, cmdbuf[1], session->trace_size,
+        session->trace_received);
+}
+
+#define TRACE_REQUEST(session, cmdbuf) trace_request((session), (cmdbuf))
+#define TRACE_REPLY(session, cmdbuf) trace_reply((session), (cmdbuf))
+#define TRACE_SIZE(session, size) ((session)->trace_size = (size))
+#else
+#define TRACE_REQUEST(session, cmdbuf) do {} while (0)
+#define TRACE_REPLY(session, cmdbuf) do {} while (0)
+#define TRACE_SIZE(session, size) do {} while (0)
+#endif
+
+static int teardown_pending(u64 progid){
+    int i;
+
+    for (i = 0; i < MAX_JOBS; i++){
+        if (g_ctx[i].session && g_ctx[i].kind == LOADER_JOB_UNREGISTER && g_ctx[i].progid == progid) return 1;
+    }
+    return 0;
+}
+
+static void submit_job(loader_ctx_t *ctx){
+    s32 count;
+
+    g_jobs_inflight++;
+    queue_push(&g_pending, ctx);
+    svcReleaseSemaphore(&count, g_job_sem, 1);
+}
+
+// keeps up to BATCH_DEPTH titles of the session's batch with the workers
+static void dispatch_batch(loader_session_t *session){
+    loader_batch_t *batch;
+    loader_ctx_t *ctx;
+
+    batch = &session->batch;
+    while (batch->next < batch->count && batch->inflight < BATCH_DEPTH){
+        ctx = alloc_ctx(session, batch->prog_handles[batch->next]);
+        if (ctx == NULL) svcBreak(USERBREAK_ASSERT);
+        ctx->index = batch->next++;
+        attach_exheader(ctx);
+        if (session->cached_prog_handle == ctx->prog_handle){
+            memcpy(ctx->exheader, &session->exheader, sizeof(exheader_header));
+            ctx->exheader_valid = 1;
+            STATS_INC(g_stats->exheader_cache_hits);
+        }
+        else{
+            STATS_INC(g_stats->exheader_cache_misses);
+        }
+        batch->inflight++;
+        submit_job(ctx);
+    }
+}
+
+static void start_batch(loader_session_t *session, u16 cmdid, u32 count, u64 *prog_handles){
+    loader_batch_t *batch;
+    u32 i;
+
+    batch = &session->batch;
+    batch->cmdid = cmdid;
+    batch->count = count;
+    batch->next = 0;
+    batch->inflight = 0;
+    for (i = 0; i < count; i++){
+        batch->prog_handles[i] = prog_handles[i];
+        batch->results[i] = 0;
+        batch->processes[i] = 0;
+    }
+    dispatch_batch(session);
+}
+
+// returns non-zero when the request was handed to a worker and must not be replied to yet
+static int handle_commands(int index){
     u32* cmdbuf;
     u16 cmdid;
     int res;
-    Handle handle;
+    u32 count;
     u64 prog_handle;
+    loader_session_t *session;
+    loader_ctx_t *ctx;
 
+    session = g_handle_sessions[index];
     cmdbuf = getThreadCommandBuffer();
     cmdid = cmdbuf[0] >> 16;
     res = 0;
     switch (cmdid){
         case 1: // LoadProcess
         {
-          res = loader_LoadProcess(&handle, *(u64 *)&cmdbuf[1]);
-          cmdbuf[0] = 0x10042;
-          cmdbuf[1] = res;
-          cmdbuf[2] = 16;
-          cmdbuf[3] = handle;
-          break;
+          start_batch(session, cmdid, 1, (u64 *)&cmdbuf[1]);
+          park_session(index);
+          return 1;
+        }
+        case 0x102: // LoadProcessBatch
+        {
+          if (cmdbuf[1] == 0 || cmdbuf[1] > MAX_BATCH){
+            cmdbuf[0] = IPC_MakeHeader(0x102, 1, 0);
+            cmdbuf[1] = MAKERESULT(RL_PERMANENT, RS_INVALIDARG, RM_LDR, RD_OUT_OF_RANGE);
+            break;
+          }
+          start_batch(session, cmdid, cmdbuf[1], (u64 *)&cmdbuf[2]);
+          park_session(index);
+          return 1;
+        }
+        case 0x103: // GetLaunchOrder
+        {
+          count = cmdbuf[1]; // unsigned, a huge count must not pass as negative
+          if (count == 0 || count > DEPGRAPH_MAX_TITLES ||
+              cmdbuf[2] != IPC_Desc_Buffer(count * sizeof(u64), IPC_BUFFER_R) ||
+              cmdbuf[4] != IPC_Desc_Buffer(count, IPC_BUFFER_W)){
+            cmdbuf[0] = IPC_MakeHeader(0x103, 1, 0);
+            cmdbuf[1] = MAKERESULT(RL_PERMANENT, RS_INVALIDARG, RM_LDR, RD_INVALID_SIZE);
+            break;
+          }
+          ctx = alloc_ctx(session, 0);
+          if (ctx == NULL) svcBreak(USERBREAK_ASSERT);
+          ctx->kind = LOADER_JOB_LAUNCHORDER;
+          attach_exheader(ctx);
+          ctx->count = count;
+          ctx->prog_handles = (const u64 *)cmdbuf[3];
+          ctx->levels = (u8 *)cmdbuf[5];
+          ctx->level_count = 0;
+          park_session(index);
+          submit_job(ctx);
+          return 1;
+        }
+        case 0x104: // DryRun
+        {
+          prog_handle = *(u64 *)&cmdbuf[1];
+          ctx = alloc_ctx(session, prog_handle);
+          if (ctx == NULL) svcBreak(USERBREAK_ASSERT);
+          ctx->kind = LOADER_JOB_DRYRUN;
+          attach_exheader(ctx);
+          park_session(index);
+          submit_job(ctx);
+          return 1;
+        }
+        case 0x105: // ReloadPatches
+        {
+          // reads and indexes the whole file, loads keep running meanwhile
+          ctx = alloc_ctx(session, 0);
+          if (ctx == NULL) svcBreak(USERBREAK_ASSERT);
+          ctx->kind = LOADER_JOB_RELOADPATCHES;
+          park_session(index);
+          submit_job(ctx);
+          return 1;
         }
         case 2: // RegisterProgram
         {
-          memcpy(&title, &cmdbuf[1], sizeof(FS_ProgramInfo));
-          memcpy(&update, &cmdbuf[5], sizeof(FS_ProgramInfo));
-          res = loader_RegisterProgram(&prog_handle, &title, &update);
-          cmdbuf[0] = 0x200C0;
-          cmdbuf[1] = res;
-          *(u64 *)&cmdbuf[2] = prog_handle;
-          break;
+          memcpy(&session->register_title, &cmdbuf[1], sizeof(FS_ProgramInfo));
+          memcpy(&session->register_update, &cmdbuf[5], sizeof(FS_ProgramInfo));
+          park_session(index);
+          if (teardown_pending(session->register_title.programId)){
+            // the title's previous registration is still being torn down on a worker
+            session->register_waiting = 1;
+            STATS_INC(g_stats->registers_delayed);
+            return 1;
+          }
+          // fs:REG or PxiPM round trip
+          ctx = alloc_ctx(session, 0);
+          if (ctx == NULL) svcBreak(USERBREAK_ASSERT);
+          ctx->kind = LOADER_JOB_REGISTER;
+          submit_job(ctx);
+          return 1;
         }
         case 3: // UnregisterProgram
         {
-          if (g_cached_prog_handle == prog_handle)
-          {
-            g_cached_prog_handle = 0;
+          prog_handle = *(u64 *)&cmdbuf[1];
+          invalidate_cached_exheader(prog_handle);
+          ctx = alloc_ctx(session, prog_handle);
+          if (ctx == NULL) svcBreak(USERBREAK_ASSERT);
+          ctx->kind = LOADER_JOB_UNREGISTER;
+          // pm hardly ever looks at the result, so answer now and unload on a worker
+          if (take_registration(prog_handle, &ctx->progid) && g_teardowns_inflight < MAX_TEARDOWNS){
+            g_teardowns_inflight++;
+            submit_job(ctx);
+            STATS_INC(g_stats->unregisters_deferred);
+            cmdbuf[0] = 0x30040;
+            cmdbuf[1] = 0;
+            break;
           }
-          cmdbuf[0] = 0x30040;
-          cmdbuf[1] = loader_UnregisterProgram(*(u64 *)&cmdbuf[1]);
-          break;
+          // an unknown handle or too many unloads queued, answer once this one is done
+          ctx->reply = 1;
+          park_session(index);
+          submit_job(ctx);
+          return 1;
         }
         case 4: // GetProgramInfo
         {
           prog_handle = *(u64 *)&cmdbuf[1];
-          if (prog_handle != g_cached_prog_handle){
-            res = loader_GetProgramInfo(&g_exheader, prog_handle);
-            if (res >= 0)
-              g_cached_prog_handle = prog_handle;
-            else
-              g_cached_prog_handle = 0;
+          if (prog_handle != session->cached_prog_handle){
+            // only the cached exheader is answered here, a fetch goes to a worker
+            STATS_INC(g_stats->exheader_cache_misses);
+            ctx = alloc_ctx(session, prog_handle);
+            if (ctx == NULL) svcBreak(USERBREAK_ASSERT);
+            ctx->kind = LOADER_JOB_GETINFO;
+            attach_exheader(ctx);
+            session->cached_prog_handle = 0;
+            park_session(index);
+            submit_job(ctx);
+            return 1;
           }
-          memcpy(&g_ret_buf, &g_exheader, 1024);
+          STATS_INC(g_stats->exheader_cache_hits);
           cmdbuf[0] = 0x40042;
           cmdbuf[1] = res;
           cmdbuf[2] = 0x1000002;
-          cmdbuf[3] = (u32) &g_ret_buf;
+          cmdbuf[3] = (u32) &session->exheader;
+          break;
+        }
+        case 0x100: // GetStatsHandle
+        {
+          cmdbuf[0] = IPC_MakeHeader(0x100, 2, 2);
+          cmdbuf[1] = statsGetBlockHandle() ? 0 : MAKERESULT(RL_PERMANENT, RS_NOTSUPPORTED, RM_LDR, RD_NOT_FOUND);
+          cmdbuf[2] = STATS_BLOCK_SIZE;
+          cmdbuf[3] = IPC_Desc_SharedHandles(1);
+          cmdbuf[4] = statsGetBlockHandle();
+          break;
+        }
+        case 0x101: // GetMemoryStats
+        {
+          statsRefreshMemory();
+          cmdbuf[0] = IPC_MakeHeader(0x101, 6, 0);
+          cmdbuf[1] = 0;
+          cmdbuf[2] = g_stats->image_size;
+          cmdbuf[3] = g_stats->bss_size;
+          cmdbuf[4] = g_stats->stacks[0].used;
+          cmdbuf[5] = 0; // deepest worker
+          for (count = 1; count <= NUM_WORKERS; count++){
+            if (g_stats->stacks[count].used > cmdbuf[5]) cmdbuf[5] = g_stats->stacks[count].used;
+          }
+          cmdbuf[6] = WORKER_STACK_SIZE;
           break;
         }
         default: // error
@@ -334,6 +1021,155 @@ static void handle_commands(void){
           break;
         }
     }
+    return 0;
+}
+
+// collects a finished title, returns the session to answer once its whole batch is done
+static loader_session_t *complete_job(void){
+    loader_ctx_t *ctx;
+    loader_session_t *session;
+    loader_batch_t *batch;
+    u32 *cmdbuf;
+    u64 progid;
+    int reply;
+    u32 i;
+
+    ctx = queue_pop(&g_done);
+    if (ctx == NULL) svcBreak(USERBREAK_ASSERT);
+    session = ctx->session;
+    g_jobs_inflight--;
+    cmdbuf = getThreadCommandBuffer();
+
+    if (ctx->kind == LOADER_JOB_LAUNCHORDER){
+        // hand the mapped buffers back so the kernel unmaps them
+        cmdbuf[0] = IPC_MakeHeader(0x103, 2, 4);
+        cmdbuf[1] = ctx->res;
+        cmdbuf[2] = ctx->level_count;
+        cmdbuf[3] = IPC_Desc_Buffer(ctx->count * sizeof(u64), IPC_BUFFER_R);
+        cmdbuf[4] = (u32)ctx->prog_handles;
+        cmdbuf[5] = IPC_Desc_Buffer(ctx->count, IPC_BUFFER_W);
+        cmdbuf[6] = (u32)ctx->levels;
+        free_ctx(ctx);
+        unpark_session(session);
+        return session;
+    }
+
+    if (ctx->kind == LOADER_JOB_UNREGISTER){
+        progid = ctx->progid;
+        reply = ctx->reply;
+        if (reply){
+            cmdbuf[0] = 0x30040;
+            cmdbuf[1] = ctx->res;
+        }
+        else{
+            g_teardowns_inflight--;
+        }
+        free_ctx(ctx);
+        if (!teardown_pending(progid)){
+            // registers of the title that were held back run now, each answered when its job completes
+            for (i = 0; i < MAX_SESSIONS; i++){
+                if (!g_sessions[i].register_waiting || g_sessions[i].register_title.programId != progid) continue;
+                g_sessions[i].register_waiting = 0;
+                ctx = alloc_ctx(&g_sessions[i], 0);
+                if (ctx == NULL) svcBreak(USERBREAK_ASSERT);
+                ctx->kind = LOADER_JOB_REGISTER;
+                submit_job(ctx);
+            }
+        }
+        if (!reply) return NULL;
+        unpark_session(session);
+        return session;
+    }
+
+    if (ctx->kind == LOADER_JOB_GETINFO){
+        if (R_SUCCEEDED(ctx->res)){
+            memcpy(&session->exheader, ctx->exheader, sizeof(exheader_header));
+            if (!ctx->stale) session->cached_prog_handle = ctx->prog_handle;
+        }
+        cmdbuf[0] = 0x40042;
+        cmdbuf[1] = ctx->res;
+        cmdbuf[2] = 0x1000002;
+        cmdbuf[3] = (u32) &session->exheader;
+        free_ctx(ctx);
+        unpark_session(session);
+        return session;
+    }
+
+    if (ctx->kind == LOADER_JOB_REGISTER){
+        if (R_SUCCEEDED(ctx->res)) note_registration(ctx->prog_handle, session->register_title.programId);
+        cmdbuf[0] = 0x200C0;
+        cmdbuf[1] = ctx->res;
+        *(u64 *)&cmdbuf[2] = ctx->prog_handle;
+        free_ctx(ctx);
+        unpark_session(session);
+        return session;
+    }
+
+    if (ctx->kind == LOADER_JOB_DRYRUN){
+        cmdbuf[0] = IPC_MakeHeader(0x104, 8, 0);
+        cmdbuf[1] = ctx->res;
+        for (i = TRACE_STAGE_GETPROGRAMINFO; i <= TRACE_STAGE_PATCH; i++) cmdbuf[1 + i] = ctx->stage_ticks[i];
+        cmdbuf[7] = ctx->bytes_read;
+        cmdbuf[8] = ctx->bytes_decompressed;
+        TRACE_SIZE(session, ctx->bytes_read);
+        free_ctx(ctx);
+        unpark_session(session);
+        return session;
+    }
+
+    if (ctx->kind == LOADER_JOB_RELOADPATCHES){
+        cmdbuf[0] = IPC_MakeHeader(0x105, 3, 0);
+        cmdbuf[1] = ctx->res;
+        cmdbuf[2] = ctx->patch_records;
+        cmdbuf[3] = ctx->patch_bad_offset;
+        TRACE_SIZE(session, ctx->patch_records);
+        free_ctx(ctx);
+        unpark_session(session);
+        return session;
+    }
+
+    batch = &session->batch;
+    TRACE_SIZE(session, session->trace_size + ctx->bytes_read);
+    batch->results[ctx->index] = ctx->res;
+    batch->processes[ctx->index] = R_SUCCEEDED(ctx->res) ? ctx->process : 0;
+    batch->inflight--;
+    free_ctx(ctx);
+
+    dispatch_batch(session);
+    if (batch->inflight) return NULL;
+
+    if (batch->cmdid == 1){
+        cmdbuf[0] = 0x10042;
+        cmdbuf[1] = batch->results[0];
+        cmdbuf[2] = 16;
+        cmdbuf[3] = batch->processes[0];
+    }
+    else{
+        cmdbuf[0] = IPC_MakeHeader(0x102, 2 + batch->count, 1 + batch->count);
+        cmdbuf[1] = 0;
+        cmdbuf[2] = batch->count;
+        for (i = 0; i < batch->count; i++){
+            cmdbuf[3 + i] = batch->results[i];
+            cmdbuf[4 + batch->count + i] = batch->processes[i];
+        }
+        cmdbuf[3 + batch->count] = IPC_Desc_MoveHandles(batch->count);
+    }
+    unpark_session(session);
+    return session;
+}
+
+static loader_session_t *alloc_session(Handle handle){
+    int i;
+
+    for (i = 0; i < MAX_SESSIONS; i++){
+        if (g_sessions[i].handle == 0){
+            g_sessions[i].handle = handle;
+            g_sessions[i].cached_prog_handle = 0;
+            g_sessions[i].register_waiting = 0;
+            return &g_sessions[i];
+        }
+    }
+    return NULL;
 }
 
 static Result should_terminate(int *term_request){
@@ -346,20 +1182,35 @@ static Result should_terminate(int *term_request){
     return 0;
 }
 
-// this is called before main
+// this is called before main, everything beyond srv is brought up once "Loader" is registered
 void __appInit(void){
+    statsInit();
     srvSysInit();
+}
+
+// fs:LDR and PxiPM only connect on first use
+static void init_services(void){
     fsregInit();
     fsldrInit();
     pxipmInit();
+    arenaInit();
+    depgraphInit();
+    overridesInit();
+    patchdbInit();
+    TRACE_INIT();
+    statsRegisterFootprint(STAT_MODULE_LOADER, sizeof(g_handles) + sizeof(g_handle_sessions) + sizeof(g_sessions) +
+        sizeof(g_ctx) + sizeof(g_worker_stacks));
 }
 
 // this is called after main exits
 void __appExit(void){
+    TRACE_FLUSH_ALL();
+    patchdbExit();
     pxipmExit();
     fsldrExit();
     fsregExit();
     srvSysExit();
+    statsExit();
 }
 
 // stubs for non-needed pre-main functions
@@ -385,17 +1236,25 @@ int main(int argc, char **argv){
     Handle reply_target;
     Handle *srv_handle;
     Handle *notification_handle;
+    loader_session_t *session;
     s32 index;
     int i, term_request;
     u32* cmdbuf;
 
-    srv_handle = &g_handles[1];
-    notification_handle = &g_handles[0];
+    // paint what is below us now, the frames above are live
+    statsPaintStack(MAIN_STACK_TOP - MAIN_STACK_SIZE, ((u32)&index & ~3) - 0x100 - (MAIN_STACK_TOP - MAIN_STACK_SIZE));
+    statsRegisterStack(0, MAIN_STACK_TOP - MAIN_STACK_SIZE, MAIN_STACK_SIZE);
+
+    srv_handle = &g_handles[HANDLE_PORT];
+    notification_handle = &g_handles[HANDLE_NOTIFICATION];
     if (R_FAILED(srvSysRegisterService(srv_handle, "Loader", MAX_SESSIONS))) svcBreak(USERBREAK_ASSERT);
     if (R_FAILED(srvSysEnableNotification(notification_handle))) svcBreak(USERBREAK_ASSERT);
+    init_services();
+    if (R_FAILED(start_workers())) svcBreak(USERBREAK_ASSERT);
 
-    g_active_handles = 2;
-    g_cached_prog_handle = 0;
+    g_active_handles = HANDLE_FIRST_SESSION;
+    g_jobs_inflight = 0;
+    g_teardowns_inflight = 0;
     index = 1;
 
     reply_target = 0;
@@ -406,13 +1265,16 @@ int main(int argc, char **argv){
         cmdbuf = getThreadCommandBuffer();
         cmdbuf[0] = 0xFFFF0000;
     }
+    else{
+        statsMarkReply();
+    }
     ret = svcReplyAndReceive(&index, g_handles, g_active_handles, reply_target);
 
     if (R_FAILED(ret)){
         // check if any handle has been closed
         if (ret == (Result)0xC920181A){
             if (index == -1){
-                for (i = 2; i < MAX_SESSIONS+2; i++){
+                for (i = HANDLE_FIRST_SESSION; i < g_active_handles; i++){
                     if (g_handles[i] == reply_target){
                         index = i;
                         break;
@@ -420,7 +1282,9 @@ int main(int argc, char **argv){
                 }
             }
             svcCloseHandle(g_handles[index]);
+            g_handle_sessions[index]->handle = 0;
             g_handles[index] = g_handles[g_active_handles-1];
+            g_handle_sessions[index] = g_handle_sessions[g_active_handles-1];
             g_active_handles--;
             reply_target = 0;
         }
@@ -432,18 +1296,20 @@ int main(int argc, char **argv){
         // process responses
         reply_target = 0;
         switch (index){
-            case 0: // notification
+            case HANDLE_NOTIFICATION:
             {
                 if (R_FAILED(should_terminate(&term_request))) svcBreak(USERBREAK_ASSERT);
                 break;
             }
-            case 1: // new session
+            case HANDLE_PORT: // new session
             {
                 if (R_FAILED(svcAcceptSession(&handle, *srv_handle))){
                     svcBreak(USERBREAK_ASSERT);
                 }
-                if (g_active_handles < MAX_SESSIONS+2){
+                session = alloc_session(handle);
+                if (session){
                     g_handles[g_active_handles] = handle;
+                    g_handle_sessions[g_active_handles] = session;
                     g_active_handles++;
                 }
                 else{
@@ -451,16 +1317,30 @@ int main(int argc, char **argv){
                 }
                 break;
             }
+            case HANDLE_COMPLETION: // a worker finished a request
+            {
+                session = complete_job();
+                if (session){
+                    reply_target = session->handle;
+                    TRACE_REPLY(session, getThreadCommandBuffer());
+                }
+                break;
+            }
             default: // session
             {
-                handle_commands();
-                reply_target = g_handles[index];
+                session = g_handle_sessions[index];
+                TRACE_REQUEST(session, getThreadCommandBuffer());
+                if (!handle_commands(index)){
+                    reply_target = session->handle;
+                    TRACE_REPLY(session, getThreadCommandBuffer());
+                }
                 break;
             }
         }
     }
-    } while (!term_request || g_active_handles != 2);
+    } while (!term_request || g_active_handles != HANDLE_FIRST_SESSION || g_jobs_inflight);
     
+    stop_workers();
     srvSysUnregisterService("Loader");
     svcCloseHandle(*srv_handle);
     svcCloseHandle(*notification_handle);
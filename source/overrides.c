@@ -0,0 +1,195 @@
+#include <3ds.h>
+#include <string.h>
+#include "overrides.h"
+#include "ifile.h"
+#include "stats.h"
+
+// arm11systemlocalcaps.flags
+#define FLAGS_N3DS_CPU 4 // bit 0 L2 cache, bit 1 804 MHz
+#define FLAGS_N3DS_MODE 5 // bits 0-3
+#define FLAGS_O3DS_MODE 6 // bits 4-7, the rest is ideal processor and affinity
+
+#define CPU_TIME_MAX 89 // pm refuses to give an application core more than this
+#define HANDLE_TABLE_MIN 0x20
+#define HANDLE_TABLE_MAX 0x400 // keeps one title from draining the kernel's handle slab
+
+// arm11 kernel capability descriptors, told apart by their leading ones
+#define DESC_HANDLE_TABLE_MASK 0xFF000000
+#define DESC_HANDLE_TABLE 0xFE000000 // size in bits 0-18
+#define DESC_KERNEL_FLAGS_MASK 0xFF800000
+#define DESC_KERNEL_FLAGS 0xFF000000 // memory type in bits 8-11
+
+static override_t g_overrides[OVERRIDES_MAX_TITLES];
+static u32 g_count;
+static int g_loaded;
+static LightLock g_lock;
+
+void overridesInit(void){
+    LightLock_Init(&g_lock);
+    statsRegisterFootprint(STAT_MODULE_OVERRIDES, sizeof(g_overrides));
+}
+
+int override_valid(u32 key, u32 value){
+    switch (key){
+        case OVERRIDE_L2_CACHE:
+        case OVERRIDE_CPU_804MHZ:
+            return value <= 1;
+        case OVERRIDE_N3DS_MODE:
+            return value <= 3;
+        case OVERRIDE_O3DS_MODE:
+            return value <= 5 && value != 1;
+        case OVERRIDE_CPU_TIME:
+            return value <= CPU_TIME_MAX;
+        case OVERRIDE_RESLIMIT_CATEGORY:
+            return value <= 3;
+        case OVERRIDE_HANDLE_TABLE:
+            return value >= HANDLE_TABLE_MIN && value <= HANDLE_TABLE_MAX;
+        case OVERRIDE_MEMORY_TYPE:
+            return value >= 1 && value <= 3;
+    }
+    return 0;
+}
+
+static u8 set_bits(u8 flags, u8 mask, u8 bits){
+    return (flags & ~mask) | (bits & mask);
+}
+
+static int find_descriptor(const exheader_header *exheader, u32 mask, u32 prefix){
+    int i;
+
+    for (i = 0; i < 28; i++){
+        if ((exheader->arm11kernelcaps.descriptors[i] & mask) == prefix) return i;
+    }
+    return -1;
+}
+
+// everything is worked out and checked first, the exheader is either fully patched or left alone
+int override_patch_exheader(exheader_header *exheader, const override_t *ovr){
+    exheader_arm11systemlocalcaps *caps = &exheader->arm11systemlocalcaps;
+    u8 cpu, n3ds_mode, o3ds_mode, category;
+    u16 cpu_time;
+    int handle_desc, flags_desc;
+    u32 handle_value, flags_value, key;
+
+    for (key = 0; key < OVERRIDE_KEY_COUNT; key++){
+        if ((ovr->present & (1 << key)) && !override_valid(key, ovr->values[key])) return 0;
+    }
+
+    cpu = caps->flags[FLAGS_N3DS_CPU];
+    n3ds_mode = caps->flags[FLAGS_N3DS_MODE];
+    o3ds_mode = caps->flags[FLAGS_O3DS_MODE];
+    category = caps->resourcelimitcategory;
+    cpu_time = caps->resourcelimitdescriptor[0];
+    if (ovr->present & (1 << OVERRIDE_L2_CACHE)) cpu = set_bits(cpu, 0x01, ovr->values[OVERRIDE_L2_CACHE]);
+    if (ovr->present & (1 << OVERRIDE_CPU_804MHZ)) cpu = set_bits(cpu, 0x02, ovr->values[OVERRIDE_CPU_804MHZ] << 1);
+    if (ovr->present & (1 << OVERRIDE_N3DS_MODE)) n3ds_mode = set_bits(n3ds_mode, 0x0F, ovr->values[OVERRIDE_N3DS_MODE]);
+    if (ovr->present & (1 << OVERRIDE_O3DS_MODE)) o3ds_mode = set_bits(o3ds_mode, 0xF0, ovr->values[OVERRIDE_O3DS_MODE] << 4);
+    if (ovr->present & (1 << OVERRIDE_RESLIMIT_CATEGORY)) category = ovr->values[OVERRIDE_RESLIMIT_CATEGORY];
+    if (ovr->present & (1 << OVERRIDE_CPU_TIME)) cpu_time = ovr->values[OVERRIDE_CPU_TIME];
+
+    // capabilities are only rewritten in place, a title without the descriptor keeps the kernel default
+    handle_desc = -1;
+    handle_value = 0;
+    if (ovr->present & (1 << OVERRIDE_HANDLE_TABLE)){
+        if ((handle_desc = find_descriptor(exheader, DESC_HANDLE_TABLE_MASK, DESC_HANDLE_TABLE)) < 0) return 0;
+        handle_value = (exheader->arm11kernelcaps.descriptors[handle_desc] & ~0x7FFFF) | ovr->values[OVERRIDE_HANDLE_TABLE];
+    }
+    flags_desc = -1;
+    flags_value = 0;
+    if (ovr->present & (1 << OVERRIDE_MEMORY_TYPE)){
+        if ((flags_desc = find_descriptor(exheader, DESC_KERNEL_FLAGS_MASK, DESC_KERNEL_FLAGS)) < 0) return 0;
+        flags_value = (exheader->arm11kernelcaps.descriptors[flags_desc] & ~0xF00) | (ovr->values[OVERRIDE_MEMORY_TYPE] << 8);
+    }
+
+    // each value was checked on its own, the combination has to make sense too
+    if ((ovr->present & (1 << OVERRIDE_CPU_TIME)) && category != 0) return 0; // only applications have a core time limit
+
+    caps->flags[FLAGS_N3DS_CPU] = cpu;
+    caps->flags[FLAGS_N3DS_MODE] = n3ds_mode;
+    caps->flags[FLAGS_O3DS_MODE] = o3ds_mode;
+    caps->resourcelimitcategory = category;
+    caps->resourcelimitdescriptor[0] = cpu_time;
+    if (handle_desc >= 0) exheader->arm11kernelcaps.descriptors[handle_desc] = handle_value;
+    if (flags_desc >= 0) exheader->arm11kernelcaps.descriptors[flags_desc] = flags_value;
+    return 1;
+}
+
+static int find_title(u64 progid, int *pos){
+    int lo, hi, mid;
+
+    lo = 0;
+    hi = g_count - 1;
+    while (lo <= hi){
+        mid = (lo + hi) / 2;
+        if (g_overrides[mid].progid == progid){
+            *pos = mid;
+            return 1;
+        }
+        if (g_overrides[mid].progid < progid) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    *pos = lo;
+    return 0;
+}
+
+static void add_entry(const overrides_file_entry_t *entry){
+    override_t *ovr;
+    int pos;
+
+    if (entry->key >= OVERRIDE_KEY_COUNT || !override_valid(entry->key, entry->value)) return;
+    if (!find_title(entry->progid, &pos)){
+        if (g_count == OVERRIDES_MAX_TITLES) return;
+        memmove(&g_overrides[pos + 1], &g_overrides[pos], (g_count - pos) * sizeof(override_t));
+        memset(&g_overrides[pos], 0, sizeof(override_t));
+        g_overrides[pos].progid = entry->progid;
+        g_count++;
+    }
+    ovr = &g_overrides[pos];
+    ovr->present |= 1 << entry->key;
+    ovr->values[entry->key] = entry->value;
+}
+
+static void load(void){
+    overrides_file_header_t header;
+    overrides_file_entry_t entries[16];
+    IFile file;
+    FS_Path apath;
+    FS_Path ppath;
+    u64 total;
+    u32 left, n, i;
+
+    apath.type = PATH_EMPTY;
+    apath.size = 1;
+    apath.data = (u8 *)"";
+    ppath.type = PATH_ASCII;
+    ppath.data = OVERRIDES_PATH;
+    ppath.size = sizeof(OVERRIDES_PATH);
+    if (R_FAILED(IFile_Open(&file, ARCHIVE_SDMC, apath, ppath, FS_OPEN_READ))) return;
+    if (R_FAILED(IFile_Read(&file, &total, &header, sizeof(header))) || total != sizeof(header) ||
+        header.magic != OVERRIDES_MAGIC || header.version != OVERRIDES_VERSION){
+        IFile_Close(&file);
+        return;
+    }
+    for (left = header.count; left; left -= n){
+        n = (left < 16) ? left : 16;
+        if (R_FAILED(IFile_Read(&file, &total, entries, n * sizeof(entries[0]))) || total != n * sizeof(entries[0])) break;
+        for (i = 0; i < n; i++) add_entry(&entries[i]);
+    }
+    STATS_ADD(g_stats->bytes_read, file.pos);
+    IFile_Close(&file);
+}
+
+void overrides_apply(exheader_header *exheader){
+    int pos;
+
+    LightLock_Lock(&g_lock);
+    if (!g_loaded){
+        load();
+        g_loaded = 1;
+    }
+    if (find_title(exheader->arm11systemlocalcaps.programid, &pos)){
+        if (override_patch_exheader(exheader, &g_overrides[pos])) STATS_INC(g_stats->overrides_applied);
+        else STATS_INC(g_stats->overrides_rejected);
+    }
+    LightLock_Unlock(&g_lock);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <3ds/types.h>
+#include "exheader.h"
+
+// Per-title exheader overrides from the SD card. The file is read once, on
+// the first load that asks, and kept as a sorted table in memory. Overrides
+// are applied where the exheader is fetched so pm sees the same values in
+// GetProgramInfo as the process gets.
+
+#define OVERRIDES_PATH "/rei/overrides.dat"
+#define OVERRIDES_MAGIC 0x52564F4C // "LOVR"
+#define OVERRIDES_VERSION 1
+#define OVERRIDES_MAX_TITLES 64
+
+typedef enum{
+    OVERRIDE_L2_CACHE = 0, // 0 off, 1 on, New 3DS only
+    OVERRIDE_CPU_804MHZ, // 0 268 MHz, 1 804 MHz, New 3DS only
+    OVERRIDE_N3DS_MODE, // memory layout on New 3DS: 0 legacy, 1 prod, 2 dev1, 3 dev2
+    OVERRIDE_O3DS_MODE, // memory layout on Old 3DS: 0 prod, 2 dev1, 3 dev2, 4 dev3, 5 dev4
+    OVERRIDE_CPU_TIME, // resourcelimitdescriptor[0], app core time limit in percent
+    OVERRIDE_RESLIMIT_CATEGORY, // 0 application, 1 system applet, 2 library applet, 3 other
+    OVERRIDE_HANDLE_TABLE, // handle table size kernel capability
+    OVERRIDE_MEMORY_TYPE, // kernel flags capability: 1 application, 2 system, 3 base
+    OVERRIDE_KEY_COUNT
+} override_key_t;
+
+typedef struct{
+    u32 magic;
+    u16 version;
+    u16 count;
+} PACKED overrides_file_header_t;
+
+// one value for one title, keys this build does not know are skipped
+typedef struct{
+    u64 progid;
+    u16 key;
+    u16 reserved;
+    u32 value;
+} PACKED overrides_file_entry_t;
+
+typedef struct{
+    u64 progid;
+    u16 present; // 1 << key for every key set
+    u16 values[OVERRIDE_KEY_COUNT];
+} override_t;
+
+void overridesInit(void);
+int override_valid(u32 key, u32 value);
+int override_patch_exheader(exheader_header *exheader, const override_t *ovr);
+void overrides_apply(exheader_header *exheader);
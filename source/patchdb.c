@@ -0,0 +1,436 @@
+#include <3ds.h>
+#include <stdlib.h>
+#include <string.h>
+#include "patchdb.h"
+#include "ifile.h"
+#include "stats.h"
+
+// patches.dat is either the original format, a bare list of
+//   u64 progid, u8 pattern_len, u8 patch_len, s8 offset, s8 count, pattern, patch
+// or a patch_file_header_t followed by
+//   u64 progid, u8 pattern_len, u8 patch_len, s8 offset, s8 count, u8 flags,
+//   [u8 anchor, u32 window if PATCH_FLAG_ANCHORED],
+//   [u64 mask if PATCH_FLAG_MASKED, u64 last progid if PATCH_FLAG_RANGE],
+//   pattern, [bitmask if PATCH_FLAG_BITMASK], patch
+
+#define PAGE_ALIGN(x) (((x) + 0xFFF) & ~0xFFF)
+
+typedef struct{
+    u32 pattern; // offsets into the file image, a bitmask sits right after the pattern
+    u32 replace;
+    u8 patlen;
+    u8 replen;
+    s8 offset;
+    s8 count;
+    s16 anchor;
+    u8 align;
+    u8 masked;
+    u32 window;
+} patchdb_record_t;
+
+typedef struct{
+    u64 value; // already masked
+    u16 group;
+    u16 record;
+    u32 reserved;
+} patchdb_key_t;
+
+typedef struct{
+    u64 mask;
+    u32 start;
+    u32 count;
+} patchdb_group_t;
+
+typedef struct{
+    u64 first;
+    u64 last;
+    u64 max_last; // over this range and every one sorted before it
+    u16 record;
+    u16 reserved[3];
+} patchdb_range_t;
+
+struct patchdb{
+    u8 *data; // the whole file, patterns are read from here
+    u32 data_size;
+    u32 index_size;
+    patchdb_record_t *records;
+    patchdb_key_t *keys;
+    patchdb_range_t *ranges;
+    u32 num_records;
+    u32 num_keys;
+    u32 num_ranges;
+    u32 num_groups;
+    u32 bad_offset; // of the record parsing stopped at, PATCHDB_NO_ERROR if it did not
+    patchdb_group_t groups[PATCHDB_MAX_MASKS];
+};
+
+// Two generations, each in its own PATCHDB_MAX_SIZE of heap. Lookups pin the
+// current one, a reload builds the other and flips g_current, and the old one
+// is freed once the last load still using it lets go.
+static patchdb_t g_dbs[PATCHDB_SLOTS];
+static u32 g_refs[PATCHDB_SLOTS];
+static int g_current; // slot handed out by patchdb_acquire, -1 until the first load
+static int g_reloading;
+static LightLock g_lock;
+
+void patchdbInit(void){
+    LightLock_Init(&g_lock);
+    g_current = -1;
+    statsRegisterFootprint(STAT_MODULE_PATCHDB, sizeof(g_dbs));
+}
+
+static int add_group(patchdb_t *db, u64 mask){
+    u32 i;
+
+    for (i = 0; i < db->num_groups; i++){
+        if (db->groups[i].mask == mask) return i;
+    }
+    if (db->num_groups == PATCHDB_MAX_MASKS) return -1;
+    db->groups[db->num_groups].mask = mask;
+    return db->num_groups++;
+}
+
+// counts the records on the first pass, fills the arrays once they exist, stops at the first bad record
+static int parse(patchdb_t *db, int fill, u32 limit){
+    patch_file_header_t header;
+    patchdb_record_t *rec;
+    u8 *start;
+    u8 *p = db->data;
+    u8 *end = db->data + db->data_size;
+    u8 fields[5];
+    u64 progid, arg;
+    int versioned;
+    int group;
+    u32 align, masklen;
+
+    db->num_records = 0;
+    db->num_keys = 0;
+    db->num_ranges = 0;
+    db->num_groups = 0;
+    db->bad_offset = PATCHDB_NO_ERROR;
+    versioned = 0;
+    start = p;
+    if (db->data_size >= sizeof(header)){
+        memcpy(&header, p, sizeof(header));
+        if (header.magic == PATCH_FILE_MAGIC){
+            if (header.version != PATCH_FILE_VERSION) goto bad;
+            versioned = 1;
+            p += sizeof(header);
+        }
+    }
+
+    while (p < end){
+        start = p;
+        if (db->num_records == limit) goto bad;
+        if (end - p < 8 + (versioned ? 5 : 4)) goto bad;
+        memcpy(&progid, p, 8);
+        fields[4] = 0;
+        memcpy(fields, p + 8, versioned ? 5 : 4);
+        p += 8 + (versioned ? 5 : 4);
+
+        rec = fill ? &db->records[db->num_records] : NULL;
+        if (fields[0] == 0) goto bad; // an empty pattern matches everywhere
+        if (fields[4] & ~(PATCH_FLAG_ANCHORED | PATCH_FLAG_MASKED | PATCH_FLAG_RANGE | PATCH_FLAG_ALIGN2 | PATCH_FLAG_ALIGN4 |
+            PATCH_FLAG_BITMASK)) goto bad;
+        if ((fields[4] & PATCH_FLAG_MASKED) && (fields[4] & PATCH_FLAG_RANGE)) goto bad;
+        if ((fields[4] & PATCH_FLAG_ALIGN2) && (fields[4] & PATCH_FLAG_ALIGN4)) goto bad;
+        align = (fields[4] & PATCH_FLAG_ALIGN4) ? 4 : (fields[4] & PATCH_FLAG_ALIGN2) ? 2 : 1;
+        // the aligned matcher compares whole halfwords or words
+        if (fields[0] % align || ((fields[4] & PATCH_FLAG_BITMASK) && align == 1)) goto bad;
+        masklen = (fields[4] & PATCH_FLAG_BITMASK) ? fields[0] : 0;
+        if (masklen > PATCH_MAX_MASKED_LEN) goto bad;
+        if (rec){
+            rec->anchor = PATCH_NO_ANCHOR;
+            rec->window = 0;
+        }
+        if (fields[4] & PATCH_FLAG_ANCHORED){
+            if (end - p < 5) goto bad;
+            if (rec){
+                rec->anchor = p[0];
+                rec->window = p[1] | p[2] << 8 | p[3] << 16 | (u32)p[4] << 24;
+            }
+            p += 5;
+        }
+        arg = ~0ULL; // exact key
+        if (fields[4] & (PATCH_FLAG_MASKED | PATCH_FLAG_RANGE)){
+            if (end - p < 8) goto bad;
+            memcpy(&arg, p, 8);
+            p += 8;
+        }
+        if (end - p < fields[0] + masklen + fields[1]) goto bad;
+        if (rec){
+            rec->pattern = p - db->data;
+            rec->replace = rec->pattern + fields[0] + masklen;
+            rec->patlen = fields[0];
+            rec->replen = fields[1];
+            rec->offset = fields[2];
+            rec->count = fields[3];
+            rec->align = align;
+            rec->masked = masklen != 0;
+        }
+        p += fields[0] + masklen + fields[1];
+
+        if (fields[4] & PATCH_FLAG_RANGE){
+            if (arg < progid) goto bad;
+            if (fill){
+                db->ranges[db->num_ranges].first = progid;
+                db->ranges[db->num_ranges].last = arg;
+                db->ranges[db->num_ranges].record = db->num_records;
+            }
+            db->num_ranges++;
+        }
+        else{
+            if ((group = add_group(db, arg)) < 0) goto bad;
+            if (fill){
+                db->keys[db->num_keys].value = progid & arg;
+                db->keys[db->num_keys].group = group;
+                db->keys[db->num_keys].record = db->num_records;
+            }
+            db->num_keys++;
+        }
+        db->num_records++;
+    }
+    return 0;
+
+    bad:
+    db->bad_offset = start - db->data;
+    return -1;
+}
+
+static int cmp_key(const void *a, const void *b){
+    const patchdb_key_t *x = a, *y = b;
+
+    if (x->group != y->group) return x->group < y->group ? -1 : 1;
+    if (x->value != y->value) return x->value < y->value ? -1 : 1;
+    return 0;
+}
+
+static int cmp_range(const void *a, const void *b){
+    const patchdb_range_t *x = a, *y = b;
+
+    if (x->first != y->first) return x->first < y->first ? -1 : 1;
+    return 0;
+}
+
+static void build_index(patchdb_t *db){
+    u32 i;
+    u64 max_last;
+
+    qsort(db->keys, db->num_keys, sizeof(patchdb_key_t), cmp_key);
+    for (i = 0; i < db->num_groups; i++) db->groups[i].count = 0;
+    for (i = 0; i < db->num_keys; i++){
+        if (db->groups[db->keys[i].group].count++ == 0) db->groups[db->keys[i].group].start = i;
+    }
+
+    qsort(db->ranges, db->num_ranges, sizeof(patchdb_range_t), cmp_range);
+    max_last = 0;
+    for (i = 0; i < db->num_ranges; i++){
+        if (db->ranges[i].last > max_last) max_last = db->ranges[i].last;
+        db->ranges[i].max_last = max_last;
+    }
+}
+
+static void unload(patchdb_t *db){
+    u32 dummy;
+
+    if (db->index_size) svcControlMemory(&dummy, (u32)(uintptr_t)db->data + db->data_size, 0, db->index_size, MEMOP_FREE, 0);
+    if (db->data_size) svcControlMemory(&dummy, (u32)(uintptr_t)db->data, 0, db->data_size, MEMOP_FREE, 0);
+    memset(db, 0, sizeof(*db));
+}
+
+// A truncated or malformed file keeps the patches before the bad record, like
+// the old reader did, unless strict is set. *bad_offset is where parsing
+// stopped and *parsed how many records came before it.
+static Result load(patchdb_t *db, u32 base, int strict, u32 *parsed, u32 *bad_offset){
+    IFile file;
+    FS_Path apath;
+    FS_Path ppath;
+    u64 size, total;
+    u32 addr, index_size;
+    Result res;
+
+    memset(db, 0, sizeof(*db));
+    *parsed = 0;
+    *bad_offset = PATCHDB_NO_ERROR;
+    apath.type = PATH_EMPTY;
+    apath.size = 1;
+    apath.data = (u8 *)"";
+    ppath.type = PATH_ASCII;
+    ppath.data = PATCHDB_PATH;
+    ppath.size = sizeof(PATCHDB_PATH);
+    if (R_FAILED(res = IFile_Open(&file, ARCHIVE_SDMC, apath, ppath, FS_OPEN_READ))) return res;
+    if (R_FAILED(res = IFile_GetSize(&file, &size))) goto end;
+    if (size == 0) goto end; // no patches
+    if (size > PATCHDB_MAX_SIZE){
+        res = PATCHDB_ERR_TOO_LARGE;
+        goto end;
+    }
+    if (R_FAILED(res = svcControlMemory(&addr, base, 0, PAGE_ALIGN(size), MEMOP_ALLOC, MEMPERM_READ | MEMPERM_WRITE))) goto end;
+    db->data = (u8 *)(uintptr_t)addr;
+    db->data_size = PAGE_ALIGN(size);
+    if (R_SUCCEEDED(res = IFile_Read(&file, &total, db->data, size)) && total != size) res = PATCHDB_ERR_SHORT_READ;
+    if (R_FAILED(res)) goto end;
+    STATS_ADD(g_stats->bytes_read, total);
+
+    db->data_size = size; // parse the file, not the page padding
+    parse(db, 0, 0xFFFF);
+    db->data_size = PAGE_ALIGN(size);
+    *parsed = db->num_records;
+    *bad_offset = db->bad_offset;
+    if (strict && db->bad_offset != PATCHDB_NO_ERROR){
+        res = PATCHDB_ERR_MALFORMED;
+        goto end;
+    }
+    if (db->num_records == 0){
+        unload(db);
+        goto end;
+    }
+    index_size = PAGE_ALIGN(db->num_records * sizeof(patchdb_record_t) + db->num_keys * sizeof(patchdb_key_t) +
+        db->num_ranges * sizeof(patchdb_range_t));
+    if (db->data_size + index_size > PATCHDB_MAX_SIZE){
+        res = PATCHDB_ERR_TOO_LARGE;
+        goto end;
+    }
+    if (R_FAILED(res = svcControlMemory(&addr, base + db->data_size, 0, index_size, MEMOP_ALLOC, MEMPERM_READ | MEMPERM_WRITE))) goto end;
+    db->index_size = index_size;
+    db->records = (patchdb_record_t *)(uintptr_t)addr;
+    db->keys = (patchdb_key_t *)(db->records + db->num_records);
+    db->ranges = (patchdb_range_t *)(db->keys + db->num_keys);
+
+    db->data_size = size;
+    parse(db, 1, db->num_records);
+    db->data_size = PAGE_ALIGN(size);
+    build_index(db);
+
+    end:
+    if (R_FAILED(res)) unload(db);
+    IFile_Close(&file);
+    return res;
+}
+
+void patchdbExit(void){
+    int i;
+
+    LightLock_Lock(&g_lock);
+    for (i = 0; i < PATCHDB_SLOTS; i++) unload(&g_dbs[i]);
+    g_current = -1;
+    LightLock_Unlock(&g_lock);
+}
+
+patchdb_t *patchdb_acquire(void){
+    patchdb_t *db;
+    u32 parsed, bad_offset;
+
+    LightLock_Lock(&g_lock);
+    if (g_current < 0){
+        load(&g_dbs[0], PATCHDB_ADDR, 0, &parsed, &bad_offset);
+        g_current = 0;
+    }
+    db = &g_dbs[g_current];
+    g_refs[g_current]++;
+    LightLock_Unlock(&g_lock);
+    return db;
+}
+
+void patchdb_release(patchdb_t *db){
+    int slot = db - g_dbs;
+
+    LightLock_Lock(&g_lock);
+    // the last load still on a replaced generation frees it
+    if (--g_refs[slot] == 0 && slot != g_current) unload(db);
+    LightLock_Unlock(&g_lock);
+}
+
+Result patchdb_reload(u32 *num_records, u32 *bad_offset){
+    int slot, old;
+    Result res;
+
+    *num_records = 0;
+    *bad_offset = PATCHDB_NO_ERROR;
+    // the first load happens under the lock, so it never races the reload for a slot
+    patchdb_release(patchdb_acquire());
+    LightLock_Lock(&g_lock);
+    slot = (g_current == 0) ? 1 : 0;
+    if (g_reloading || g_refs[slot]){
+        LightLock_Unlock(&g_lock);
+        return PATCHDB_ERR_BUSY;
+    }
+    g_reloading = 1;
+    LightLock_Unlock(&g_lock);
+
+    res = load(&g_dbs[slot], PATCHDB_ADDR + slot * PATCHDB_MAX_SIZE, 1, num_records, bad_offset);
+
+    LightLock_Lock(&g_lock);
+    if (R_SUCCEEDED(res)){
+        old = g_current;
+        g_current = slot; // loads from here on get the new patches
+        if (old >= 0 && g_refs[old] == 0) unload(&g_dbs[old]);
+        STATS_INC(g_stats->patchdb_reloads);
+    }
+    else{
+        STATS_INC(g_stats->patchdb_reloads_rejected);
+    }
+    g_reloading = 0;
+    LightLock_Unlock(&g_lock);
+    return res;
+}
+
+static void add_match(u16 *records, int *n, int max, u16 record){
+    int i;
+
+    if (*n == max) return;
+    // keep file order, that is the order patches are applied in
+    for (i = *n; i > 0 && records[i - 1] > record; i--) records[i] = records[i - 1];
+    records[i] = record;
+    (*n)++;
+}
+
+// the generation is pinned by the caller and never changes, no lock needed
+int patchdb_lookup(patchdb_t *db, u64 progid, u16 *records, int max){
+    patchdb_group_t *group;
+    u64 value;
+    int lo, hi, mid, n;
+    u32 g;
+
+    n = 0;
+    for (g = 0; g < db->num_groups; g++){
+        group = &db->groups[g];
+        value = progid & group->mask;
+        lo = group->start;
+        hi = group->start + group->count;
+        while (lo < hi){
+            mid = (lo + hi) / 2;
+            if (db->keys[mid].value < value) lo = mid + 1;
+            else hi = mid;
+        }
+        for (; lo < (int)(group->start + group->count) && db->keys[lo].value == value; lo++) add_match(records, &n, max, db->keys[lo].record);
+    }
+
+    // ranges starting at or before progid, walking back until none of the earlier ones reach it
+    lo = 0;
+    hi = db->num_ranges;
+    while (lo < hi){
+        mid = (lo + hi) / 2;
+        if (db->ranges[mid].first <= progid) lo = mid + 1;
+        else hi = mid;
+    }
+    for (lo--; lo >= 0 && db->ranges[lo].max_last >= progid; lo--){
+        if (db->ranges[lo].last >= progid) add_match(records, &n, max, db->ranges[lo].record);
+    }
+    return n;
+}
+
+void patchdb_get(patchdb_t *db, u16 record, patch_t *patch){
+    patchdb_record_t *rec = &db->records[record];
+
+    patch->pattern = db->data + rec->pattern;
+    patch->patlen = rec->patlen;
+    patch->replace = db->data + rec->replace;
+    patch->replen = rec->replen;
+    patch->bitmask = rec->masked ? patch->pattern + rec->patlen : NULL;
+    patch->align = rec->align;
+    patch->offset = rec->offset;
+    patch->count = rec->count;
+    patch->anchor = rec->anchor;
+    patch->window = rec->window;
+}
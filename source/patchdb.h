@@ -0,0 +1,40 @@
+#pragma once
+
+#include <3ds/types.h>
+#include "patcher.h"
+
+// In-memory index of patches.dat, read once on the first lookup. A patch is
+// keyed by an exact progid, a progid under a mask or a range of progids.
+// Keys sharing a mask sit in one sorted array and ranges are sorted by
+// their first progid with a running maximum of their last, so finding a
+// title's patches is a binary search per distinct mask plus one over the
+// ranges.
+//
+// Loads pin a generation with patchdb_acquire for as long as they use its
+// records. patchdb_reload (Loader command 0x105) builds a new generation
+// next to the current one and swaps it in, a load already running finishes
+// with the patches it started with.
+
+#define PATCHDB_PATH "/rei/patches/patches.dat"
+#define PATCHDB_ADDR 0x08200000 // clear of the prefetch heap
+#define PATCHDB_MAX_SIZE 0x100000 // file plus index, per generation
+#define PATCHDB_SLOTS 2 // generation i lives at PATCHDB_ADDR + i*PATCHDB_MAX_SIZE
+#define PATCHDB_MAX_MASKS 16
+#define PATCHDB_MAX_MATCHES 64 // patches applied to one title
+#define PATCHDB_NO_ERROR 0xFFFFFFFF
+
+// patchdb_reload results besides SD errors, a rejected file leaves the current patches in place
+#define PATCHDB_ERR_TOO_LARGE MAKERESULT(RL_PERMANENT, RS_OUTOFRESOURCE, RM_LDR, RD_TOO_LARGE)
+#define PATCHDB_ERR_SHORT_READ MAKERESULT(RL_PERMANENT, RS_INVALIDSTATE, RM_LDR, RD_NO_DATA)
+#define PATCHDB_ERR_MALFORMED MAKERESULT(RL_PERMANENT, RS_INVALIDARG, RM_LDR, RD_INVALID_COMBINATION)
+#define PATCHDB_ERR_BUSY MAKERESULT(RL_TEMPORARY, RS_INVALIDSTATE, RM_LDR, RD_BUSY) // the generation before is still in use
+
+typedef struct patchdb patchdb_t;
+
+void patchdbInit(void);
+void patchdbExit(void);
+patchdb_t *patchdb_acquire(void);
+void patchdb_release(patchdb_t *db);
+Result patchdb_reload(u32 *num_records, u32 *bad_offset);
+int patchdb_lookup(patchdb_t *db, u64 progid, u16 *records, int max);
+void patchdb_get(patchdb_t *db, u16 record, patch_t *patch);
@@ -2,8 +2,8 @@
 #include <string.h>
 #include <wchar.h>
 #include "patcher.h"
-#include "ifile.h"
-#include "fsldr.h"
+#include "patchdb.h"
+#include "stats.h"
 
 // Below is stolen from http://en.wikipedia.org/wiki/Boyer%E2%80%93Moore_string_search_algorithm
 
@@ -11,36 +11,6 @@
 #define NOT_FOUND patlen
 #define max(a, b) ((a < b) ? b : a)
 
-//Max number of patches that can be present in the /rei/patches folder (because RAM reasons for now)
-#define MAX_PATCHES 30
-#define MAX_PATCH_FILENAME_LEN 50
-
-//Patch vars
-static IFile fp;
-static char magic[4];
-static char unused[0xB];
-static u64  uid = 0,
-            br = 0,
-            fileSize = 0;
-static u8 pattern_length = 0, 
-          patch_length = 0,
-          patchCnt = 0,
-          titleCnt = 0,
-          patchFlag = 0;
-static s8 search_multiple = 0, 
-          offset = 0;
-static u32 entryCount = 0,
-           fileCount = 0,
-           cachePos = 0;
-           Handle dirHandle;
-static u8 pattern[0x100];
-static u8 patch[0x100];
-static u32 uidCachedArray[0x100];
-static char paths[MAX_PATCHES][MAX_PATCH_FILENAME_LEN] = {0};
-static FS_Path dirPath = { PATH_EMPTY, 1, (u8*)"" };
-static FS_Path archivePath = { PATH_EMPTY, 1, (u8*)"" };
-static FS_Archive archive = 0;
- 
 // delta1 table: delta1[c] contains the distance between the last
 // character of pat and the rightmost occurence of c in pat.
 // If c does not occur in pat, then delta1[c] = patlen.
@@ -131,13 +101,12 @@ static void make_delta2(int *delta2, u8 *pat, int patlen){
     }
 }
  
-static u8* boyer_moore(u8 *string, int stringlen, u8 *pat, int patlen){
+// With the strong good suffix rule in delta2 finding the first match is
+// linear (Cole), so runs of padding cannot make this quadratic. The Galil
+// rule is not needed since a search never restarts inside the last match.
+static u8* boyer_moore(u8 *string, int stringlen, u8 *pat, int patlen, int *delta1, int *delta2){
     int i;
-    int delta1[ALPHABET_LEN];
-    int delta2[patlen * sizeof(int)];
-    make_delta1(delta1, pat, patlen);
-    make_delta2(delta2, pat, patlen);
- 
+
   i = patlen-1;
     while (i < stringlen) {
         int j = patlen-1;
@@ -151,92 +120,462 @@ static u8* boyer_moore(u8 *string, int stringlen, u8 *pat, int patlen){
     return NULL;
 }
 
-static int patch_memory(start, size, pattern, patsize, offset, replace, repsize, count)
+static inline u32 load_unit(const u8 *p, u32 align){
+    u16 half;
+    u32 word;
+
+    if (align == 2){
+        memcpy(&half, p, 2);
+        return half;
+    }
+    memcpy(&word, p, 4);
+    return word;
+}
+
+// unit by unit kmp for unmasked aligned patterns, linear whatever the input,
+// only used once aligned_search has compared too much
+static u8 *aligned_kmp(u8 *p, u8 *end, const u8 *pat, u32 patlen, u32 align){
+    u8 fail[ALPHABET_LEN / 2];
+    u32 units = patlen / align;
+    u32 i, k, u;
+
+    fail[0] = 0;
+    for (i = 1, k = 0; i < units; i++){
+        u = load_unit(pat + i * align, align);
+        while (k && u != load_unit(pat + k * align, align)) k = fail[k - 1];
+        if (u == load_unit(pat + k * align, align)) k++;
+        fail[i] = k;
+    }
+    for (k = 0; end - p >= (int)align; p += align){
+        u = load_unit(p, align);
+        while (k && u != load_unit(pat + k * align, align)) k = fail[k - 1];
+        if (u == load_unit(pat + k * align, align) && ++k == units) return p - (patlen - align);
+    }
+    return NULL;
+}
+
+// Instruction patches: only offsets from image that are multiples of align
+// (2 or 4) are tried, compared a halfword or word at a time under bitmask.
+// Candidates are filtered on the first unit that is neither all zeros nor
+// all ones under its mask, so padding does not send every position into a
+// full compare. A repeated word still can, so past twice the searched units
+// in compares an unmasked pattern goes to aligned_kmp. Masked ones cannot,
+// PATCH_MAX_MASKED_LEN keeps their verify to a few units.
+static u8 *aligned_search(u8 *image, u8 *p, u8 *end, const u8 *pat, const u8 *bitmask, u32 patlen, u32 align){
+    u32 full = (align == 2) ? 0xFFFF : 0xFFFFFFFF;
+    u32 key, key_mask, m, i, k;
+    s32 budget;
+
+    i = (u32)(p - image) & (align - 1);
+    if (i) p += align - i;
+    budget = (end > p) ? 2 * (end - p) / align : 0;
+    for (k = 0; k < patlen; k += align){
+        key_mask = bitmask ? load_unit(bitmask + k, align) : full;
+        key = load_unit(pat + k, align) & key_mask;
+        if (key != 0 && key != key_mask) break;
+    }
+    if (k == patlen) k = 0;
+    key_mask = bitmask ? load_unit(bitmask + k, align) : full;
+    key = load_unit(pat + k, align) & key_mask;
+
+    for (; end - p >= (int)patlen; p += align){
+        if ((load_unit(p + k, align) & key_mask) != key) continue;
+        for (i = 0; i < patlen; i += align){
+            m = bitmask ? load_unit(bitmask + i, align) : full;
+            if ((load_unit(p + i, align) & m) != (load_unit(pat + i, align) & m)) break;
+        }
+        if (i == patlen) return p;
+        if ((budget -= i / align + 1) < 0 && bitmask == NULL) return aligned_kmp(p + align, end, pat, patlen, align);
+    }
+    return NULL;
+}
+
+// replacements that would land outside [image, image + image_size) are skipped,
+// returns how many were written
+static int patch_memory(image, image_size, start, size, pattern, patsize, bitmask, align, offset, replace, repsize, count, first, scratch)
+    u8* image;
+    u32 image_size;
     u8* start;
     u32 size;
     u32 patsize;
     u8 pattern[patsize];
+    u8 *bitmask;
+    u32 align;
     int offset;
     u32 repsize;
     u8 replace[repsize];
     int count;
+    u8 **first;
+    arena_t *scratch;
 {
+    int *delta1 = NULL, *delta2 = NULL;
     u8 *found;
-    int i;
-    u32 at;
+    int i, written;
+    u32 at, mark;
+    s32 dest;
 
+    *first = NULL;
+    if (patsize == 0) return 0; // would match everywhere
+    // the tables only depend on the pattern, count can be large
+    mark = arena_mark(scratch);
+    if (align == 1){
+        delta1 = arena_alloc(scratch, ALPHABET_LEN * sizeof(int));
+        delta2 = arena_alloc(scratch, patsize * sizeof(int));
+        if (delta1 == NULL || delta2 == NULL) svcBreak(USERBREAK_ASSERT); // ARENA_SCRATCH_SIZE is too small
+        make_delta1(delta1, pattern, patsize);
+        make_delta2(delta2, pattern, patsize);
+    }
+    written = 0;
     for (i = 0; i < count; i++){
-        found = boyer_moore(start, size, pattern, patsize);
+        if (align == 1) found = boyer_moore(start, size, pattern, patsize, delta1, delta2);
+        else found = aligned_search(image, start, start + size, pattern, bitmask, patsize, align);
         if (found == NULL) break;
+        if (i == 0) *first = found;
         at = (u32)(found - start);
-        memcpy(found + offset, replace, repsize);
+        dest = (s32)(found - image) + offset;
+        if (dest >= 0 && dest + repsize <= image_size){
+            memcpy(image + dest, replace, repsize);
+            written++;
+        }
         if (at + patsize > size) size = 0;
         else size = size - (at + patsize);
         start = found + patsize;
     }
-    return i;
+    arena_rewind(scratch, mark);
+    return written;
+}
+
+typedef void (*patch_visit_t)(void *arg, const patch_t *patch);
+
+// Hardcoding Rei string here so it cant be changed ;^)
+// every region's MSET, 0x00040010000 2x000
+#define MSET_PROGID 0x0004001000020000LL
+#define MSET_MASK 0xFFFFFFFFFFFF0FFFLL
+
+// hands every patch for progid to visit, in the order patch_code applies them
+static void for_each_patch(u64 progid, patch_visit_t visit, void *arg){
+    u16 records[PATCHDB_MAX_MATCHES];
+    patchdb_t *db;
+    patch_t patch;
+    int count, i;
+
+    db = patchdb_acquire();
+    count = patchdb_lookup(db, progid, records, PATCHDB_MAX_MATCHES);
+    for (i = 0; i < count; i++){
+        patchdb_get(db, records[i], &patch);
+        visit(arg, &patch);
+    }
+    patchdb_release(db);
+
+    if ((progid & MSET_MASK) == MSET_PROGID){
+        static const u16 ver_string_pattern[] = u"Ver.";
+        static const u16 ver_string_patch[] = u"\uE024Rei";
+        patch.pattern = (u8 *)ver_string_pattern;
+        patch.patlen = 8;
+        patch.replace = (u8 *)ver_string_patch;
+        patch.replen = 8;
+        patch.bitmask = NULL;
+        patch.align = 1;
+        patch.offset = 0;
+        patch.count = 1;
+        patch.anchor = PATCH_NO_ANCHOR;
+        patch.window = 0;
+        visit(arg, &patch);
+    }
+}
+
+typedef struct{
+    u8 *code;
+    u32 size;
+    arena_t *scratch;
+    int applied;
+    u32 num_patches;
+    u32 first[PATCH_MAX_ANCHORS]; // where each patch first matched, size if it did not
+} patch_direct_t;
+
+static void apply_direct(void *arg, const patch_t *patch){
+    patch_direct_t *direct = arg;
+    u8 *start = direct->code;
+    u32 size = direct->size;
+    u8 *first = NULL;
+    u32 at;
+
+    if (patch->anchor != PATCH_NO_ANCHOR){
+        // only the window after the anchor's first match, nothing at all if the anchor missed
+        if ((u32)patch->anchor >= direct->num_patches || patch->anchor >= PATCH_MAX_ANCHORS) goto done;
+        at = direct->first[patch->anchor];
+        if (at == direct->size) goto done;
+        start += at;
+        size = (patch->window < direct->size - at) ? patch->window : direct->size - at;
+    }
+    direct->applied += patch_memory(direct->code, direct->size, start, size, patch->pattern, patch->patlen, patch->bitmask, patch->align,
+        patch->offset, patch->replace, patch->replen, patch->count, &first, direct->scratch);
+    done:
+    if (direct->num_patches < PATCH_MAX_ANCHORS) direct->first[direct->num_patches] = first ? (u32)(first - direct->code) : direct->size;
+    direct->num_patches++;
+}
+
+int patch_code(u64 progid, u8 *code, u32 size, arena_t *scratch){
+    patch_direct_t direct;
+
+    direct.code = code;
+    direct.size = size;
+    direct.scratch = scratch;
+    direct.applied = 0;
+    direct.num_patches = 0;
+    for_each_patch(progid, apply_direct, &direct);
+    STATS_ADD(g_stats->patches_applied, direct.applied);
+    return 0;
+}
+
+#ifdef LOADER_FUSED_PATCH
+// Fused mode: the decoder hands over each chunk of output as soon as it is
+// final and patch_scan collects every match of every pattern in it while
+// it is still cached. patch_apply then replays patch_code's sequential
+// search order over those hits. A write can create or destroy matches, so
+// hits are re-checked against memory and the bytes around every write are
+// searched again; anything that does not fit the tables goes through
+// patch_memory instead. Either way the result is the same as patch_code.
+//
+// The scan cannot stop at a record's count, lzss finishes the image top
+// down and the first matches are the last ones found. So every record
+// costs a pass over the whole image, where patch_code stops at its count-th
+// match. Fused only wins when that pass would otherwise come from memory
+// rather than cache for most of the image: patterns that are absent or
+// match near the end, such as version specific patches on titles they
+// no longer fit. A count=1 pattern that matches early is far cheaper
+// direct.
+
+// Horspool is enough for chunk scans and needs no per-pattern state beyond the skip table
+static void make_skip(u8 *skip, const u8 *pat, u32 patlen){
+    u32 i;
+
+    memset(skip, patlen, ALPHABET_LEN);
+    for (i = 0; i < patlen - 1; i++) skip[pat[i]] = patlen - 1 - i;
+}
+
+// linear whatever the input, only used once horspool has compared too much
+static u8 *kmp(u8 *p, u8 *end, const u8 *pat, u32 patlen){
+    u8 fail[ALPHABET_LEN];
+    u32 i, k;
+
+    fail[0] = 0;
+    for (i = 1, k = 0; i < patlen; i++){
+        while (k && pat[i] != pat[k]) k = fail[k - 1];
+        if (pat[i] == pat[k]) k++;
+        fail[i] = k;
+    }
+    for (k = 0; p < end; p++){
+        while (k && *p != pat[k]) k = fail[k - 1];
+        if (*p == pat[k] && ++k == patlen) return p - (patlen - 1);
+    }
+    return NULL;
 }
 
-int patch_code(u64 progid, u8 *code, u32 size){
-    //File vars
-    IFile fp;
-    FS_Path apath;
-    FS_Path ppath;
-    size_t len;
-    u64 fileSize;
-    const char *path = "/rei/patches/patches.dat";
-    
-    //Patch vars
-    u64 read_id, 
-        br;
-    u8 pattern_length, 
-       patch_length;
-    s8 search_multiple, 
-       offset;
-    u8 pattern[0x100];
-    u8 patch[0x100];
-    
-    len = strnlen(path, PATH_MAX);
-    apath.type = PATH_EMPTY;
-    apath.size = 1;
-    apath.data = (u8 *)"";
-    ppath.type = PATH_ASCII;
-    ppath.data = path;
-    ppath.size = len+1;
-    
-    //Read patches from SD
-    if(R_FAILED(IFile_Open(&fp, ARCHIVE_SDMC, apath, ppath, FS_OPEN_READ))) goto end;
-    if(R_FAILED(IFile_GetSize(&fp, &fileSize))) goto end;
-    while (!feof(&fp)) { //Read all patches concatinated
-        if (R_FAILED(IFile_Read(&fp, &br, &read_id, 8))) goto end;
-        if (R_FAILED(IFile_Read(&fp, &br, &pattern_length, 1))) goto end;
-        if (R_FAILED(IFile_Read(&fp, &br, &patch_length, 1))) goto end;
-        if (R_FAILED(IFile_Read(&fp, &br, &search_multiple, 1))) goto end;
-        if (R_FAILED(IFile_Read(&fp, &br, &offset, 1))) goto end;
-        if (R_FAILED(IFile_Read(&fp, &br, &pattern, pattern_length))) goto end;
-        if (R_FAILED(IFile_Read(&fp, &br, &patch, patch_length))) goto end;
-        if (read_id == progid) patch_memory(code, size, pattern, pattern_length, search_multiple, patch, patch_length, offset);
-    }
-    end:
-    IFile_Close(&fp);
-    
-    //Hardcoding Rei string here so it cant be changed ;^)
-    switch(progid){
-        case 0x0004001000020000LL:  //JPN MSET
-        case 0x0004001000021000LL:  //USA MSET
-        case 0x0004001000022000LL:  //EUR MSET
-        case 0x0004001000026000LL:  //CHN MSET
-        case 0x0004001000027000LL:  //KOR MSET
-        case 0x0004001000028000LL:  //TWN MSET
-        {
-            static const char* ver_string_pattern = u"Ver.";
-            static const char* ver_string_patch = u"\uE024Rei";
-            patch_memory(code, size, 
-            ver_string_pattern, 8, 0, 
-            ver_string_patch, 8, 1
-            );
-            break;
+// a pattern like 00..0100 over zero padding makes every verify nearly full
+// length, so past twice the searched length in compares the rest goes to kmp
+static u8 *horspool(u8 *p, u8 *end, const u8 *pat, u32 patlen, const u8 *skip){
+    u8 last = pat[patlen - 1];
+    s32 budget = 2 * (end - p);
+    u8 c;
+
+    while (end - p >= (int)patlen){
+        c = p[patlen - 1];
+        if (c == last){
+            if (memcmp(p, pat, patlen - 1) == 0) return p;
+            if ((budget -= patlen) < 0) return kmp(p + 1, end, pat, patlen);
         }
+        p += skip[c];
+    }
+    return NULL;
+}
+
+// first match of rec in [p, end), skip is only needed for unaligned records
+static u8 *find(patch_set_t *set, patch_record_t *rec, u8 *p, u8 *end, const u8 *skip){
+    u8 *pat = set->bytes + rec->pattern;
+
+    if (rec->align > 1) return aligned_search(set->code, p, end, pat, rec->masked ? pat + rec->patlen : NULL, rec->patlen, rec->align);
+    return horspool(p, end, pat, rec->patlen, skip);
+}
+
+static void add_record(void *arg, const patch_t *patch){
+    patch_set_t *set = arg;
+    patch_record_t *rec;
+    u32 masklen = patch->bitmask ? patch->patlen : 0;
+
+    if (set->num_records == PATCH_MAX_RECORDS || set->num_bytes + patch->patlen + masklen + patch->replen > PATCH_MAX_BYTES){
+        set->fallback = 1;
+        return;
+    }
+    rec = &set->records[set->num_records++];
+    rec->pattern = set->num_bytes;
+    memcpy(set->bytes + set->num_bytes, patch->pattern, patch->patlen);
+    set->num_bytes += patch->patlen;
+    if (masklen){
+        memcpy(set->bytes + set->num_bytes, patch->bitmask, masklen);
+        set->num_bytes += masklen;
     }
+    rec->replace = set->num_bytes;
+    memcpy(set->bytes + set->num_bytes, patch->replace, patch->replen);
+    set->num_bytes += patch->replen;
+    rec->patlen = patch->patlen;
+    rec->replen = patch->replen;
+    rec->offset = patch->offset;
+    rec->count = patch->count;
+    rec->align = patch->align;
+    rec->masked = masklen != 0;
+    rec->anchor = patch->anchor;
+    rec->window = patch->window;
+    rec->overflow = (patch->patlen == 0); // patch_memory ignores these
+    rec->num_hits = 0;
+}
+
+void patch_scan(void *arg, u8 *lo, u8 *hi){
+    patch_set_t *set = arg;
+    patch_record_t *rec;
+    u8 skip[ALPHABET_LEN];
+    u8 *limit = set->code + set->size;
+    u8 *pat, *end, *p;
+    u32 i, quota;
+
+    if (set->num_records == 0) return;
+    if (lo < set->scanned) set->scanned = lo;
+    quota = PATCH_MAX_HITS / set->num_records;
+    for (i = 0; i < set->num_records; i++){
+        rec = &set->records[i];
+        if (rec->anchor != PATCH_NO_ANCHOR) continue; // anchored ones search their window at apply time
+        if (rec->overflow) break; // patch_apply searches memory itself from this record on, later hits would go unused
+        pat = set->bytes + rec->pattern;
+        // matches starting in [lo, hi), the bytes above hi are final already
+        end = (limit - hi < rec->patlen - 1) ? limit : hi + rec->patlen - 1;
+        if (rec->align == 1) make_skip(skip, pat, rec->patlen);
+        p = lo;
+        while ((p = find(set, rec, p, end, skip)) != NULL){
+            // no longer scanned, patch_memory stops at count matches anyway
+            if (rec->num_hits == quota){
+                rec->overflow = 1;
+                break;
+            }
+            set->hits[set->num_hits].offset = p - set->code;
+            set->hits[set->num_hits].record = i;
+            set->num_hits++;
+            rec->num_hits++;
+            p++;
+        }
+    }
+}
+
+void patch_prepare(patch_set_t *set, arena_t *scratch, u64 progid, u8 *code, u32 size, u8 *final){
+    set->scratch = scratch;
+    set->progid = progid;
+    set->code = code;
+    set->size = size;
+    set->scanned = code + size;
+    set->num_records = 0;
+    set->num_bytes = 0;
+    set->num_hits = 0;
+    set->fallback = 0;
+    for_each_patch(progid, add_record, set);
+    if (set->fallback) set->num_records = 0; // nothing to collect, patch_apply starts over
+    if (final < set->scanned) patch_scan(set, final, set->scanned);
+}
+
+// first match of rec at or after cursor in memory as it is now, or size if there is none
+static u32 find_next(patch_set_t *set, u32 r, u32 cursor, u32 (*dirty)[2], u32 num_dirty){
+    patch_record_t *rec = &set->records[r];
+    u8 *pat = set->bytes + rec->pattern;
+    u8 skip[ALPHABET_LEN];
+    u32 best = set->size;
+    u32 lo, hi, i;
+    u8 *p;
+
+    // untouched bytes still hold what the scan saw, so a match there is one of the hits
+    for (i = 0; i < set->num_hits; i++){
+        if (set->hits[i].record != r || set->hits[i].offset < cursor || set->hits[i].offset >= best) continue;
+        p = set->code + set->hits[i].offset;
+        if (rec->masked ? find(set, rec, p, p + rec->patlen, NULL) != NULL : memcmp(p, pat, rec->patlen) == 0) best = set->hits[i].offset;
+    }
+
+    // any other match overlaps something written since
+    if (num_dirty && rec->align == 1) make_skip(skip, pat, rec->patlen);
+    for (i = 0; i < num_dirty; i++){
+        lo = (dirty[i][0] < rec->patlen - 1) ? 0 : dirty[i][0] - (rec->patlen - 1);
+        if (lo < cursor) lo = cursor;
+        hi = dirty[i][1] + rec->patlen - 1;
+        if (hi > best + rec->patlen - 1) hi = best + rec->patlen - 1;
+        if (hi > set->size) hi = set->size;
+        if (lo >= hi) continue;
+        p = find(set, rec, set->code + lo, set->code + hi, skip);
+        if (p != NULL && (u32)(p - set->code) < best) best = p - set->code;
+    }
+    return best;
+}
+
+// first match of an anchored rec in [cursor, hi), the window is small enough to just search it
+static u32 find_window(patch_set_t *set, u32 r, u32 cursor, u32 hi){
+    patch_record_t *rec = &set->records[r];
+    u8 *pat = set->bytes + rec->pattern;
+    u8 skip[ALPHABET_LEN];
+    u8 *p;
+
+    if (rec->align == 1) make_skip(skip, pat, rec->patlen);
+    p = find(set, rec, set->code + cursor, set->code + hi, skip);
+    return p ? (u32)(p - set->code) : set->size;
+}
+
+int patch_apply(patch_set_t *set){
+    patch_record_t *rec;
+    u32 dirty[PATCH_MAX_DIRTY][2];
+    u32 first[PATCH_MAX_RECORDS];
+    u32 num_dirty = 0;
+    u32 cursor, at, r, hi;
+    s32 lo, end;
+    u8 *found;
+    int untracked = 0;
+    int applied = 0;
+    int i;
+
+    if (set->fallback) return patch_code(set->progid, set->code, set->size, set->scratch);
+    if (set->scanned > set->code) patch_scan(set, set->code, set->scanned);
+
+    for (r = 0; r < set->num_records; r++){
+        rec = &set->records[r];
+        first[r] = set->size;
+        cursor = 0;
+        hi = set->size;
+        if (rec->anchor != PATCH_NO_ANCHOR){
+            if ((u32)rec->anchor >= r || first[rec->anchor] == set->size) continue;
+            cursor = first[rec->anchor];
+            hi = (rec->window < set->size - cursor) ? cursor + rec->window : set->size;
+        }
+        if (rec->overflow || num_dirty + (rec->count > 0 ? rec->count : 0) > PATCH_MAX_DIRTY) untracked = 1;
+        if (untracked){
+            // writes are no longer tracked, so every later record searches memory directly
+            applied += patch_memory(set->code, set->size, set->code + cursor, hi - cursor, set->bytes + rec->pattern, rec->patlen,
+                rec->masked ? set->bytes + rec->pattern + rec->patlen : NULL, rec->align, rec->offset, set->bytes + rec->replace, rec->replen,
+                rec->count, &found, set->scratch);
+            if (found) first[r] = found - set->code;
+            continue;
+        }
+        for (i = 0; i < rec->count; i++){
+            if (rec->anchor != PATCH_NO_ANCHOR) at = find_window(set, r, cursor, hi);
+            else at = find_next(set, r, cursor, dirty, num_dirty);
+            if (at == set->size) break;
+            if (i == 0) first[r] = at;
+            cursor = at + rec->patlen;
+            lo = (s32)at + rec->offset;
+            end = lo + rec->replen;
+            if (lo < 0 || end > (s32)set->size) continue; // same as patch_memory, skipped
+            memcpy(set->code + lo, set->bytes + rec->replace, rec->replen);
+            applied++;
+            if (lo < end){
+                dirty[num_dirty][0] = lo;
+                dirty[num_dirty][1] = end;
+                num_dirty++;
+            }
+        }
+    }
+    STATS_ADD(g_stats->patches_applied, applied);
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -1,7 +1,91 @@
 #pragma once
 
 #include <3ds/types.h>
+#include "arena.h"
+
+// patches.dat starts with this header, files without it are in the original unversioned format
+#define PATCH_FILE_MAGIC 0x54415052 // "RPAT"
+#define PATCH_FILE_VERSION 1
+#define PATCH_FLAG_ANCHORED 0x01 // only search the window after an earlier patch's first match
+#define PATCH_FLAG_MASKED 0x02 // applies to every progid equal to the record's under a mask
+#define PATCH_FLAG_RANGE 0x04 // applies to every progid from the record's up to a last one
+#define PATCH_FLAG_ALIGN2 0x08 // only matches at even offsets into the image, Thumb halfwords
+#define PATCH_FLAG_ALIGN4 0x10 // only matches at multiples of 4, ARM instructions
+#define PATCH_FLAG_BITMASK 0x20 // pattern bits clear in a mask of the same length are not compared, needs an ALIGN flag
+#define PATCH_MAX_MASKED_LEN 32 // longest pattern with a bitmask, their search has no linear fallback
+
+#define PATCH_NO_ANCHOR -1
+#define PATCH_MAX_ANCHORS 32 // later patches of a title cannot be anchors
+
+typedef struct{
+    u32 magic;
+    u8 version;
+    u8 reserved[3];
+} patch_file_header_t;
+
+// a patch with an empty replacement only marks a place for the ones anchored to it
+typedef struct{
+    u8 *pattern;
+    u32 patlen;
+    u8 *replace;
+    u32 replen;
+    u8 *bitmask; // patlen bytes, NULL compares every bit
+    u32 align; // 1, 2 or 4, matches start at offsets into the image that are multiples of it
+    int offset; // from the match to where replace goes
+    int count; // matches to patch
+    int anchor; // index among the same title's patches, or PATCH_NO_ANCHOR
+    u32 window; // bytes from the anchor's first match
+} patch_t;
 
 void initPatcher(void);
 void exitPatcher(void);
-int patch_code(u64 progid, u8 *code, u32 size);
+// search tables come out of scratch and are given back before returning
+int patch_code(u64 progid, u8 *code, u32 size, arena_t *scratch);
+
+#ifdef LOADER_FUSED_PATCH
+#define PATCH_MAX_RECORDS 16
+#define PATCH_MAX_BYTES 0x800
+#define PATCH_MAX_HITS 256
+#define PATCH_MAX_DIRTY 32
+
+typedef struct{
+    u16 pattern; // offsets into patch_set_t.bytes
+    u16 replace;
+    u8 patlen;
+    u8 replen;
+    s8 offset;
+    s8 count;
+    u8 overflow; // lost some hits, applied with patch_memory instead
+    u16 num_hits; // at most PATCH_MAX_HITS / num_records, so one common pattern cannot crowd out the rest
+    u8 align;
+    u8 masked; // the bitmask follows the pattern in bytes
+    s16 anchor;
+    u32 window;
+} patch_record_t;
+
+typedef struct{
+    u32 offset;
+    u32 record;
+} patch_hit_t;
+
+// one title's patches and every place their patterns occur in the decoded image
+typedef struct{
+    u64 progid;
+    u8 *code;
+    u32 size;
+    u8 *scanned; // lowest byte handed to patch_scan so far
+    u32 num_records;
+    u32 num_bytes;
+    u32 num_hits;
+    int fallback; // patches did not fit, patch_apply runs patch_code
+    arena_t *scratch;
+    patch_record_t records[PATCH_MAX_RECORDS];
+    patch_hit_t hits[PATCH_MAX_HITS];
+    u8 bytes[PATCH_MAX_BYTES];
+} patch_set_t;
+
+// bytes in [final, code + size) must already hold their decoded contents
+void patch_prepare(patch_set_t *set, arena_t *scratch, u64 progid, u8 *code, u32 size, u8 *final);
+void patch_scan(void *set, u8 *lo, u8 *hi);
+int patch_apply(patch_set_t *set);
+#endif
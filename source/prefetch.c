@@ -0,0 +1,344 @@
+#include <3ds.h>
+#include <string.h>
+#include "prefetch.h"
+#include "ifile.h"
+#include "fsldr.h"
+#include "fsreg.h"
+#include "stats.h"
+
+#define PREFETCH_STACK_SIZE 0x1000
+#define PREFETCH_EXHEADER_SIZE 0x400 // what fs:REG and PxiPM hand out
+
+extern const char CODE_PATH[12];
+
+typedef enum{
+    PREFETCH_EMPTY = 0,
+    PREFETCH_LOADING,
+    PREFETCH_READY,
+    PREFETCH_USED,
+    PREFETCH_FAILED
+} prefetch_state_t;
+
+typedef struct{
+    u64 progid;
+    u64 prog_handle; // learnt from RegisterProgram, GetProgramInfo only knows this
+    u32 read_ticks;
+    u32 code_offset;
+    u32 code_size;
+    u32 exheader_offset;
+    u8 state;
+    u8 exheader_state;
+} prefetch_entry_t;
+
+static prefetch_entry_t g_entries[PREFETCH_MAX_TITLES];
+static int g_entry_count;
+static LightLock g_lock;
+static u8 *g_heap;
+static u32 g_heap_used;
+static int g_running;
+static Handle g_thread;
+static u8 g_stack[PREFETCH_STACK_SIZE] __attribute__((aligned(8)));
+
+// what this boot looked like, written out once boot is over
+static prefetch_manifest_entry_t g_record[PREFETCH_MAX_TITLES];
+static int g_record_count;
+static int g_boot_done;
+static int g_committed;
+
+static int is_boot_title(u64 progid){
+    return (progid >> 32) == 0x00040130;
+}
+
+static FS_Path sdmc_path(const char *path){
+    FS_Path ppath;
+
+    ppath.type = PATH_ASCII;
+    ppath.data = path;
+    ppath.size = strlen(path) + 1;
+    return ppath;
+}
+
+static FS_Path empty_path(void){
+    FS_Path apath;
+
+    apath.type = PATH_EMPTY;
+    apath.size = 1;
+    apath.data = (u8 *)"";
+    return apath;
+}
+
+// fills g_entries, the caller publishes the count
+static int read_manifest(void){
+    IFile file;
+    prefetch_manifest_header_t header;
+    prefetch_manifest_entry_t entry;
+    u64 total;
+    int i;
+
+    if (R_FAILED(IFile_Open(&file, ARCHIVE_SDMC, empty_path(), sdmc_path(PREFETCH_MANIFEST_PATH), FS_OPEN_READ))) return 0;
+    if (R_FAILED(IFile_Read(&file, &total, &header, sizeof(header))) || total != sizeof(header) ||
+        header.magic != PREFETCH_MAGIC || header.version != PREFETCH_VERSION || header.count > PREFETCH_MAX_TITLES){
+        IFile_Close(&file);
+        return 0;
+    }
+    for (i = 0; i < header.count; i++){
+        if (R_FAILED(IFile_Read(&file, &total, &entry, sizeof(entry))) || total != sizeof(entry)) break;
+        g_entries[i].progid = entry.progid;
+        g_entries[i].read_ticks = entry.read_ticks;
+        g_entries[i].code_size = entry.code_size;
+    }
+    IFile_Close(&file);
+    return i;
+}
+
+// heap is only mapped for as long as there is prefetched data to hand out
+static void free_heap(void){
+    u32 dummy;
+
+    if (g_heap == NULL) return;
+    svcControlMemory(&dummy, (u32)g_heap, 0, PREFETCH_BUDGET, MEMOP_FREE, 0);
+    g_heap = NULL;
+}
+
+// reserves room for one title, fails once the ceiling is reached
+static int reserve(u32 size, u32 *offset){
+    size = (size + 3) & ~3;
+    if (g_heap_used + size > PREFETCH_BUDGET) return 0;
+    *offset = g_heap_used;
+    g_heap_used += size;
+    return 1;
+}
+
+static void prefetch_title(prefetch_entry_t *entry){
+    FS_ProgramInfo info;
+    FS_Path archivePath;
+    FS_Path filePath;
+    IFile file;
+    u64 prog_handle;
+    u64 size;
+    u64 total;
+    int ok;
+
+    // a manifest from an older firmware may name titles that are gone, those just fail here
+    info.programId = entry->progid;
+    info.mediaType = MEDIATYPE_NAND;
+    memset(info.padding, 0, sizeof(info.padding));
+    if (R_FAILED(FSREG_LoadProgram(&prog_handle, &info))) goto fail;
+
+    ok = 0;
+    LightLock_Lock(&g_lock);
+    if (reserve(PREFETCH_EXHEADER_SIZE, &entry->exheader_offset)) ok = 1;
+    LightLock_Unlock(&g_lock);
+    if (ok && R_SUCCEEDED(FSREG_GetProgramInfo((ExHeader_Info *)(g_heap + entry->exheader_offset), 1, prog_handle))){
+        LightLock_Lock(&g_lock);
+        entry->exheader_state = PREFETCH_READY;
+        LightLock_Unlock(&g_lock);
+    }
+
+    archivePath.type = PATH_BINARY;
+    archivePath.data = &prog_handle;
+    archivePath.size = 8;
+    filePath.type = PATH_BINARY;
+    filePath.data = CODE_PATH;
+    filePath.size = sizeof(CODE_PATH);
+    ok = 0;
+    if (R_SUCCEEDED(IFile_Open(&file, ARCHIVE_SAVEDATA_AND_CONTENT2, archivePath, filePath, FS_OPEN_READ))){
+        if (R_SUCCEEDED(IFile_GetSize(&file, &size))){
+            LightLock_Lock(&g_lock);
+            ok = reserve(size, &entry->code_offset);
+            LightLock_Unlock(&g_lock);
+            if (ok) ok = R_SUCCEEDED(IFile_Read(&file, &total, g_heap + entry->code_offset, size)) && total == size;
+        }
+        IFile_Close(&file);
+    }
+    FSREG_UnloadProgram(prog_handle);
+    if (!ok) goto fail;
+
+    LightLock_Lock(&g_lock);
+    entry->code_size = size;
+    entry->state = PREFETCH_READY;
+    LightLock_Unlock(&g_lock);
+    return;
+
+    fail:
+    LightLock_Lock(&g_lock);
+    entry->state = PREFETCH_FAILED;
+    LightLock_Unlock(&g_lock);
+}
+
+static void prefetch_main(void *arg){
+    prefetch_entry_t *entry;
+    u32 addr;
+    int i, count, claimed;
+
+    // even reading the manifest stays off the startup path, and out of the way of titles pm is waiting for
+    fsldr_priority_begin(FSLDR_PRIORITY_BACKGROUND);
+    count = read_manifest();
+    if (count > 0 && R_SUCCEEDED(svcControlMemory(&addr, PREFETCH_HEAP_ADDR, 0, PREFETCH_BUDGET, MEMOP_ALLOC, MEMPERM_READ | MEMPERM_WRITE))){
+        LightLock_Lock(&g_lock);
+        g_heap = (u8 *)addr;
+        g_entry_count = count;
+        LightLock_Unlock(&g_lock);
+    }
+
+    for (i = 0; i < g_entry_count; i++){
+        entry = &g_entries[i];
+        LightLock_Lock(&g_lock);
+        // pm got there first or boot is already over
+        claimed = !g_boot_done && entry->state == PREFETCH_EMPTY;
+        if (claimed) entry->state = PREFETCH_LOADING;
+        LightLock_Unlock(&g_lock);
+        if (claimed) prefetch_title(entry);
+    }
+    fsldr_priority_end(FSLDR_PRIORITY_BACKGROUND);
+
+    LightLock_Lock(&g_lock);
+    g_running = 0;
+    if (g_boot_done) free_heap();
+    LightLock_Unlock(&g_lock);
+    svcExitThread();
+}
+
+Result prefetchInit(s32 priority){
+    Result res;
+
+    LightLock_Init(&g_lock);
+    statsRegisterFootprint(STAT_MODULE_PREFETCH, sizeof(g_entries) + sizeof(g_record) + sizeof(g_stack));
+    statsPaintStack((u32)g_stack, PREFETCH_STACK_SIZE);
+    statsRegisterStack(STATS_STACK_PREFETCH, (u32)g_stack, PREFETCH_STACK_SIZE);
+    g_running = 1;
+    res = svcCreateThread(&g_thread, prefetch_main, 0, (u32 *)(g_stack + PREFETCH_STACK_SIZE), priority, -2);
+    if (R_FAILED(res)){
+        g_running = 0;
+        g_thread = 0;
+    }
+    return res;
+}
+
+void prefetchExit(void){
+    if (g_thread == 0) return;
+    svcWaitSynchronization(g_thread, U64_MAX);
+    svcCloseHandle(g_thread);
+    g_thread = 0;
+    free_heap();
+}
+
+static prefetch_entry_t *find_entry(u64 progid){
+    int i;
+
+    for (i = 0; i < g_entry_count; i++){
+        if (g_entries[i].progid == progid) return &g_entries[i];
+    }
+    return NULL;
+}
+
+void prefetch_note_registered(u64 prog_handle, u64 progid){
+    prefetch_entry_t *entry;
+
+    LightLock_Lock(&g_lock);
+    entry = find_entry(progid);
+    if (entry) entry->prog_handle = prog_handle;
+    LightLock_Unlock(&g_lock);
+}
+
+int prefetch_take_exheader(u64 prog_handle, exheader_header *exheader){
+    prefetch_entry_t *entry;
+    int i, hit;
+
+    hit = 0;
+    LightLock_Lock(&g_lock);
+    for (i = 0; i < g_entry_count; i++){
+        entry = &g_entries[i];
+        if (entry->prog_handle != prog_handle || entry->exheader_state != PREFETCH_READY || g_heap == NULL) continue;
+        memcpy(exheader, g_heap + entry->exheader_offset, PREFETCH_EXHEADER_SIZE);
+        entry->exheader_state = PREFETCH_USED;
+        hit = 1;
+        break;
+    }
+    LightLock_Unlock(&g_lock);
+    return hit;
+}
+
+int prefetch_take_code(u64 progid, void *dst, u64 max_size, u64 *size){
+    prefetch_entry_t *entry;
+    u64 start;
+    u64 elapsed;
+    int hit;
+
+    hit = 0;
+    start = svcGetSystemTick();
+    LightLock_Lock(&g_lock);
+    entry = find_entry(progid);
+    if (entry){
+        if (entry->state == PREFETCH_READY && g_heap != NULL && entry->code_size <= max_size){
+            memcpy(dst, g_heap + entry->code_offset, entry->code_size);
+            *size = entry->code_size;
+            entry->state = PREFETCH_USED;
+            hit = 1;
+        }
+        else if (entry->state == PREFETCH_EMPTY){
+            entry->state = PREFETCH_USED; // no point fetching it behind pm's back any more
+        }
+    }
+    LightLock_Unlock(&g_lock);
+
+    if (entry == NULL) return 0;
+    if (hit){
+        elapsed = svcGetSystemTick() - start;
+        STATS_INC(g_stats->prefetch_hits);
+        if (entry->read_ticks > elapsed) STATS_ADD(g_stats->prefetch_ticks_saved, entry->read_ticks - elapsed);
+        // the copy is not what the title costs to read, the next boot orders by the real read
+        prefetch_record(progid, entry->code_size, entry->read_ticks);
+    }
+    else{
+        STATS_INC(g_stats->prefetch_misses);
+    }
+    return hit;
+}
+
+void prefetch_record(u64 progid, u64 code_size, u64 read_ticks){
+    prefetch_manifest_entry_t *entry;
+
+    LightLock_Lock(&g_lock);
+    if (!is_boot_title(progid)){
+        // first title past the system modules, the boot sequence is complete
+        g_boot_done = 1;
+        if (!g_running) free_heap();
+    }
+    else if (!g_boot_done && g_record_count < PREFETCH_MAX_TITLES){
+        entry = &g_record[g_record_count++];
+        entry->progid = progid;
+        entry->code_size = code_size;
+        entry->read_ticks = read_ticks > 0xFFFFFFFF ? 0xFFFFFFFF : read_ticks;
+    }
+    LightLock_Unlock(&g_lock);
+}
+
+// writes this boot's manifest once, called by the workers off the reply path
+void prefetch_commit(void){
+    IFile file;
+    prefetch_manifest_header_t header;
+    u64 total;
+    int write;
+
+    LightLock_Lock(&g_lock);
+    write = g_boot_done && !g_committed && g_record_count > 0;
+    if (write) g_committed = 1;
+    LightLock_Unlock(&g_lock);
+    if (!write) return;
+
+    fsldr_priority_begin(FSLDR_PRIORITY_BACKGROUND);
+    if (R_FAILED(IFile_Open(&file, ARCHIVE_SDMC, empty_path(), sdmc_path(PREFETCH_MANIFEST_PATH), FS_OPEN_WRITE | FS_OPEN_CREATE))){
+        fsldr_priority_end(FSLDR_PRIORITY_BACKGROUND);
+        return;
+    }
+    header.magic = PREFETCH_MAGIC;
+    header.version = PREFETCH_VERSION;
+    header.count = g_record_count;
+    if (R_SUCCEEDED(IFile_Write(&file, &total, &header, sizeof(header), 0)) &&
+        R_SUCCEEDED(IFile_Write(&file, &total, g_record, g_record_count * sizeof(prefetch_manifest_entry_t), 0))){
+        FSFILE_SetSize(file.handle, file.pos);
+    }
+    IFile_Close(&file);
+    fsldr_priority_end(FSLDR_PRIORITY_BACKGROUND);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <3ds/types.h>
+#include "exheader.h"
+
+// Boot-profile-guided prefetch. During boot the loader writes down which
+// system modules it loaded and how big their .code was. On the next boot a
+// background thread walks that manifest and pulls exheaders and .code into
+// memory ahead of pm's requests.
+
+#define PREFETCH_MANIFEST_PATH "/rei/boot.manifest"
+#define PREFETCH_MAGIC 0x4D50424C // "LBPM"
+#define PREFETCH_VERSION 1
+#define PREFETCH_MAX_TITLES 64
+#define PREFETCH_BUDGET 0x100000 // ceiling for everything prefetched
+#define PREFETCH_HEAP_ADDR 0x08000000
+
+typedef struct{
+    u32 magic;
+    u16 version;
+    u16 count;
+} PACKED prefetch_manifest_header_t;
+
+typedef struct{
+    u64 progid;
+    u32 code_size; // compressed size on NAND
+    u32 read_ticks; // what reading it cost last boot
+} PACKED prefetch_manifest_entry_t;
+
+Result prefetchInit(s32 priority);
+void prefetchExit(void);
+void prefetch_note_registered(u64 prog_handle, u64 progid);
+int prefetch_take_exheader(u64 prog_handle, exheader_header *exheader);
+int prefetch_take_code(u64 progid, void *dst, u64 max_size, u64 *size);
+void prefetch_record(u64 progid, u64 code_size, u64 read_ticks);
+void prefetch_commit(void);
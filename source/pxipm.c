@@ -2,31 +2,49 @@
 #include <string.h>
 #include "pxipm.h"
 #include "srvsys.h"
+#include "stats.h"
 
 static Handle pxipmHandle;
 static int pxipmRefCount;
+static LightLock pxipmLock;
 
 Result pxipmInit(void)
 {
-  Result ret = 0;
-
   if (AtomicPostIncrement(&pxipmRefCount)) return 0;
 
-  ret = srvSysGetServiceHandle(&pxipmHandle, "PxiPM");
-
-  if (R_FAILED(ret)) AtomicDecrement(&pxipmRefCount);
-  return ret;
+  // the session is only opened on first use, most boots never need PxiPM
+  LightLock_Init(&pxipmLock);
+  return 0;
 }
 
 void pxipmExit(void)
 {
   if (AtomicDecrement(&pxipmRefCount)) return;
-  svcCloseHandle(pxipmHandle);
+  if (pxipmHandle != 0) svcCloseHandle(pxipmHandle);
+  pxipmHandle = 0;
+}
+
+static Result pxipmConnect(void)
+{
+  Result ret = 0;
+  Handle session;
+
+  LightLock_Lock(&pxipmLock);
+  if (pxipmHandle == 0)
+  {
+    ret = srvSysGetServiceHandle(&session, "PxiPM");
+    if (R_SUCCEEDED(ret)) pxipmHandle = session;
+  }
+  LightLock_Unlock(&pxipmLock);
+  return ret;
 }
 
 Result PXIPM_RegisterProgram(u64 *prog_handle, const FS_ProgramInfo *title, const FS_ProgramInfo *update)
 {
   u32 *cmdbuf = getThreadCommandBuffer();
+  Result ret = 0;
+
+  if (pxipmHandle == 0 && R_FAILED(ret = pxipmConnect())) return ret;
 
   cmdbuf[0] = IPC_MakeHeader(0x2,8,0); // 0x20200
   memcpy(&cmdbuf[1], &title->programId, sizeof(u64));
@@ -36,8 +54,7 @@ Result PXIPM_RegisterProgram(u64 *prog_handle, const FS_ProgramInfo *title, cons
   *(u8*)&cmdbuf[7] = update->mediaType;
   memcpy(((u8*)&cmdbuf[7])+1, &update->padding, 7);
 
-  Result ret = 0;
-  if(R_FAILED(ret = svcSendSyncRequest(pxipmHandle))) return ret;
+  if(R_FAILED(ret = statsSendSyncRequest(STAT_IPC_PXIPM_REGISTERPROGRAM, pxipmHandle))) return ret;
   *prog_handle = *(u64*)&cmdbuf[2];
 
   return cmdbuf[1];
@@ -46,6 +63,9 @@ Result PXIPM_RegisterProgram(u64 *prog_handle, const FS_ProgramInfo *title, cons
 Result PXIPM_GetProgramInfo(ExHeader_Info *exheader, u64 prog_handle)
 {
   u32 *cmdbuf = getThreadCommandBuffer();
+  Result ret = 0;
+
+  if (pxipmHandle == 0 && R_FAILED(ret = pxipmConnect())) return ret;
 
   cmdbuf[0] = IPC_MakeHeader(0x1,2,2); // 0x10082
   cmdbuf[1] = (u32)(prog_handle);
@@ -53,8 +73,7 @@ Result PXIPM_GetProgramInfo(ExHeader_Info *exheader, u64 prog_handle)
   cmdbuf[3] = (0x400 << 8) | 0x4;
   cmdbuf[4] = (u32)exheader;
 
-  Result ret = 0;
-  if(R_FAILED(ret = svcSendSyncRequest(pxipmHandle))) return ret;
+  if(R_FAILED(ret = statsSendSyncRequest(STAT_IPC_PXIPM_GETPROGRAMINFO, pxipmHandle))) return ret;
 
   return cmdbuf[1];
 }
@@ -62,13 +81,15 @@ Result PXIPM_GetProgramInfo(ExHeader_Info *exheader, u64 prog_handle)
 Result PXIPM_UnregisterProgram(u64 prog_handle)
 {
   u32 *cmdbuf = getThreadCommandBuffer();
+  Result ret = 0;
+
+  if (pxipmHandle == 0 && R_FAILED(ret = pxipmConnect())) return ret;
 
   cmdbuf[0] = IPC_MakeHeader(0x3,2,0); // 0x30080
   cmdbuf[1] = (u32)(prog_handle);
   cmdbuf[2] = (u32)(prog_handle >> 32);
 
-  Result ret = 0;
-  if(R_FAILED(ret = svcSendSyncRequest(pxipmHandle))) return ret;
+  if(R_FAILED(ret = statsSendSyncRequest(STAT_IPC_PXIPM_UNREGISTERPROGRAM, pxipmHandle))) return ret;
 
   return cmdbuf[1];
 }
@@ -1,6 +1,11 @@
 #include <3ds.h>
 #include <string.h>
 #include "srvsys.h"
+#include "stats.h"
+
+// srv: may not be up yet when we start, retry with a bounded exponential backoff
+#define SRV_CONNECT_DELAY_MIN 10000LL
+#define SRV_CONNECT_DELAY_MAX 2000000LL
 
 static Handle srvHandle;
 static int srvRefCount;
@@ -10,6 +15,7 @@ static int initLockinit = 0;
 Result srvSysInit()
 {
   Result rc = 0;
+  s64 delay = SRV_CONNECT_DELAY_MIN;
 
   if (!initLockinit)
   {
@@ -31,7 +37,9 @@ Result srvSysInit()
         R_SUMMARY(rc) != RS_NOTFOUND || 
         R_DESCRIPTION(rc) != RD_NOT_FOUND
        ) break;
-    svcSleepThread(500000);
+    svcSleepThread(delay);
+    delay *= 2;
+    if (delay > SRV_CONNECT_DELAY_MAX) delay = SRV_CONNECT_DELAY_MAX;
   }
   if (R_SUCCEEDED(rc))
   {
@@ -51,7 +59,7 @@ Result srvSysRegisterClient(void)
   cmdbuf[0] = IPC_MakeHeader(0x1,0,2); // 0x10002
   cmdbuf[1] = IPC_Desc_CurProcessHandle();
 
-  if(R_FAILED(rc = svcSendSyncRequest(srvHandle)))return rc;
+  if(R_FAILED(rc = statsSendSyncRequest(STAT_IPC_SRV_REGISTERCLIENT, srvHandle)))return rc;
 
   return cmdbuf[1];
 }
@@ -87,7 +95,7 @@ Result srvSysGetServiceHandle(Handle* out, const char* name)
   cmdbuf[3] = strlen(name);
   cmdbuf[4] = 0x0;
 
-  if(R_FAILED(rc = svcSendSyncRequest(srvHandle)))return rc;
+  if(R_FAILED(rc = statsSendSyncRequest(STAT_IPC_SRV_GETSERVICEHANDLE, srvHandle)))return rc;
 
   if(out) *out = cmdbuf[3];
 
@@ -101,7 +109,7 @@ Result srvSysEnableNotification(Handle* semaphoreOut)
 
   cmdbuf[0] = IPC_MakeHeader(0x2,0,0);
 
-  if(R_FAILED(rc = svcSendSyncRequest(srvHandle)))return rc;
+  if(R_FAILED(rc = statsSendSyncRequest(STAT_IPC_SRV_ENABLENOTIFICATION, srvHandle)))return rc;
 
   if(semaphoreOut) *semaphoreOut = cmdbuf[3];
 
@@ -115,7 +123,7 @@ Result srvSysReceiveNotification(u32* notificationIdOut)
 
   cmdbuf[0] = IPC_MakeHeader(0xB,0,0); // 0xB0000
 
-  if(R_FAILED(rc = svcSendSyncRequest(srvHandle)))return rc;
+  if(R_FAILED(rc = statsSendSyncRequest(STAT_IPC_SRV_RECEIVENOTIFICATION, srvHandle)))return rc;
 
   if(notificationIdOut) *notificationIdOut = cmdbuf[2];
 
@@ -132,7 +140,7 @@ Result srvSysRegisterService(Handle* out, const char* name, int maxSessions)
   cmdbuf[3] = strlen(name);
   cmdbuf[4] = maxSessions;
 
-  if(R_FAILED(rc = svcSendSyncRequest(srvHandle)))return rc;
+  if(R_FAILED(rc = statsSendSyncRequest(STAT_IPC_SRV_REGISTERSERVICE, srvHandle)))return rc;
 
   if(out) *out = cmdbuf[3];
 
@@ -148,7 +156,7 @@ Result srvSysUnregisterService(const char* name)
   strncpy((char*) &cmdbuf[1], name,8);
   cmdbuf[3] = strlen(name);
 
-  if(R_FAILED(rc = svcSendSyncRequest(srvHandle)))return rc;
+  if(R_FAILED(rc = statsSendSyncRequest(STAT_IPC_SRV_UNREGISTERSERVICE, srvHandle)))return rc;
 
   return cmdbuf[1];
 }
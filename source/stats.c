@@ -0,0 +1,108 @@
+#include <3ds.h>
+#include <string.h>
+#include "stats.h"
+
+static union{
+    loader_stats_t stats;
+    u8 page[STATS_BLOCK_SIZE];
+} g_block ALIGN(0x1000);
+
+loader_stats_t *const g_stats = &g_block.stats;
+
+// from the linker script and the Makefile
+extern u8 __start__[];
+extern u8 __bss_start__[];
+extern u8 __bss_end__[];
+
+static Handle g_block_handle;
+static u64 g_start_tick;
+static int g_replied;
+
+Result statsInit(void){
+    g_start_tick = svcGetSystemTick();
+    g_stats->magic = STATS_MAGIC;
+    g_stats->version = STATS_VERSION;
+    g_stats->size = sizeof(loader_stats_t);
+    g_stats->ticks_per_sec = SYSCLOCK_ARM11;
+    g_stats->image_size = (u32)(__bss_end__ - __start__);
+    g_stats->bss_size = (u32)(__bss_end__ - __bss_start__);
+    statsRegisterFootprint(STAT_MODULE_STATS, sizeof(g_block));
+
+    // readers only ever get to look, updates never need an IPC round trip
+    return svcCreateMemoryBlock(&g_block_handle, (u32)&g_block, STATS_BLOCK_SIZE, MEMPERM_READ | MEMPERM_WRITE, MEMPERM_READ);
+}
+
+void statsExit(void){
+    if (g_block_handle != 0) svcCloseHandle(g_block_handle);
+    g_block_handle = 0;
+}
+
+Handle statsGetBlockHandle(void){
+    return g_block_handle;
+}
+
+void statsMarkReply(void){
+    if (g_replied) return;
+    g_replied = 1;
+    g_stats->first_reply_ticks = svcGetSystemTick() - g_start_tick;
+}
+
+static int stats_bucket(u64 ticks){
+    int bucket;
+
+    if (ticks >> 32) return STATS_HIST_BUCKETS - 1;
+    if (ticks == 0) return 0;
+    bucket = 31 - __builtin_clz((u32)ticks) - (STATS_HIST_SHIFT - 1);
+    if (bucket < 0) return 0;
+    if (bucket >= STATS_HIST_BUCKETS) return STATS_HIST_BUCKETS - 1;
+    return bucket;
+}
+
+Result statsSendSyncRequest(stats_ipc_id_t id, Handle session){
+    stats_ipc_t *stat;
+    u64 start;
+    u64 ticks;
+    Result res;
+
+    start = svcGetSystemTick();
+    res = svcSendSyncRequest(session);
+    ticks = svcGetSystemTick() - start;
+
+    stat = &g_stats->ipc[id];
+    STATS_INC(stat->calls);
+    STATS_ADD(stat->ticks, ticks);
+    STATS_INC(stat->hist[stats_bucket(ticks)]);
+    if (R_FAILED(res)) STATS_INC(stat->errors);
+    return res;
+}
+
+void statsPaintStack(u32 base, u32 size){
+    u32 *word;
+
+    for (word = (u32 *)base; word < (u32 *)(base + size); word++) *word = STATS_STACK_PAINT;
+}
+
+void statsRegisterStack(int slot, u32 base, u32 size){
+    if (slot >= STATS_MAX_STACKS) return;
+    g_stats->stacks[slot].base = base;
+    g_stats->stacks[slot].size = size;
+}
+
+void statsRegisterFootprint(stats_module_id_t id, u32 size){
+    g_stats->footprint[id] = size;
+}
+
+// stacks grow down, the first overwritten word from the bottom is the deepest point reached
+void statsRefreshMemory(void){
+    stats_stack_t *stack;
+    u32 *word;
+    int i;
+
+    for (i = 0; i < STATS_MAX_STACKS; i++){
+        stack = &g_stats->stacks[i];
+        if (stack->size == 0) continue;
+        word = (u32 *)stack->base;
+        while (word < (u32 *)(stack->base + stack->size) && *word == STATS_STACK_PAINT) word++;
+        stack->used = stack->base + stack->size - (u32)word;
+    }
+}
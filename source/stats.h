@@ -0,0 +1,120 @@
+#pragma once
+
+#include <3ds/types.h>
+
+// Counters published in a read-only memory block, see Loader command 0x100.
+// Layout changes must bump STATS_VERSION.
+
+#define STATS_MAGIC 0x5453444C // "LDST"
+#define STATS_VERSION 12
+#define STATS_BLOCK_SIZE 0x1000
+#define STATS_HIST_BUCKETS 16
+#define STATS_HIST_SHIFT 10 // bucket 0 holds calls under 2^10 ticks (~4us), each next one doubles
+#define STATS_MAX_STACKS 4
+#define STATS_STACK_PREFETCH (STATS_MAX_STACKS - 1) // the workers take the slots from 1
+#define STATS_MAX_POOLS 4
+#define STATS_STACK_PAINT 0x5A5A5A5A
+
+typedef enum{
+    STAT_IPC_SRV_REGISTERCLIENT = 0,
+    STAT_IPC_SRV_GETSERVICEHANDLE,
+    STAT_IPC_SRV_ENABLENOTIFICATION,
+    STAT_IPC_SRV_RECEIVENOTIFICATION,
+    STAT_IPC_SRV_REGISTERSERVICE,
+    STAT_IPC_SRV_UNREGISTERSERVICE,
+    STAT_IPC_FSREG_CHECKHOSTLOADID,
+    STAT_IPC_FSREG_LOADPROGRAM,
+    STAT_IPC_FSREG_GETPROGRAMINFO,
+    STAT_IPC_FSREG_UNLOADPROGRAM,
+    STAT_IPC_FSREG_UNREGISTER,
+    STAT_IPC_FSREG_REGISTER,
+    STAT_IPC_FSLDR_INITIALIZEWITHSDKVERSION,
+    STAT_IPC_FSLDR_SETPRIORITY,
+    STAT_IPC_FSLDR_OPENFILEDIRECTLY,
+    STAT_IPC_FSLDR_OPENDIRECTORY,
+    STAT_IPC_FSLDR_OPENARCHIVE,
+    STAT_IPC_FSLDR_CLOSEARCHIVE,
+    STAT_IPC_PXIPM_REGISTERPROGRAM,
+    STAT_IPC_PXIPM_GETPROGRAMINFO,
+    STAT_IPC_PXIPM_UNREGISTERPROGRAM,
+    STAT_IPC_COUNT
+} stats_ipc_id_t;
+
+// modules that own more than a handful of bytes of .data/.bss
+typedef enum{
+    STAT_MODULE_LOADER = 0,
+    STAT_MODULE_STATS,
+    STAT_MODULE_TRACE,
+    STAT_MODULE_PREFETCH,
+    STAT_MODULE_DEPGRAPH,
+    STAT_MODULE_OVERRIDES,
+    STAT_MODULE_PATCHDB,
+    STAT_MODULE_ARENA,
+    STAT_MODULE_COUNT
+} stats_module_id_t;
+
+typedef struct{
+    u32 base;
+    u32 size;
+    u32 used; // high-water mark, refreshed by statsRefreshMemory
+} stats_stack_t;
+
+// one per arena_id_t
+typedef struct{
+    u32 quota;
+    u32 used;
+    u32 high; // most ever used at once
+    u32 failures; // allocations refused for lack of quota
+} stats_pool_t;
+
+typedef struct{
+    u32 calls;
+    u32 errors; // transport errors only, service results are not inspected
+    u64 ticks;
+    u32 hist[STATS_HIST_BUCKETS];
+} stats_ipc_t;
+
+typedef struct{
+    u32 magic;
+    u16 version;
+    u16 size;
+    u64 ticks_per_sec;
+    u64 first_reply_ticks; // process start to the first Loader reply
+    stats_ipc_t ipc[STAT_IPC_COUNT];
+    u32 loads;
+    u32 load_failures;
+    u32 exheader_cache_hits;
+    u32 exheader_cache_misses;
+    u64 bytes_read;
+    u64 bytes_decompressed;
+    u32 patches_applied;
+    u32 prefetch_hits;
+    u32 prefetch_misses; // titles in the boot manifest that still had to be read
+    u64 prefetch_ticks_saved; // last boot's read time minus the copy out of the prefetch buffer
+    u32 overrides_applied; // exheaders changed by /rei/overrides.dat
+    u32 overrides_rejected; // left alone because the result would have been out of bounds
+    u32 unregisters_deferred; // acknowledged before the teardown ran
+    u32 registers_delayed; // held back until a teardown of the same title finished
+    u32 patchdb_reloads;
+    u32 patchdb_reloads_rejected; // the running patches were kept
+    u32 image_size; // code, data and bss of the loader itself
+    u32 bss_size;
+    u32 footprint[STAT_MODULE_COUNT];
+    stats_stack_t stacks[STATS_MAX_STACKS]; // main thread first, then the workers, the prefetcher last
+    stats_pool_t pools[STATS_MAX_POOLS];
+} loader_stats_t;
+
+extern loader_stats_t *const g_stats;
+
+#define STATS_ADD(field, n) __atomic_fetch_add(&(field), (n), __ATOMIC_RELAXED)
+#define STATS_INC(field) STATS_ADD(field, 1)
+
+Result statsInit(void);
+void statsExit(void);
+Handle statsGetBlockHandle(void);
+void statsMarkReply(void);
+Result statsSendSyncRequest(stats_ipc_id_t id, Handle session);
+void statsPaintStack(u32 base, u32 size);
+void statsRegisterStack(int slot, u32 base, u32 size);
+void statsRegisterFootprint(stats_module_id_t id, u32 size);
+void statsRefreshMemory(void);
@@ -0,0 +1,160 @@
+#ifdef LOADER_TRACE
+
+#include <3ds.h>
+#include <string.h>
+#include "trace.h"
+#include "ifile.h"
+#include "stats.h"
+
+#define TRACE_RING_SIZE 256
+#define TRACE_FLUSH_BATCH 128
+
+// Records are appended by the workers and written out in batches. When the
+// SD card can't keep up new records are dropped rather than overwriting ones
+// that a flush may be copying out.
+static trace_record_t g_ring[TRACE_RING_SIZE];
+static u32 g_head; // next slot to fill
+static u32 g_tail; // oldest record not yet on SD
+static u32 g_seq;
+static u32 g_dropped;
+static int g_checked; // the file on SD was found to be in this format
+static LightLock g_ring_lock;
+static LightLock g_flush_lock;
+
+void trace_init(void){
+    LightLock_Init(&g_ring_lock);
+    LightLock_Init(&g_flush_lock);
+    statsRegisterFootprint(STAT_MODULE_TRACE, sizeof(g_ring));
+}
+
+u32 trace_begin(void){
+    return (u32)AtomicIncrement((s32 *)&g_seq);
+}
+
+static void push(const trace_record_t *rec){
+    LightLock_Lock(&g_ring_lock);
+    if (g_head - g_tail >= TRACE_RING_SIZE){
+        g_dropped++;
+    }
+    else{
+        memcpy(&g_ring[g_head % TRACE_RING_SIZE], rec, sizeof(trace_record_t));
+        g_head++;
+    }
+    LightLock_Unlock(&g_ring_lock);
+}
+
+void trace_record(u32 seq, u64 progid, trace_stage_t stage){
+    trace_record_t rec;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.progid = progid;
+    rec.tick = svcGetSystemTick();
+    rec.seq = seq;
+    rec.stage = stage;
+    push(&rec);
+}
+
+void trace_command(u16 cmdid, u64 prog_handle, u64 progid, Result result, u32 size, u64 received){
+    trace_record_t rec;
+    u64 ticks;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.progid = progid;
+    rec.tick = svcGetSystemTick();
+    rec.stage = TRACE_COMMAND;
+    rec.cmdid = cmdid;
+    rec.prog_handle = prog_handle;
+    rec.result = result;
+    rec.size = size;
+    ticks = rec.tick - received;
+    rec.ticks = ticks > 0xFFFFFFFF ? 0xFFFFFFFF : ticks;
+    push(&rec);
+}
+
+static Result trace_open(IFile *file){
+    FS_Path apath;
+    FS_Path ppath;
+    trace_file_header_t header;
+    u64 size;
+    u64 total;
+    Result res;
+
+    apath.type = PATH_EMPTY;
+    apath.size = 1;
+    apath.data = (u8 *)"";
+    ppath.type = PATH_ASCII;
+    ppath.data = TRACE_PATH;
+    ppath.size = sizeof(TRACE_PATH);
+
+    if (R_FAILED(res = IFile_Open(file, ARCHIVE_SDMC, apath, ppath, FS_OPEN_READ | FS_OPEN_WRITE | FS_OPEN_CREATE))) return res;
+    if (R_FAILED(res = IFile_GetSize(file, &size))) goto fail;
+    if (size && !g_checked){
+        // a trace from another format would be misread with ours appended, start over
+        if (size < sizeof(header) || R_FAILED(IFile_Read(file, &total, &header, sizeof(header))) || total != sizeof(header) ||
+            header.magic != TRACE_MAGIC || header.version != TRACE_VERSION || header.record_size != sizeof(trace_record_t)){
+            if (R_FAILED(res = FSFILE_SetSize(file->handle, 0))) goto fail;
+            file->pos = 0;
+            size = 0;
+        }
+        else{
+            size -= (size - sizeof(header)) % sizeof(trace_record_t); // a record cut short by a power loss
+        }
+    }
+    g_checked = 1;
+    if (size == 0){
+        header.magic = TRACE_MAGIC;
+        header.version = TRACE_VERSION;
+        header.record_size = sizeof(trace_record_t);
+        header.ticks_per_sec = SYSCLOCK_ARM11;
+        if (R_FAILED(res = IFile_Write(file, &total, &header, sizeof(header), 0))) goto fail;
+        file->pos = sizeof(header); // IFile_Write leaves file->size alone
+    }
+    else file->pos = size;
+    return 0;
+
+    fail:
+    IFile_Close(file);
+    return res;
+}
+
+void trace_flush(int force){
+    IFile file;
+    u32 head, tail, first, count;
+    u64 total;
+    Result res;
+
+    LightLock_Lock(&g_flush_lock);
+    LightLock_Lock(&g_ring_lock);
+    head = g_head;
+    tail = g_tail;
+    LightLock_Unlock(&g_ring_lock);
+
+    if (head == tail || (!force && head - tail < TRACE_FLUSH_BATCH)){
+        LightLock_Unlock(&g_flush_lock);
+        return;
+    }
+
+    if (R_SUCCEEDED(trace_open(&file))){
+        // the pending span may wrap around the end of the ring
+        res = 0;
+        while (tail != head && R_SUCCEEDED(res)){
+            first = tail % TRACE_RING_SIZE;
+            count = head - tail;
+            if (first + count > TRACE_RING_SIZE) count = TRACE_RING_SIZE - first;
+            res = IFile_Write(&file, &total, &g_ring[first], count * sizeof(trace_record_t), 0);
+            tail += count;
+        }
+        IFile_Close(&file);
+    }
+    else{
+        // no SD card, don't let stale records hold the ring hostage
+        tail = head;
+    }
+
+    LightLock_Lock(&g_ring_lock);
+    g_tail = tail;
+    LightLock_Unlock(&g_ring_lock);
+    LightLock_Unlock(&g_flush_lock);
+}
+
+#endif
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <3ds/types.h>
+
+// Per-stage LoadProcess timing and every Loader command served. Build with
+// LOADER_TRACE=1 to enable, otherwise every TRACE_* macro compiles to nothing.
+
+#define TRACE_PATH "/rei/trace.bin"
+#define TRACE_MAGIC 0x4352544C // "LTRC"
+#define TRACE_VERSION 2
+
+// each record marks the end of the named stage
+typedef enum{
+    TRACE_STAGE_BEGIN = 0,
+    TRACE_STAGE_GETPROGRAMINFO,
+    TRACE_STAGE_ALLOCATE,
+    TRACE_STAGE_READ,
+    TRACE_STAGE_DECOMPRESS,
+    TRACE_STAGE_PATCH,
+    TRACE_STAGE_CREATECODESET,
+    TRACE_STAGE_CREATEPROCESS,
+    TRACE_STAGE_COUNT,
+    TRACE_COMMAND = 0x100 // a reply, tick is when it was sent
+} trace_stage_t;
+
+typedef struct{
+    u32 magic;
+    u16 version;
+    u16 record_size;
+    u64 ticks_per_sec;
+} PACKED trace_file_header_t;
+
+typedef struct{
+    u64 progid;
+    u64 tick;
+    u32 seq; // groups the records of one LoadProcess, 0 for commands
+    u16 stage;
+    u16 cmdid;
+    // commands only
+    u64 prog_handle;
+    u32 result;
+    u32 size; // bytes read for loads, titles for GetLaunchOrder
+    u32 ticks; // from the request arriving to the reply
+    u32 reserved;
+} PACKED trace_record_t;
+
+#ifdef LOADER_TRACE
+
+void trace_init(void);
+u32 trace_begin(void);
+void trace_record(u32 seq, u64 progid, trace_stage_t stage);
+void trace_command(u16 cmdid, u64 prog_handle, u64 progid, Result result, u32 size, u64 received);
+void trace_flush(int force);
+
+#define TRACE_INIT() trace_init()
+#define TRACE_BEGIN(seq) ((seq) = trace_begin())
+#define TRACE_STAGE(seq, progid, stage) trace_record((seq), (progid), (stage))
+#define TRACE_COMMAND(cmdid, prog_handle, progid, result, size, received) trace_command((cmdid), (prog_handle), (progid), (result), (size), (received))
+#define TRACE_FLUSH() trace_flush(0)
+#define TRACE_FLUSH_ALL() trace_flush(1)
+
+#else
+
+#define TRACE_INIT() do {} while (0)
+#define TRACE_BEGIN(seq) do {} while (0)
+#define TRACE_STAGE(seq, progid, stage) do {} while (0)
+#define TRACE_COMMAND(cmdid, prog_handle, progid, result, size, received) do {} while (0)
+#define TRACE_FLUSH() do {} while (0)
+#define TRACE_FLUSH_ALL() do {} while (0)
+
+#endif
@@ -0,0 +1,181 @@
+// Times a chain of anchored patches against the same patches searching
+// the whole image, with both patch engines from source/patcher.c.
+//
+//   cc -O2 -Itools/host -o anchorbench tools/anchorbench.c
+//   anchorbench [runs]
+//
+// Each image is random bytes holding a 16 byte anchor and, within the
+// window after it, CHAIN 8 byte patterns to patch. The anchored set is the
+// anchor with an empty replacement plus the patterns anchored to it, the
+// unanchored set the same patterns on their own. The patterns occur once,
+// so both sets must write the same bytes; the run fails with exit code 1
+// if they or the two engines ever disagree. Times are the best of runs
+// (default 5) in ms.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LOADER_FUSED_PATCH
+#define LZSS_CHUNK_SIZE 0x2000 // must match source/loader.c
+
+#include <3ds.h>
+#include "../source/stats.h"
+#include "../source/patchdb.h"
+
+#define MAX_IMAGE_SIZE (8 << 20)
+#define CHAIN 4
+#define ANCHOR_LEN 16
+#define TARGET_LEN 8
+#define PROGID 0x0004013000001102LL // not MSET, so only these patches apply
+
+static loader_stats_t stats;
+loader_stats_t *const g_stats = &stats;
+
+void statsRegisterFootprint(stats_module_id_t id, u32 size){}
+
+static patch_t patches[CHAIN + 1];
+static int num_patches;
+
+patchdb_t *patchdb_acquire(void){ return NULL; }
+void patchdb_release(patchdb_t *db){}
+
+int patchdb_lookup(patchdb_t *db, u64 progid, u16 *records, int max){
+    int i;
+
+    for (i = 0; i < num_patches && i < max; i++) records[i] = i;
+    return i;
+}
+
+void patchdb_get(patchdb_t *db, u16 record, patch_t *patch){
+    *patch = patches[record];
+}
+
+#include "../source/arena.c"
+#include "../source/patcher.c"
+
+static u8 original[MAX_IMAGE_SIZE];
+static u8 direct[MAX_IMAGE_SIZE];
+static u8 fused[MAX_IMAGE_SIZE];
+static u8 reference[MAX_IMAGE_SIZE];
+static u8 anchor[ANCHOR_LEN];
+static u8 targets[CHAIN][TARGET_LEN];
+static u8 replacement[TARGET_LEN];
+static u8 memory[ARENA_SCRATCH_SIZE];
+static arena_t scratch;
+static patch_set_t set;
+static int runs = 5;
+
+static double now_ms(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static void make_set(int anchored, u32 window){
+    patch_t *patch;
+    int i;
+
+    num_patches = 0;
+    if (anchored){
+        patch = &patches[num_patches++];
+        memset(patch, 0, sizeof(*patch));
+        patch->pattern = anchor;
+        patch->patlen = ANCHOR_LEN;
+        patch->replace = replacement;
+        patch->replen = 0;
+        patch->align = 1;
+        patch->count = 1;
+        patch->anchor = PATCH_NO_ANCHOR;
+    }
+    for (i = 0; i < CHAIN; i++){
+        patch = &patches[num_patches++];
+        memset(patch, 0, sizeof(*patch));
+        patch->pattern = targets[i];
+        patch->patlen = TARGET_LEN;
+        patch->replace = replacement;
+        patch->replen = TARGET_LEN;
+        patch->align = 1;
+        patch->count = 1;
+        patch->anchor = anchored ? 0 : PATCH_NO_ANCHOR;
+        patch->window = window;
+    }
+}
+
+// best of runs for each engine, leaves the patched images in direct and fused
+static void time_set(u32 size, double *direct_ms, double *fused_ms){
+    double start, ms;
+    u32 top, lo;
+    int run;
+
+    for (run = 0; run < runs; run++){
+        memcpy(direct, original, size);
+        start = now_ms();
+        patch_code(PROGID, direct, size, &scratch);
+        ms = now_ms() - start;
+        if (run == 0 || ms < *direct_ms) *direct_ms = ms;
+
+        memcpy(fused, original, size);
+        start = now_ms();
+        patch_prepare(&set, &scratch, PROGID, fused, size, fused + size);
+        for (top = size; top > 0; top = lo){
+            lo = top > LZSS_CHUNK_SIZE ? top - LZSS_CHUNK_SIZE : 0;
+            patch_scan(&set, fused + lo, fused + top);
+        }
+        patch_apply(&set);
+        ms = now_ms() - start;
+        if (run == 0 || ms < *fused_ms) *fused_ms = ms;
+    }
+}
+
+int main(int argc, char **argv){
+    static const u32 sizes[] = {1 << 20, 4 << 20, 8 << 20};
+    static const u32 windows[] = {0x100, 0x1000};
+    static const char *places[] = {"start", "middle", "end"};
+    double anchored_ms[2], plain_ms[2];
+    u32 size, window, at, i, j;
+    int place, s, w;
+    int failed = 0;
+
+    if (argc > 1) runs = atoi(argv[1]);
+    if (runs < 1){
+        fprintf(stderr, "usage: %s [runs]\n", argv[0]);
+        return 2;
+    }
+    arena_init(&scratch, memory, sizeof(memory));
+    srand(1);
+    for (i = 0; i < MAX_IMAGE_SIZE; i++) original[i] = rand();
+    for (i = 0; i < ANCHOR_LEN; i++) anchor[i] = rand();
+    for (i = 0; i < CHAIN; i++) for (j = 0; j < TARGET_LEN; j++) targets[i][j] = rand();
+    memset(replacement, 0xAA, sizeof(replacement));
+
+    printf("%-7s %-7s %-6s  %-21s  %-21s\n", "image", "window", "chain", "direct ms", "fused ms");
+    printf("%-7s %-7s %-6s  %10s %10s  %10s %10s\n", "", "", "at", "anchored", "whole", "anchored", "whole");
+    for (s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++){
+        size = sizes[s];
+        for (w = 0; w < (int)(sizeof(windows) / sizeof(windows[0])); w++){
+            window = windows[w];
+            for (place = 0; place < 3; place++){
+                at = place == 0 ? 0x1000 : place == 1 ? size / 2 : size - 2 * window;
+                srand(size + window + place);
+                for (i = 0; i < MAX_IMAGE_SIZE; i++) original[i] = rand();
+                memcpy(original + at, anchor, ANCHOR_LEN);
+                for (i = 0; i < CHAIN; i++) memcpy(original + at + ANCHOR_LEN + i * (window - ANCHOR_LEN) / CHAIN, targets[i], TARGET_LEN);
+
+                make_set(0, 0);
+                time_set(size, &plain_ms[0], &plain_ms[1]);
+                if (memcmp(direct, fused, size)) failed = 1;
+                memcpy(reference, direct, size);
+                make_set(1, window);
+                time_set(size, &anchored_ms[0], &anchored_ms[1]);
+                if (memcmp(direct, fused, size) || memcmp(direct, reference, size)) failed = 1;
+
+                printf("%4u MiB %#7x %-6s  %10.3f %10.3f  %10.3f %10.3f%s\n", size >> 20, window, places[place], anchored_ms[0],
+                    plain_ms[0], anchored_ms[1], plain_ms[1], failed ? "  DIFFERENT OUTPUT" : "");
+            }
+        }
+    }
+    return failed;
+}
@@ -0,0 +1,148 @@
+// Measures how long after the loader starts pm gets its first reply, with
+// srv, fs:REG, fs:LDR and PxiPM coming up at different times, see
+// tools/host/standin.h.
+//
+//   cc -O2 -pthread -no-pie -Itools/host -Wno-pointer-to-int-cast -Wno-int-to-pointer-cast
+//       -Wno-incompatible-pointer-types -o bootlatency tools/bootlatency.c tools/host/standin.c source/[!l]*.c
+//   bootlatency [-r runs]
+//
+// Every scenario is a boot where each service becomes ready the given
+// number of milliseconds after the loader process starts. pm connects as
+// soon as "Loader" is registered, sends RegisterProgram and then
+// LoadProcess for one title. Times are from the start of the boot:
+//
+//   registered   "Loader" registered with srv
+//   srv tries    connects to srv: until one went through
+//   first reply  the RegisterProgram reply as pm saw it
+//   loader       the loader's own first_reply_ticks, the same from its side
+//   first load   the LoadProcess reply
+//
+// Services the loader connects to on first use (fs:LDR, PxiPM) should only
+// move "first load", never "first reply". Each figure is the median of -r
+// runs (default 5). Exits 1 if a boot failed.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "host/standin.h"
+
+#define MAX_RUNS 64
+#define APP_PROGID 0x0004000000100000ULL
+
+typedef struct{
+    const char *name;
+    u32 ready_ms[STANDIN_SERVICE_COUNT];
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+    {"everything up", {0, 0, 0, 0}},
+    {"srv late", {20, 20, 20, 20}},
+    {"fs:REG late", {0, 20, 20, 20}},
+    {"fs:LDR and PxiPM late", {0, 0, 50, 50}},
+    {"srv late, fs:LDR and PxiPM later", {20, 20, 100, 100}},
+};
+
+typedef struct{
+    double first_reply_ms;
+    double first_load_ms;
+    int failed;
+} pm_result_t;
+
+typedef enum{
+    COL_REGISTERED,
+    COL_SRV_TRIES,
+    COL_FIRST_REPLY,
+    COL_LOADER,
+    COL_FIRST_LOAD,
+    COL_COUNT
+} column_t;
+
+static pm_result_t *g_result;
+
+static void pm(void *arg){
+    Handle session, process;
+    u64 prog_handle;
+
+    session = standin_connect();
+    if (R_FAILED(standin_register(session, APP_PROGID, &prog_handle))){
+        g_result->failed = 1;
+        return;
+    }
+    g_result->first_reply_ms = standin_now_ms();
+    if (R_FAILED(standin_load(session, prog_handle, &process))){
+        g_result->failed = 1;
+        return;
+    }
+    g_result->first_load_ms = standin_now_ms();
+    standin_close(process);
+    standin_unregister(session, prog_handle);
+}
+
+static int compare(const void *a, const void *b){
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv){
+    static double samples[COL_COUNT][MAX_RUNS];
+    standin_config_t cfg;
+    standin_report_t report;
+    const scenario_t *scenario;
+    char *dir;
+    u32 runs = 5, s, r, c;
+    int opt, ok = 1;
+
+    while ((opt = getopt(argc, argv, "r:")) != -1){
+        if (opt == 'r') runs = strtoul(optarg, NULL, 0);
+        else{
+            fprintf(stderr, "usage: %s [-r runs]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (runs == 0 || runs > MAX_RUNS){
+        fprintf(stderr, "%s: -r must be 1 to %u\n", argv[0], MAX_RUNS);
+        return 2;
+    }
+
+    dir = standin_temp_dir();
+    if (!standin_write_title(dir, APP_PROGID, 0, 0x40000, 1)){
+        fprintf(stderr, "%s: could not write titles to %s\n", argv[0], dir);
+        standin_remove_dir(dir);
+        return 1;
+    }
+    g_result = standin_shared(sizeof(pm_result_t));
+    standin_defaults(&cfg);
+    cfg.titles = dir;
+
+    printf("256 KiB title, storage %.1f MiB/s + %u us per request, %u us per service connect, median of %u runs\n",
+        cfg.storage_mib_s, cfg.storage_latency_us, cfg.connect_us, runs);
+    printf("%-34s %23s %10s %9s %11s %8s %10s\n", "", "ready ms srv/REG/LDR/PM", "registered", "srv tries", "first reply",
+        "loader", "first load");
+    for (s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); s++){
+        scenario = &scenarios[s];
+        for (c = 0; c < STANDIN_SERVICE_COUNT; c++) cfg.ready_us[c] = scenario->ready_ms[c] * 1000;
+        for (r = 0; r < runs; r++){
+            memset(g_result, 0, sizeof(pm_result_t));
+            if (standin_boot(&cfg, pm, NULL, &report) || g_result->failed){
+                printf("%-34s boot failed\n", scenario->name);
+                ok = 0;
+                break;
+            }
+            samples[COL_REGISTERED][r] = report.registered_ms;
+            samples[COL_SRV_TRIES][r] = report.srv_attempts;
+            samples[COL_FIRST_REPLY][r] = g_result->first_reply_ms;
+            samples[COL_LOADER][r] = report.stats.first_reply_ticks * 1000.0 / SYSCLOCK_ARM11;
+            samples[COL_FIRST_LOAD][r] = g_result->first_load_ms;
+        }
+        if (r < runs) continue;
+        for (c = 0; c < COL_COUNT; c++) qsort(samples[c], runs, sizeof(double), compare);
+        printf("%-34s %8u/%3u/%3u/%3u %10.2f %9.0f %11.2f %8.2f %10.2f\n", scenario->name, scenario->ready_ms[STANDIN_SRV],
+            scenario->ready_ms[STANDIN_FSREG], scenario->ready_ms[STANDIN_FSLDR], scenario->ready_ms[STANDIN_PXIPM],
+            samples[COL_REGISTERED][runs / 2], samples[COL_SRV_TRIES][runs / 2], samples[COL_FIRST_REPLY][runs / 2],
+            samples[COL_LOADER][runs / 2], samples[COL_FIRST_LOAD][runs / 2]);
+    }
+    standin_remove_dir(dir);
+    return !ok;
+}
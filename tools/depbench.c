@@ -0,0 +1,173 @@
+// Benchmarks the dependency graph behind GetLaunchOrder (0x103) on
+// synthetic 100 title systems, see source/depgraph.c.
+//
+//   cc -O2 -Itools/host -o depbench tools/depbench.c
+//   depbench [calls]
+//
+// Each system is a table of exheaders handed to depgraph_levels through
+// its fetch callback, so only the graph build is timed; on the device
+// every fetch is an exheader read that costs far more. The levels that
+// come back are checked against a reference: a title sits one level above
+// the highest of its dependencies in the set, titles on or behind a cycle
+// get DEPGRAPH_NO_LEVEL. Exits 1 if any system comes out wrong.
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <3ds.h>
+#include "../source/stats.h"
+#include "../source/depgraph.h"
+
+static loader_stats_t stats;
+loader_stats_t *const g_stats = &stats;
+
+void statsRegisterFootprint(stats_module_id_t id, u32 size){}
+
+#include "../source/depgraph.c"
+
+#define TITLES 100
+#define DEPLIST_LEN (sizeof(((exheader_header *)0)->deplist.programid) / sizeof(u64))
+#define BASE_PROGID 0x0004013000001002LL
+#define OUTSIDE_PROGID 0x0004013000008002LL // dependencies that are not in the set
+
+typedef struct{
+    u64 progid;
+    u64 deps[DEPLIST_LEN];
+} title_t;
+
+static title_t titles[TITLES];
+static u64 handles[TITLES];
+static u32 fetches;
+
+static Result fetch(exheader_header *exheader, u64 prog_handle){
+    title_t *title = &titles[prog_handle];
+
+    fetches++;
+    exheader->arm11systemlocalcaps.programid = title->progid;
+    memcpy(exheader->deplist.programid, title->deps, sizeof(title->deps));
+    return 0;
+}
+
+static u64 progid_of(u32 i){
+    return BASE_PROGID + ((u64)i << 8);
+}
+
+static u32 seed;
+
+static u32 next_rand(void){
+    seed = seed * 1103515245 + 12345;
+    return seed >> 16;
+}
+
+// dep_count dependencies on titles below each one, plus a few outside the set
+static void make_system(const char *name, u32 dep_count, int chain, int cycle, int reversed){
+    u32 i, d, n;
+
+    seed = 1;
+    memset(titles, 0, sizeof(titles));
+    for (i = 0; i < TITLES; i++){
+        titles[i].progid = progid_of(i);
+        n = 0;
+        if (chain && i > 0) titles[i].deps[n++] = progid_of(i - 1);
+        for (d = 0; d < dep_count && i > 0; d++) titles[i].deps[n++] = progid_of(next_rand() % i);
+        if (dep_count) titles[i].deps[n++] = OUTSIDE_PROGID + ((u64)(next_rand() % 4) << 8);
+    }
+    if (cycle){
+        // 10 -> 12 -> 11 -> 10
+        titles[10].deps[DEPLIST_LEN - 1] = progid_of(12);
+        titles[12].deps[DEPLIST_LEN - 1] = progid_of(11);
+        titles[11].deps[DEPLIST_LEN - 1] = progid_of(10);
+    }
+    for (i = 0; i < TITLES; i++) handles[i] = reversed ? TITLES - 1 - i : i;
+    printf("%-34s", name);
+}
+
+static int reference_level(u32 i, u8 *state, u8 *level){
+    u32 d, j, l;
+    int dep;
+
+    if (state[i] == 2) return level[i];
+    if (state[i] == 1) return DEPGRAPH_NO_LEVEL; // back on the path, a cycle
+    state[i] = 1;
+    l = 0;
+    for (d = 0; d < DEPLIST_LEN; d++){
+        if (titles[i].deps[d] < BASE_PROGID || titles[i].deps[d] > progid_of(TITLES - 1)) continue;
+        j = (titles[i].deps[d] - BASE_PROGID) >> 8;
+        if (j == i) continue;
+        dep = reference_level(j, state, level);
+        if (dep == DEPGRAPH_NO_LEVEL){
+            l = DEPGRAPH_NO_LEVEL;
+            break;
+        }
+        if ((u32)dep + 1 > l) l = dep + 1;
+    }
+    state[i] = 2;
+    level[i] = l;
+    return l;
+}
+
+static double now_us(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// times depgraph_levels and checks its answer, returns 0 if it was wrong
+static int run(u32 calls){
+    static exheader_header scratch;
+    u8 levels[TITLES], state[TITLES], expected[TITLES];
+    u32 level_count, i, max_level, wrong;
+    double start, us;
+    Result res = 0;
+
+    fetches = 0;
+    start = now_us();
+    for (i = 0; i < calls; i++) res = depgraph_levels(handles, TITLES, &scratch, fetch, levels, &level_count);
+    us = (now_us() - start) / calls;
+    if (R_FAILED(res)){
+        printf(" failed %08x\n", (u32)res);
+        return 0;
+    }
+
+    memset(state, 0, sizeof(state));
+    max_level = 0;
+    wrong = 0;
+    for (i = 0; i < TITLES; i++){
+        reference_level(i, state, expected);
+        if (expected[i] != DEPGRAPH_NO_LEVEL && expected[i] + 1U > max_level) max_level = expected[i] + 1;
+    }
+    // levels is in handle order
+    for (i = 0; i < TITLES; i++) if (levels[i] != expected[handles[i]]) wrong++;
+    if (level_count != max_level) wrong++;
+    printf(" %8.2f us %6u fetches %4u levels%s\n", us, fetches / calls, level_count, wrong ? "  WRONG LEVELS" : "");
+    return wrong == 0;
+}
+
+int main(int argc, char **argv){
+    u32 calls = (argc > 1) ? strtoul(argv[1], NULL, 0) : 10000;
+    int ok = 1;
+
+    if (calls == 0){
+        fprintf(stderr, "usage: %s [calls]\n", argv[0]);
+        return 2;
+    }
+    depgraphInit();
+    printf("%u titles, mean of %u calls\n", TITLES, calls);
+    make_system("no dependencies", 0, 0, 0, 0);
+    ok &= run(calls);
+    make_system("3 dependencies each", 3, 0, 0, 0);
+    ok &= run(calls);
+    make_system("3 dependencies each, reversed", 3, 0, 0, 1);
+    ok &= run(calls);
+    make_system("9 dependencies each", 9, 0, 0, 0);
+    ok &= run(calls);
+    make_system("one chain", 0, 1, 0, 0);
+    ok &= run(calls);
+    make_system("one chain, reversed", 0, 1, 0, 1);
+    ok &= run(calls);
+    make_system("3 dependencies each, one cycle", 3, 0, 1, 0);
+    ok &= run(calls);
+    return !ok;
+}
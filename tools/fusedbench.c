@@ -0,0 +1,206 @@
+// Times decompression and patching of compressed titles as the loader does
+// them, to compare the two-pass patcher with LOADER_FUSED_PATCH, see
+// tools/host/standin.h. Build it once each way and run both:
+//
+//   cc -O2 -pthread -no-pie -Itools/host -Wno-pointer-to-int-cast -Wno-int-to-pointer-cast
+//       -Wno-incompatible-pointer-types -o fusedbench tools/fusedbench.c tools/host/standin.c source/[!l]*.c
+//   the same with -DLOADER_FUSED_PATCH -o fusedbench-fused
+//   fusedbench [-t titles] [-s title KiB] [-p patches per title] [-r runs]
+//
+// The titles are lzss compressed and patches.dat, in the original format,
+// has -p patches (default 8) for each of them:
+//
+//   none      no patches, decompression alone
+//   found     8 byte patterns that occur a few times in the image, the
+//             first time some way in, count 1
+//   absent    12 byte patterns that never occur, every one a full pass
+//
+// Every title gets -r DryRuns (default 5) on free storage, the loader's
+// own DECOMPRESS and PATCH stage times from the reply are kept, the best
+// of the runs per title, and summed over the titles. The two-pass build
+// decodes the image and then searches it; the fused build searches each
+// LZSS_CHUNK_SIZE of output as the decoder finishes it and applies the
+// hits afterwards. The host caches hold a whole image, the ARM11's 16 KiB
+// data cache does not, so a gain here understates one on the device and a
+// loss overstates it. Exits 1 if a DryRun failed.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "host/standin.h"
+
+#define MAX_TITLES 32
+#define MAX_RUNS 64
+#define MAX_PATCHES 16 // PATCH_MAX_RECORDS in source/patcher.h
+#define APP_PROGID 0x0004000000100000ULL
+#define DRYRUN_DECOMPRESS 5 // reply words, 1 + TRACE_STAGE_DECOMPRESS
+#define DRYRUN_PATCH 6
+
+typedef enum{
+    SCENARIO_NONE,
+    SCENARIO_FOUND,
+    SCENARIO_ABSENT,
+    SCENARIO_COUNT
+} scenario_t;
+
+static const char *scenario_names[SCENARIO_COUNT] = {"none", "found", "absent"};
+
+typedef struct{
+    u64 decompress_ticks;
+    u64 patch_ticks;
+    Result failed;
+} pm_result_t;
+
+static pm_result_t *g_result;
+static u32 g_titles, g_runs;
+
+static u64 progid_of(u32 i){
+    return APP_PROGID | (u64)i << 8;
+}
+
+static void pm(void *arg){
+    u32 cmdbuf[64];
+    Handle session;
+    u64 prog_handle, decompress, patch;
+    Result res;
+    u32 i, r;
+
+    session = standin_connect();
+    for (i = 0; i < g_titles && !g_result->failed; i++){
+        if (R_FAILED(res = standin_register(session, progid_of(i), &prog_handle))){
+            g_result->failed = res;
+            break;
+        }
+        decompress = patch = ~0ULL;
+        for (r = 0; r < g_runs; r++){
+            cmdbuf[0] = IPC_MakeHeader(0x104, 2, 0);
+            memcpy(&cmdbuf[1], &prog_handle, sizeof(u64));
+            if (R_FAILED(res = standin_request(session, cmdbuf, NULL)) || R_FAILED(res = cmdbuf[1])){
+                g_result->failed = res;
+                break;
+            }
+            if (cmdbuf[DRYRUN_DECOMPRESS] < decompress) decompress = cmdbuf[DRYRUN_DECOMPRESS];
+            if (cmdbuf[DRYRUN_PATCH] < patch) patch = cmdbuf[DRYRUN_PATCH];
+        }
+        g_result->decompress_ticks += decompress;
+        g_result->patch_ticks += patch;
+        standin_unregister(session, prog_handle);
+    }
+}
+
+// the words standin_write_title builds the title's image from, half of it is these
+static void title_dictionary(u64 progid, u32 *dictionary){
+    u32 i;
+
+    srand(progid ^ progid >> 32);
+    for (i = 0; i < 64; i++) dictionary[i] = 0xE0000000 | (rand() & 0x0FFFFFFF);
+}
+
+static int write_patches(const char *sd, scenario_t scenario, u32 patches){
+    char path[4096];
+    u32 dictionary[64], words[3], i, p, w;
+    u64 progid;
+    u8 record[12];
+    FILE *f;
+
+    snprintf(path, sizeof(path), "%s/rei/patches/patches.dat", sd);
+    if ((f = fopen(path, "wb")) == NULL) return 0;
+    for (i = 0; i < g_titles && scenario != SCENARIO_NONE; i++){
+        progid = progid_of(i);
+        title_dictionary(progid, dictionary);
+        srand(i + 1);
+        for (p = 0; p < patches; p++){
+            if (scenario == SCENARIO_FOUND){
+                words[0] = dictionary[rand() % 64];
+                words[1] = dictionary[rand() % 64];
+            }
+            else{
+                // no image word has these high bits
+                for (w = 0; w < 3; w++) words[w] = 0x0F0F0000 | (rand() & 0xFFFF);
+            }
+            record[0] = scenario == SCENARIO_FOUND ? 8 : 12; // pattern_len
+            record[1] = 4; // patch_len
+            record[2] = 0; // offset
+            record[3] = 1; // count
+            fwrite(&progid, 8, 1, f);
+            fwrite(record, 4, 1, f);
+            fwrite(words, record[0], 1, f);
+            fwrite(&words[0], 4, 1, f); // writes back what is there, the image stays valid
+        }
+    }
+    return fclose(f) == 0;
+}
+
+int main(int argc, char **argv){
+    standin_config_t cfg;
+    char path[4096];
+    char *dir, *sd;
+    scenario_t scenario;
+    u32 size = 1024, patches = 8, i;
+    int opt, ok = 1;
+
+    g_titles = 8;
+    g_runs = 5;
+    while ((opt = getopt(argc, argv, "t:s:p:r:")) != -1){
+        switch (opt){
+            case 't': g_titles = strtoul(optarg, NULL, 0); break;
+            case 's': size = strtoul(optarg, NULL, 0); break;
+            case 'p': patches = strtoul(optarg, NULL, 0); break;
+            case 'r': g_runs = strtoul(optarg, NULL, 0); break;
+            default:
+                fprintf(stderr, "usage: %s [-t titles] [-s title KiB] [-p patches per title] [-r runs]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (g_titles == 0 || g_titles > MAX_TITLES || size == 0 || patches == 0 || patches > MAX_PATCHES || g_runs == 0 ||
+        g_runs > MAX_RUNS){
+        fprintf(stderr, "%s: -t must be 1 to %u, -p 1 to %u, -r 1 to %u, -s at least 1\n", argv[0], MAX_TITLES, MAX_PATCHES,
+            MAX_RUNS);
+        return 2;
+    }
+
+    dir = standin_temp_dir();
+    sd = standin_temp_dir();
+    for (i = 0; i < g_titles; i++){
+        if (!standin_write_title(dir, progid_of(i), 0, size << 10, 1)) ok = 0;
+    }
+    snprintf(path, sizeof(path), "%s/rei", sd);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/rei/patches", sd);
+    mkdir(path, 0755);
+    if (!ok){
+        fprintf(stderr, "%s: could not write titles to %s\n", argv[0], dir);
+        standin_remove_dir(dir);
+        standin_remove_dir(sd);
+        return 1;
+    }
+    g_result = standin_shared(sizeof(pm_result_t));
+    standin_defaults(&cfg);
+    cfg.titles = dir;
+    cfg.sd = sd;
+    cfg.storage_mib_s = 0;
+
+#ifdef LOADER_FUSED_PATCH
+    printf("LOADER_FUSED_PATCH build, ");
+#else
+    printf("two-pass build, ");
+#endif
+    printf("%u compressed titles of %u KiB, %u patches each, best of %u DryRuns\n", g_titles, size, patches, g_runs);
+    printf("  %-10s %12s %9s %9s\n", "ms", "decompress", "patch", "total");
+    for (scenario = 0; scenario < SCENARIO_COUNT; scenario++){
+        memset(g_result, 0, sizeof(pm_result_t));
+        if (!write_patches(sd, scenario, patches) || standin_boot(&cfg, pm, NULL, NULL) || g_result->failed){
+            printf("  %-10s failed %08x\n", scenario_names[scenario], (u32)g_result->failed);
+            ok = 0;
+            continue;
+        }
+        printf("  %-10s %12.3f %9.3f %9.3f\n", scenario_names[scenario], g_result->decompress_ticks * 1000.0 / SYSCLOCK_ARM11,
+            g_result->patch_ticks * 1000.0 / SYSCLOCK_ARM11,
+            (g_result->decompress_ticks + g_result->patch_ticks) * 1000.0 / SYSCLOCK_ARM11);
+    }
+    standin_remove_dir(dir);
+    standin_remove_dir(sd);
+    return !ok;
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+// Host stand-in for <3ds.h>, enough to build source/patcher.c,
+// source/patchdb.c, source/overrides.c and source/depgraph.c into the
+// tools, and with tools/host/standin.c the whole loader. svcControlMemory
+// and the file calls are left to the tool or to standin.c.
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <3ds/types.h>
+
+#define R_SUCCEEDED(res) ((res) >= 0)
+#define R_FAILED(res) ((res) < 0)
+#define R_LEVEL(res) (((res) >> 27) & 0x1F)
+#define R_SUMMARY(res) (((res) >> 21) & 0x3F)
+#define R_MODULE(res) (((res) >> 10) & 0xFF)
+#define R_DESCRIPTION(res) ((res) & 0x3FF)
+#define MAKERESULT(level, summary, module, description) \
+    ((((level) & 0x1F) << 27) | (((summary) & 0x3F) << 21) | (((module) & 0xFF) << 10) | ((description) & 0x3FF))
+
+// only the codes the shared sources return
+enum{ RL_SUCCESS = 0, RL_INFO = 1, RL_TEMPORARY = 26, RL_PERMANENT = 27 };
+enum{ RS_SUCCESS = 0, RS_NOP = 1, RS_OUTOFRESOURCE = 3, RS_NOTFOUND = 4, RS_INVALIDSTATE = 5, RS_NOTSUPPORTED = 6, RS_INVALIDARG = 7 };
+enum{ RM_KERNEL = 1, RM_LDR = 64 };
+enum{ RD_TOO_LARGE = 1001, RD_INVALID_SIZE = 1004, RD_INVALID_COMBINATION = 1006, RD_NO_DATA = 1007, RD_BUSY = 1008,
+    RD_OUT_OF_MEMORY = 1011, RD_ALREADY_INITIALIZED = 1017, RD_NOT_FOUND = 1018, RD_OUT_OF_RANGE = 1021 };
+
+#define USERBREAK_ASSERT 1
+
+#define MEMOP_FREE 1
+#define MEMOP_ALLOC 3
+#define MEMPERM_READ 1
+#define MEMPERM_WRITE 2
+
+#define ALIGN(m) __attribute__((aligned(m)))
+#define U64_MAX UINT64_MAX
+#define SYSCLOCK_ARM11 268111856LL
+#define CUR_THREAD_HANDLE 0xFFFF8000
+#define CUR_PROCESS_HANDLE 0xFFFF8001
+
+typedef pthread_mutex_t LightLock;
+typedef pthread_mutex_t RecursiveLock;
+
+static inline void LightLock_Init(LightLock *lock){ pthread_mutex_init(lock, NULL); }
+static inline void LightLock_Lock(LightLock *lock){ pthread_mutex_lock(lock); }
+static inline void LightLock_Unlock(LightLock *lock){ pthread_mutex_unlock(lock); }
+
+static inline void RecursiveLock_Init(RecursiveLock *lock){
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+static inline void RecursiveLock_Lock(RecursiveLock *lock){ pthread_mutex_lock(lock); }
+static inline void RecursiveLock_Unlock(RecursiveLock *lock){ pthread_mutex_unlock(lock); }
+
+// the return values are libctru's, the value before or after the change
+#define AtomicIncrement(ptr) __atomic_add_fetch((ptr), 1, __ATOMIC_SEQ_CST)
+#define AtomicDecrement(ptr) __atomic_sub_fetch((ptr), 1, __ATOMIC_SEQ_CST)
+#define AtomicPostIncrement(ptr) __atomic_fetch_add((ptr), 1, __ATOMIC_SEQ_CST)
+
+static inline u32 IPC_MakeHeader(u16 command_id, unsigned normal_params, unsigned translate_params){
+    return ((u32)command_id << 16) | ((normal_params & 0x3F) << 6) | (translate_params & 0x3F);
+}
+static inline u32 IPC_Desc_StaticBuffer(size_t size, unsigned buffer_id){ return (size << 14) | ((buffer_id & 0xF) << 10) | 0x2; }
+static inline u32 IPC_Desc_CurProcessHandle(void){ return 0x20; }
+static inline u32 IPC_Desc_SharedHandles(unsigned number){ return (number - 1) << 26; }
+static inline u32 IPC_Desc_MoveHandles(unsigned number){ return ((number - 1) << 26) | 0x10; }
+
+typedef enum{
+    IPC_BUFFER_R = 2,
+    IPC_BUFFER_W = 4,
+    IPC_BUFFER_RW = 6
+} IPC_BufferRights;
+
+static inline u32 IPC_Desc_Buffer(size_t size, IPC_BufferRights rights){ return (size << 4) | 0x8 | rights; }
+
+typedef enum{
+    ARCHIVE_SDMC = 9,
+    ARCHIVE_SAVEDATA_AND_CONTENT2 = 0x2345678E
+} FS_ArchiveID;
+
+typedef enum{
+    MEDIATYPE_NAND = 0,
+    MEDIATYPE_SD = 1,
+    MEDIATYPE_GAME_CARD = 2
+} FS_MediaType;
+
+enum{ PATH_EMPTY = 1, PATH_BINARY = 2, PATH_ASCII = 3 };
+
+#define FS_OPEN_READ 1
+#define FS_OPEN_WRITE 2
+#define FS_OPEN_CREATE 4
+
+typedef struct{
+    u32 type;
+    u32 size;
+    const void *data;
+} FS_Path;
+
+typedef u64 FS_Archive;
+
+typedef struct{
+    u64 programId;
+    u8 mediaType;
+    u8 padding[7];
+} FS_ProgramInfo;
+
+// the loader passes its own exheader_header and storage info, only pointers cross here
+typedef struct ExHeader_Info ExHeader_Info;
+typedef struct ExHeader_Arm11StorageInfo ExHeader_Arm11StorageInfo;
+
+typedef struct{
+    u8 name[8];
+    u16 version;
+    u16 padding[3];
+    u32 text_addr;
+    u32 text_size;
+    u32 ro_addr;
+    u32 ro_size;
+    u32 rw_addr;
+    u32 rw_size;
+    u32 text_size_total;
+    u32 ro_size_total;
+    u32 rw_size_total;
+    u32 padding2;
+    u64 program_id;
+} CodeSetHeader;
+
+static inline void svcBreak(int reason){ abort(); }
+Result svcControlMemory(u32 *addr_out, u32 addr0, u32 addr1, u32 size, u32 op, u32 perm);
+
+Result FSFILE_Close(Handle handle);
+Result FSFILE_GetSize(Handle handle, u64 *size);
+Result FSFILE_Read(Handle handle, u32 *bytesRead, u64 offset, void *buffer, u32 size);
+Result FSFILE_Write(Handle handle, u32 *bytesWritten, u64 offset, const void *buffer, u32 size, u32 flags);
+Result FSFILE_SetSize(Handle handle, u64 size);
+
+// the kernel, only tools/host/standin.c has them
+u32 *getThreadCommandBuffer(void);
+u64 svcGetSystemTick(void);
+void svcSleepThread(s64 ns);
+void svcExitThread(void) __attribute__((noreturn));
+void svcExitProcess(void) __attribute__((noreturn));
+Result svcCloseHandle(Handle handle);
+Result svcSendSyncRequest(Handle session);
+Result svcConnectToPort(Handle *out, const char *portName);
+Result svcAcceptSession(Handle *session, Handle port);
+Result svcReplyAndReceive(s32 *index, const Handle *handles, s32 handleCount, Handle replyTarget);
+Result svcCreateSemaphore(Handle *semaphore, s32 initial_count, s32 max_count);
+Result svcReleaseSemaphore(s32 *count, Handle semaphore, s32 release_count);
+Result svcWaitSynchronization(Handle handle, s64 nanoseconds);
+Result svcCreateThread(Handle *thread, void (*entrypoint)(void *), u32 arg, u32 *stack_top, s32 thread_priority, s32 processor_id);
+Result svcGetThreadPriority(s32 *out, Handle handle);
+Result svcGetProcessId(u32 *out, Handle handle);
+Result svcCreateMemoryBlock(Handle *memblock, u32 addr, u32 size, u32 my_perm, u32 other_perm);
+Result svcCreateCodeSet(Handle *out, const CodeSetHeader *info, u32 code_ptr, u32 ro_ptr, u32 data_ptr);
+Result svcCreateProcess(Handle *out, Handle codeset, const u32 *arm11_kernel_caps, u32 arm11_kernel_caps_num);
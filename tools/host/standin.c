@@ -0,0 +1,1383 @@
+// Stand-in kernel and services that run source/loader.c on a Linux host,
+// see standin.h.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "standin.h"
+
+// the device's main stack is not where the host thread runs, see standin_paint_stack
+static void standin_paint_stack(u32 base, u32 size);
+#define statsPaintStack standin_paint_stack
+#define main loader_main
+#define feof ifile_feof // ifile.h declares its own
+#include "../../source/loader.c"
+#undef feof
+#undef main
+#undef statsPaintStack
+
+#define MAX_HANDLES 1024
+#define HANDLE_BASE 0x1000
+#define MAX_PROGRAMS 256
+#define MAX_NOTIFICATIONS 16
+#define THREAD_STACK_SIZE 0x40000
+#define TLS_WORDS 0x100 // the command buffer and the static buffer descriptors after it
+
+#define SESSION_CLOSED 0xC920181A
+#define KERNEL_INVALID_HANDLE 0xD8E007F7
+#define KERNEL_OUT_OF_RANGE 0xD8E007FD
+#define KERNEL_TIMEOUT 0x09401BFE
+#define SRV_NOT_FOUND 0xD8E06406
+#define FS_NOT_FOUND 0xC8804478
+#define FS_NOT_SUPPORTED 0xE0C046BE
+#define UNKNOWN_COMMAND 0xD900182F
+
+#define PROG_HANDLE_BASE 0xFFFF000000000000ULL // what fs:REG hands out, never a PxiPM handle
+#define SDMC_ARCHIVE 0x5D00000000ULL
+
+typedef enum{
+    OBJ_FREE = 0,
+    OBJ_PORT,
+    OBJ_SERVER_SESSION,
+    OBJ_CLIENT_SESSION,
+    OBJ_SERVICE, // a session to a stand-in service
+    OBJ_FILE,
+    OBJ_SEMAPHORE,
+    OBJ_THREAD,
+    OBJ_BLOCK,
+    OBJ_CODESET,
+    OBJ_PROCESS
+} obj_type_t;
+
+typedef enum{
+    SESSION_IDLE = 0,
+    SESSION_SENT, // waiting to be received
+    SESSION_RECEIVED, // with the server
+    SESSION_REPLIED
+} session_state_t;
+
+typedef struct session{
+    session_state_t state;
+    u32 *request; // the client's command buffer while a request is out
+    void *static_buf; // where a static buffer in the reply goes
+    int client_open;
+    int server_open;
+    int accepted;
+    struct session *next; // in the port's accept queue
+} session_t;
+
+typedef struct{
+    obj_type_t type;
+    session_t *session; // sessions, the port's accept queue
+    session_t *tail;
+    standin_service_t service;
+    s32 count; // semaphore
+    s32 max;
+    int exited; // thread
+    int fd; // file
+    u64 progid; // code set and process
+} kobj_t;
+
+typedef struct{
+    u64 prog_handle;
+    u64 progid;
+} program_t;
+
+// a read or write waiting for the device
+typedef struct io{
+    u32 priority;
+    u64 seq;
+    struct io *next;
+} io_t;
+
+typedef struct{
+    void (*entry)(void *);
+    void *arg;
+    Handle self;
+} thread_start_t;
+
+static standin_config_t k_cfg;
+static standin_report_t *k_report;
+static struct timespec k_start;
+
+// one lock for every kernel object, anything that changes state wakes every waiter
+static pthread_mutex_t k_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t k_cond = PTHREAD_COND_INITIALIZER;
+static kobj_t k_objs[MAX_HANDLES];
+static Handle k_loader_port;
+static Handle k_notification;
+static u32 k_notifications[MAX_NOTIFICATIONS];
+static u32 k_notification_count;
+static int k_process_exited;
+static u32 k_processes;
+static program_t k_programs[MAX_PROGRAMS];
+static u32 k_program_count;
+static u64 k_next_program;
+static u32 k_fsldr_priority;
+static __thread u32 k_tls[TLS_WORDS];
+static __thread Handle k_self;
+
+static pthread_mutex_t io_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t io_cond = PTHREAD_COND_INITIALIZER;
+static io_t *io_queue;
+static u64 io_seq;
+static int io_busy;
+
+// stats.c sizes the image from the device linker script, the host image is not the device's
+u8 __start__[1], __bss_start__[1], __bss_end__[1];
+
+static double elapsed_us(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec - k_start.tv_sec) * 1e6 + (ts.tv_nsec - k_start.tv_nsec) / 1e3;
+}
+
+double standin_now_ms(void){
+    return elapsed_us() / 1000;
+}
+
+static void sleep_until_us(double us){
+    struct timespec ts;
+
+    ts.tv_sec = k_start.tv_sec + (time_t)(us / 1e6);
+    ts.tv_nsec = k_start.tv_nsec + (long)((us - (time_t)(us / 1e6) * 1e6) * 1e3);
+    if (ts.tv_nsec >= 1000000000){
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL));
+}
+
+static void sleep_us(double us){
+    if (us > 0) sleep_until_us(elapsed_us() + us);
+}
+
+// kernel objects, called with k_lock held
+
+static Handle new_obj(obj_type_t type, kobj_t **out){
+    int i;
+
+    for (i = 0; i < MAX_HANDLES; i++){
+        if (k_objs[i].type != OBJ_FREE) continue;
+        memset(&k_objs[i], 0, sizeof(kobj_t));
+        k_objs[i].type = type;
+        k_objs[i].fd = -1;
+        if (out) *out = &k_objs[i];
+        return HANDLE_BASE + i;
+    }
+    fprintf(stderr, "standin: out of handles\n");
+    abort();
+}
+
+static kobj_t *get_obj(Handle handle){
+    kobj_t *obj;
+
+    if (handle < HANDLE_BASE || handle >= HANDLE_BASE + MAX_HANDLES) return NULL;
+    obj = &k_objs[handle - HANDLE_BASE];
+    return obj->type == OBJ_FREE ? NULL : obj;
+}
+
+static void notify(u32 id){
+    kobj_t *sem;
+
+    if (k_notification_count < MAX_NOTIFICATIONS) k_notifications[k_notification_count++] = id;
+    if ((sem = get_obj(k_notification))) sem->count++;
+    pthread_cond_broadcast(&k_cond);
+}
+
+// the kernel
+
+u32 *getThreadCommandBuffer(void){
+    return k_tls;
+}
+
+u64 svcGetSystemTick(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * SYSCLOCK_ARM11 + (u64)ts.tv_nsec * SYSCLOCK_ARM11 / 1000000000;
+}
+
+void svcSleepThread(s64 ns){
+    sleep_us(ns / 1e3);
+}
+
+static void thread_exited(void){
+    kobj_t *obj;
+
+    pthread_mutex_lock(&k_lock);
+    if ((obj = get_obj(k_self))) obj->exited = 1;
+    pthread_cond_broadcast(&k_cond);
+    pthread_mutex_unlock(&k_lock);
+}
+
+static void *thread_main(void *arg){
+    thread_start_t start = *(thread_start_t *)arg;
+
+    free(arg);
+    k_self = start.self;
+    start.entry(start.arg);
+    thread_exited();
+    return NULL;
+}
+
+// the loader's threads keep pointers to their stacks in 32 bits, so the stacks live in the low 2 GiB
+static void spawn(Handle self, void (*entry)(void *), void *arg){
+    thread_start_t *start;
+    pthread_attr_t attr;
+    pthread_t thread;
+    void *stack;
+
+    stack = mmap(NULL, THREAD_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED) abort();
+    start = malloc(sizeof(thread_start_t));
+    start->entry = entry;
+    start->arg = arg;
+    start->self = self;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, stack, THREAD_STACK_SIZE);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, thread_main, start)) abort();
+    pthread_attr_destroy(&attr);
+}
+
+Result svcCreateThread(Handle *thread, void (*entrypoint)(void *), u32 arg, u32 *stack_top, s32 thread_priority, s32 processor_id){
+    pthread_mutex_lock(&k_lock);
+    *thread = new_obj(OBJ_THREAD, NULL);
+    pthread_mutex_unlock(&k_lock);
+    spawn(*thread, entrypoint, (void *)(uintptr_t)arg);
+    return 0;
+}
+
+void svcExitThread(void){
+    thread_exited();
+    pthread_exit(NULL);
+}
+
+void svcExitProcess(void){
+    pthread_mutex_lock(&k_lock);
+    k_process_exited = 1;
+    pthread_cond_broadcast(&k_cond);
+    pthread_mutex_unlock(&k_lock);
+    pthread_exit(NULL);
+}
+
+Result svcGetThreadPriority(s32 *out, Handle handle){
+    *out = 0x18;
+    return 0;
+}
+
+Result svcGetProcessId(u32 *out, Handle handle){
+    *out = 5;
+    return 0;
+}
+
+Result svcCreateSemaphore(Handle *semaphore, s32 initial_count, s32 max_count){
+    kobj_t *sem;
+
+    pthread_mutex_lock(&k_lock);
+    *semaphore = new_obj(OBJ_SEMAPHORE, &sem);
+    sem->count = initial_count;
+    sem->max = max_count;
+    pthread_mutex_unlock(&k_lock);
+    return 0;
+}
+
+Result svcReleaseSemaphore(s32 *count, Handle semaphore, s32 release_count){
+    kobj_t *sem;
+    Result res = 0;
+
+    pthread_mutex_lock(&k_lock);
+    if ((sem = get_obj(semaphore)) == NULL || sem->type != OBJ_SEMAPHORE) res = KERNEL_INVALID_HANDLE;
+    else if (sem->count + release_count > sem->max) res = KERNEL_OUT_OF_RANGE;
+    else{
+        *count = sem->count;
+        sem->count += release_count;
+        pthread_cond_broadcast(&k_cond);
+    }
+    pthread_mutex_unlock(&k_lock);
+    return res;
+}
+
+// takes what the object has to give, called with k_lock held
+static int acquire(kobj_t *obj){
+    switch (obj->type){
+        case OBJ_SEMAPHORE:
+            if (obj->count == 0) return 0;
+            obj->count--;
+            return 1;
+        case OBJ_THREAD:
+            return obj->exited;
+        case OBJ_PORT:
+            return obj->session != NULL;
+        default:
+            return 0;
+    }
+}
+
+Result svcWaitSynchronization(Handle handle, s64 nanoseconds){
+    struct timespec deadline;
+    kobj_t *obj;
+    Result res = 0;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += nanoseconds / 1000000000;
+    deadline.tv_nsec += nanoseconds % 1000000000;
+    if (deadline.tv_nsec >= 1000000000){
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    pthread_mutex_lock(&k_lock);
+    while (1){
+        if ((obj = get_obj(handle)) == NULL){
+            res = KERNEL_INVALID_HANDLE;
+            break;
+        }
+        if (acquire(obj)) break;
+        if (nanoseconds < 0) pthread_cond_wait(&k_cond, &k_lock);
+        else if (pthread_cond_timedwait(&k_cond, &k_lock, &deadline)){
+            res = KERNEL_TIMEOUT;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&k_lock);
+    return res;
+}
+
+Result svcAcceptSession(Handle *session, Handle port){
+    kobj_t *obj, *server;
+    session_t *s;
+
+    pthread_mutex_lock(&k_lock);
+    obj = get_obj(port);
+    if (obj == NULL || obj->type != OBJ_PORT || obj->session == NULL){
+        pthread_mutex_unlock(&k_lock);
+        return KERNEL_INVALID_HANDLE;
+    }
+    s = obj->session;
+    obj->session = s->next;
+    if (obj->session == NULL) obj->tail = NULL;
+    *session = new_obj(OBJ_SERVER_SESSION, &server);
+    server->session = s;
+    s->server_open = 1;
+    s->accepted = 1;
+    pthread_cond_broadcast(&k_cond);
+    pthread_mutex_unlock(&k_lock);
+    return 0;
+}
+
+// copies the normal and translate parameters, and what static buffers point to into static_buf
+static void copy_message(u32 *dst, const u32 *src, void *static_buf){
+    u32 normal, translate, i, desc;
+
+    normal = (src[0] >> 6) & 0x3F;
+    translate = src[0] & 0x3F;
+    memcpy(dst, src, (1 + normal + translate) * sizeof(u32));
+    for (i = 1 + normal; i < 1 + normal + translate;){
+        desc = src[i];
+        if ((desc & 0xF) == 0){ // handles
+            i += 2 + (desc >> 26);
+            continue;
+        }
+        if ((desc & 0xF) == 2 && static_buf) memcpy(static_buf, (void *)(uintptr_t)src[i + 1], desc >> 14);
+        i += 2;
+    }
+}
+
+Result svcReplyAndReceive(s32 *index, const Handle *handles, s32 handleCount, Handle replyTarget){
+    kobj_t *obj;
+    session_t *s;
+    s32 i;
+
+    pthread_mutex_lock(&k_lock);
+    if (replyTarget){
+        obj = get_obj(replyTarget);
+        s = obj->session;
+        if (!s->client_open){
+            *index = -1;
+            pthread_mutex_unlock(&k_lock);
+            return SESSION_CLOSED;
+        }
+        copy_message(s->request, k_tls, s->static_buf);
+        s->state = SESSION_REPLIED;
+        pthread_cond_broadcast(&k_cond);
+    }
+    while (1){
+        for (i = 0; i < handleCount; i++){
+            obj = get_obj(handles[i]);
+            if (obj->type != OBJ_SERVER_SESSION){
+                if (acquire(obj)) break;
+                continue;
+            }
+            s = obj->session;
+            if (!s->client_open){
+                *index = i;
+                pthread_mutex_unlock(&k_lock);
+                return SESSION_CLOSED;
+            }
+            if (s->state == SESSION_SENT){
+                copy_message(k_tls, s->request, NULL);
+                s->state = SESSION_RECEIVED;
+                break;
+            }
+        }
+        if (i < handleCount) break;
+        pthread_cond_wait(&k_cond, &k_lock);
+    }
+    *index = i;
+    pthread_mutex_unlock(&k_lock);
+    return 0;
+}
+
+Result svcCreateMemoryBlock(Handle *memblock, u32 addr, u32 size, u32 my_perm, u32 other_perm){
+    pthread_mutex_lock(&k_lock);
+    *memblock = new_obj(OBJ_BLOCK, NULL);
+    pthread_mutex_unlock(&k_lock);
+    return 0;
+}
+
+// the loader's heaps and staging window sit at fixed device addresses, from
+// the prefetch heap to the end of the window. The host heap can start
+// anywhere in the low GiB, so the range is held from before main and
+// handed out from the reservation.
+#define RESERVED_BASE PREFETCH_HEAP_ADDR
+#define RESERVED_END SHARED_MEM_END
+#define MAX_REGIONS 64
+
+typedef struct{
+    u32 base;
+    u32 size;
+} region_t;
+
+static region_t k_regions[MAX_REGIONS];
+static pthread_mutex_t k_memory_lock = PTHREAD_MUTEX_INITIALIZER;
+
+__attribute__((constructor)) static void reserve_device_range(void){
+    if (mmap((void *)RESERVED_BASE, RESERVED_END - RESERVED_BASE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE |
+        MAP_FIXED_NOREPLACE, -1, 0) == MAP_FAILED){
+        fprintf(stderr, "standin: %08x-%08x is taken, run again\n", RESERVED_BASE, RESERVED_END);
+        exit(1);
+    }
+}
+
+static int reserved(u32 addr, u32 size){
+    return addr >= RESERVED_BASE && addr + size <= RESERVED_END;
+}
+
+// gives pages back to the reservation
+static void release(u32 addr, u32 size){
+    int i;
+
+    pthread_mutex_lock(&k_memory_lock);
+    mmap((void *)(uintptr_t)addr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+    for (i = 0; i < MAX_REGIONS; i++){
+        if (k_regions[i].size && k_regions[i].base >= addr && k_regions[i].base + k_regions[i].size <= addr + size){
+            k_regions[i].size = 0;
+        }
+    }
+    pthread_mutex_unlock(&k_memory_lock);
+}
+
+Result svcControlMemory(u32 *addr_out, u32 addr0, u32 addr1, u32 size, u32 op, u32 perm){
+    int i, slot = -1;
+    void *p;
+
+    if (!reserved(addr0, size)){
+        if ((op & 0xFF) == MEMOP_FREE) return munmap((void *)(uintptr_t)addr0, size) ? -1 : 0;
+        p = mmap((void *)(uintptr_t)addr0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+        if (p == MAP_FAILED) return -1;
+        *addr_out = addr0;
+        return 0;
+    }
+    if ((op & 0xFF) == MEMOP_FREE){
+        release(addr0, size);
+        return 0;
+    }
+    // like the kernel, pages already handed out are not handed out again
+    pthread_mutex_lock(&k_memory_lock);
+    for (i = 0; i < MAX_REGIONS; i++){
+        if (k_regions[i].size == 0){
+            if (slot < 0) slot = i;
+        }
+        else if (addr0 < k_regions[i].base + k_regions[i].size && k_regions[i].base < addr0 + size) break;
+    }
+    if (i < MAX_REGIONS || slot < 0 || mmap((void *)(uintptr_t)addr0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE |
+        MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED){
+        pthread_mutex_unlock(&k_memory_lock);
+        return -1;
+    }
+    k_regions[slot].base = addr0;
+    k_regions[slot].size = size;
+    pthread_mutex_unlock(&k_memory_lock);
+    *addr_out = addr0;
+    return 0;
+}
+
+// the pages now belong to the code set, the loader only forgets their addresses
+Result svcCreateCodeSet(Handle *out, const CodeSetHeader *info, u32 code_ptr, u32 ro_ptr, u32 data_ptr){
+    kobj_t *codeset;
+
+    release(code_ptr, (info->text_size + info->ro_size + info->rw_size) << 12);
+    pthread_mutex_lock(&k_lock);
+    *out = new_obj(OBJ_CODESET, &codeset);
+    codeset->progid = info->program_id;
+    pthread_mutex_unlock(&k_lock);
+    return 0;
+}
+
+Result svcCreateProcess(Handle *out, Handle codeset, const u32 *arm11_kernel_caps, u32 arm11_kernel_caps_num){
+    kobj_t *process, *obj;
+
+    pthread_mutex_lock(&k_lock);
+    obj = get_obj(codeset);
+    *out = new_obj(OBJ_PROCESS, &process);
+    process->progid = obj->progid;
+    k_processes++;
+    pthread_mutex_unlock(&k_lock);
+    return 0;
+}
+
+Result svcCloseHandle(Handle handle){
+    kobj_t *obj;
+
+    pthread_mutex_lock(&k_lock);
+    if ((obj = get_obj(handle)) == NULL){
+        pthread_mutex_unlock(&k_lock);
+        return KERNEL_INVALID_HANDLE;
+    }
+    switch (obj->type){
+        case OBJ_CLIENT_SESSION:
+            obj->session->client_open = 0;
+            break;
+        case OBJ_SERVER_SESSION:
+            obj->session->server_open = 0;
+            break;
+        case OBJ_FILE:
+            close(obj->fd);
+            break;
+        case OBJ_PROCESS:
+            k_processes--;
+            break;
+        default:
+            break;
+    }
+    obj->type = OBJ_FREE;
+    pthread_cond_broadcast(&k_cond);
+    pthread_mutex_unlock(&k_lock);
+    return 0;
+}
+
+// stacks from this image are painted like on the device, the main stack is a host stack
+static void standin_paint_stack(u32 base, u32 size){
+    if (base == MAIN_STACK_TOP - MAIN_STACK_SIZE) return;
+    statsPaintStack(base, size);
+}
+
+void __sync_init(void){}
+void __sync_fini(void){}
+void __system_initSyscalls(void){}
+
+static void process_main(void *arg){
+    initSystem(NULL);
+    __ctru_exit(loader_main(0, NULL));
+}
+
+// storage
+
+static void storage_access(u32 priority, u32 size){
+    io_t io, **link;
+    int first = 1;
+    u32 chunk;
+
+    if (k_cfg.storage_mib_s <= 0) return;
+    pthread_mutex_lock(&io_lock);
+    k_report->storage_requests++;
+    k_report->storage_bytes += size;
+    io.priority = priority;
+    io.seq = io_seq++;
+    io.next = io_queue;
+    io_queue = &io;
+    while (1){
+        // the device picks the most urgent request, the oldest of those
+        while (1){
+            io_t *best = NULL, *p;
+
+            for (p = io_queue; p; p = p->next){
+                if (best == NULL || p->priority < best->priority || (p->priority == best->priority && p->seq < best->seq)) best = p;
+            }
+            if (!io_busy && best == &io) break;
+            pthread_cond_wait(&io_cond, &io_lock);
+        }
+        io_busy = 1;
+        pthread_mutex_unlock(&io_lock);
+        chunk = size < k_cfg.storage_chunk ? size : k_cfg.storage_chunk;
+        sleep_us((first ? k_cfg.storage_latency_us : 0) + chunk / (k_cfg.storage_mib_s * 1.048576));
+        first = 0;
+        size -= chunk;
+        pthread_mutex_lock(&io_lock);
+        io_busy = 0;
+        pthread_cond_broadcast(&io_cond);
+        if (size == 0) break;
+    }
+    for (link = &io_queue; *link != &io; link = &(*link)->next);
+    *link = io.next;
+    pthread_mutex_unlock(&io_lock);
+}
+
+Result standin_storage_read(u32 priority, u32 size){
+    storage_access(priority, size);
+    return 0;
+}
+
+// fs:REG and PxiPM
+
+static u64 find_program(u64 prog_handle){
+    u64 progid = 0;
+    u32 i;
+
+    pthread_mutex_lock(&k_lock);
+    for (i = 0; i < k_program_count; i++){
+        if (k_programs[i].prog_handle == prog_handle) progid = k_programs[i].progid;
+    }
+    pthread_mutex_unlock(&k_lock);
+    return progid;
+}
+
+static void title_path(char *path, size_t size, u64 progid, const char *ext){
+    snprintf(path, size, "%s/%016llx.%s", k_cfg.titles, (unsigned long long)progid, ext);
+}
+
+static Result load_program(u64 progid, u64 *prog_handle){
+    char path[4096];
+
+    title_path(path, sizeof(path), progid, "exheader");
+    if (access(path, R_OK)) return FS_NOT_FOUND;
+    pthread_mutex_lock(&k_lock);
+    if (k_program_count == MAX_PROGRAMS){
+        pthread_mutex_unlock(&k_lock);
+        return MAKERESULT(RL_PERMANENT, RS_OUTOFRESOURCE, 0, RD_OUT_OF_MEMORY);
+    }
+    *prog_handle = PROG_HANDLE_BASE | ++k_next_program;
+    k_programs[k_program_count].prog_handle = *prog_handle;
+    k_programs[k_program_count].progid = progid;
+    k_program_count++;
+    pthread_mutex_unlock(&k_lock);
+    return 0;
+}
+
+static Result unload_program(u64 prog_handle){
+    Result res = FS_NOT_FOUND;
+    u32 i;
+
+    sleep_us(k_cfg.unload_us);
+    pthread_mutex_lock(&k_lock);
+    for (i = 0; i < k_program_count; i++){
+        if (k_programs[i].prog_handle != prog_handle) continue;
+        k_programs[i] = k_programs[--k_program_count];
+        res = 0;
+        break;
+    }
+    pthread_mutex_unlock(&k_lock);
+    return res;
+}
+
+static Result get_program_info(u64 prog_handle, void *exheader){
+    char path[4096];
+    u64 progid;
+    int fd;
+    Result res = 0;
+
+    if ((progid = find_program(prog_handle)) == 0) return FS_NOT_FOUND;
+    title_path(path, sizeof(path), progid, "exheader");
+    storage_access(FSLDR_PRIORITY_INTERACTIVE, 0x400);
+    if ((fd = open(path, O_RDONLY)) < 0) return FS_NOT_FOUND;
+    if (read(fd, exheader, 0x400) != 0x400) res = FS_NOT_FOUND;
+    close(fd);
+    return res;
+}
+
+// 64 bit parameters take two words, not always 8 byte aligned
+static u64 get_u64(const u32 *words){
+    u64 value;
+
+    memcpy(&value, words, sizeof(value));
+    return value;
+}
+
+static void put_u64(u32 *words, u64 value){
+    memcpy(words, &value, sizeof(value));
+}
+
+static void reply(u32 *cmdbuf, u16 cmdid, Result res){
+    cmdbuf[0] = IPC_MakeHeader(cmdid, 1, 0);
+    cmdbuf[1] = res;
+}
+
+static void fsreg_request(u32 *cmdbuf){
+    u16 cmdid = cmdbuf[0] >> 16;
+    u64 prog_handle;
+    Result res;
+
+    switch (cmdid){
+        case 0x401: // Register
+        case 0x402: // Unregister
+        case 0x406: // CheckHostLoadId, every title is fs:REG's
+            reply(cmdbuf, cmdid, 0);
+            break;
+        case 0x403: // GetProgramInfo
+            reply(cmdbuf, cmdid, get_program_info(get_u64(&cmdbuf[2]), (void *)(uintptr_t)cmdbuf[65]));
+            break;
+        case 0x404: // LoadProgram
+            prog_handle = 0;
+            res = load_program(get_u64(&cmdbuf[1]), &prog_handle);
+            cmdbuf[0] = IPC_MakeHeader(cmdid, 3, 0);
+            cmdbuf[1] = res;
+            put_u64(&cmdbuf[2], prog_handle);
+            break;
+        case 0x405: // UnloadProgram
+            reply(cmdbuf, cmdid, unload_program(get_u64(&cmdbuf[1])));
+            break;
+        default:
+            reply(cmdbuf, 0, UNKNOWN_COMMAND);
+            break;
+    }
+}
+
+static void pxipm_request(u32 *cmdbuf){
+    u16 cmdid = cmdbuf[0] >> 16;
+    u64 prog_handle;
+    Result res;
+
+    switch (cmdid){
+        case 0x1: // GetProgramInfo
+            reply(cmdbuf, cmdid, get_program_info(get_u64(&cmdbuf[1]), (void *)(uintptr_t)cmdbuf[4]));
+            break;
+        case 0x2: // RegisterProgram
+            prog_handle = 0;
+            res = load_program(get_u64(&cmdbuf[1]), &prog_handle);
+            cmdbuf[0] = IPC_MakeHeader(cmdid, 3, 0);
+            cmdbuf[1] = res;
+            put_u64(&cmdbuf[2], prog_handle);
+            break;
+        case 0x3: // UnregisterProgram
+            reply(cmdbuf, cmdid, unload_program(get_u64(&cmdbuf[1])));
+            break;
+        default:
+            reply(cmdbuf, 0, UNKNOWN_COMMAND);
+            break;
+    }
+}
+
+// fs:LDR
+
+static Result open_file(u32 archive, const void *archive_path, u32 archive_size, u32 type, const char *file_path, u32 size,
+    u32 flags, Handle *out){
+    char path[4096];
+    kobj_t *file;
+    u64 prog_handle, progid;
+    int fd;
+
+    if (archive == ARCHIVE_SAVEDATA_AND_CONTENT2){
+        if (archive_size != 8 || size != sizeof(CODE_PATH) || memcmp(file_path, CODE_PATH, size)) return FS_NOT_FOUND;
+        memcpy(&prog_handle, archive_path, 8);
+        if ((progid = find_program(prog_handle)) == 0) return FS_NOT_FOUND;
+        title_path(path, sizeof(path), progid, "code");
+    }
+    else if (archive == ARCHIVE_SDMC){
+        if (k_cfg.sd == NULL || type != PATH_ASCII) return FS_NOT_FOUND;
+        snprintf(path, sizeof(path), "%s%.*s", k_cfg.sd, (int)size, file_path);
+    }
+    else{
+        return FS_NOT_SUPPORTED;
+    }
+    fd = open(path, ((flags & FS_OPEN_WRITE) ? O_RDWR : O_RDONLY) | ((flags & FS_OPEN_CREATE) ? O_CREAT : 0), 0644);
+    if (fd < 0) return FS_NOT_FOUND;
+    pthread_mutex_lock(&k_lock);
+    *out = new_obj(OBJ_FILE, &file);
+    file->fd = fd;
+    pthread_mutex_unlock(&k_lock);
+    return 0;
+}
+
+static void fsldr_request(u32 *cmdbuf){
+    u16 cmdid = cmdbuf[0] >> 16;
+    Handle file = 0;
+    Result res;
+
+    switch (cmdid){
+        case 0x861: // InitializeWithSdkVersion
+        case 0x80E: // CloseArchive
+            reply(cmdbuf, cmdid, 0);
+            break;
+        case 0x862: // SetPriority
+            pthread_mutex_lock(&k_lock);
+            k_fsldr_priority = cmdbuf[1];
+            k_report->set_priority_calls++;
+            pthread_mutex_unlock(&k_lock);
+            reply(cmdbuf, cmdid, 0);
+            break;
+        case 0x803: // OpenFileDirectly
+            res = open_file(cmdbuf[2], (void *)(uintptr_t)cmdbuf[10], cmdbuf[4], cmdbuf[5], (const char *)(uintptr_t)cmdbuf[12],
+                cmdbuf[6], cmdbuf[7], &file);
+            cmdbuf[0] = IPC_MakeHeader(cmdid, 1, 2);
+            cmdbuf[1] = res;
+            cmdbuf[2] = IPC_Desc_MoveHandles(1);
+            cmdbuf[3] = file;
+            break;
+        case 0x802: // OpenFile, only archives of the card are handed out
+            res = open_file(ARCHIVE_SDMC, NULL, 0, cmdbuf[4], (const char *)(uintptr_t)cmdbuf[9], cmdbuf[5], cmdbuf[6], &file);
+            cmdbuf[0] = IPC_MakeHeader(cmdid, 1, 2);
+            cmdbuf[1] = res;
+            cmdbuf[2] = IPC_Desc_MoveHandles(1);
+            cmdbuf[3] = file;
+            break;
+        case 0x80C: // OpenArchive
+            cmdbuf[0] = IPC_MakeHeader(cmdid, 3, 0);
+            cmdbuf[1] = (cmdbuf[1] == ARCHIVE_SDMC && k_cfg.sd) ? 0 : FS_NOT_FOUND;
+            cmdbuf[2] = (u32)SDMC_ARCHIVE;
+            cmdbuf[3] = (u32)(SDMC_ARCHIVE >> 32);
+            break;
+        default:
+            reply(cmdbuf, cmdid, FS_NOT_SUPPORTED);
+            break;
+    }
+}
+
+static int get_fd(Handle handle, u32 *priority){
+    kobj_t *obj;
+    int fd = -1;
+
+    pthread_mutex_lock(&k_lock);
+    if ((obj = get_obj(handle)) && obj->type == OBJ_FILE) fd = obj->fd;
+    *priority = k_cfg.pin_priority ? FSLDR_PRIORITY_INTERACTIVE : k_fsldr_priority;
+    pthread_mutex_unlock(&k_lock);
+    return fd;
+}
+
+Result FSFILE_Read(Handle handle, u32 *bytesRead, u64 offset, void *buffer, u32 size){
+    u32 priority;
+    ssize_t n;
+    int fd;
+
+    if ((fd = get_fd(handle, &priority)) < 0) return KERNEL_INVALID_HANDLE;
+    storage_access(priority, size);
+    if ((n = pread(fd, buffer, size, offset)) < 0) return FS_NOT_FOUND;
+    *bytesRead = n;
+    return 0;
+}
+
+Result FSFILE_Write(Handle handle, u32 *bytesWritten, u64 offset, const void *buffer, u32 size, u32 flags){
+    u32 priority;
+    ssize_t n;
+    int fd;
+
+    if ((fd = get_fd(handle, &priority)) < 0) return KERNEL_INVALID_HANDLE;
+    storage_access(priority, size);
+    if ((n = pwrite(fd, buffer, size, offset)) < 0) return FS_NOT_FOUND;
+    *bytesWritten = n;
+    return 0;
+}
+
+Result FSFILE_GetSize(Handle handle, u64 *size){
+    struct stat st;
+    u32 priority;
+    int fd;
+
+    if ((fd = get_fd(handle, &priority)) < 0 || fstat(fd, &st)) return KERNEL_INVALID_HANDLE;
+    *size = st.st_size;
+    return 0;
+}
+
+Result FSFILE_SetSize(Handle handle, u64 size){
+    u32 priority;
+    int fd;
+
+    if ((fd = get_fd(handle, &priority)) < 0 || ftruncate(fd, size)) return KERNEL_INVALID_HANDLE;
+    return 0;
+}
+
+Result FSFILE_Close(Handle handle){
+    return svcCloseHandle(handle);
+}
+
+// srv
+
+static int service_named(const u32 *cmdbuf, const char *name){
+    return cmdbuf[3] == strlen(name) && !memcmp(&cmdbuf[1], name, cmdbuf[3]);
+}
+
+static void srv_request(u32 *cmdbuf){
+    static const char *names[STANDIN_SERVICE_COUNT] = {"srv:", "fs:REG", "fs:LDR", "PxiPM"};
+    u16 cmdid = cmdbuf[0] >> 16;
+    kobj_t *obj;
+    Handle handle;
+    int service;
+
+    switch (cmdid){
+        case 0x2: // EnableNotification
+            pthread_mutex_lock(&k_lock);
+            k_notification = new_obj(OBJ_SEMAPHORE, &obj);
+            obj->count = k_notification_count;
+            obj->max = MAX_NOTIFICATIONS;
+            cmdbuf[0] = IPC_MakeHeader(cmdid, 1, 2);
+            cmdbuf[1] = 0;
+            cmdbuf[2] = IPC_Desc_SharedHandles(1);
+            cmdbuf[3] = k_notification;
+            pthread_mutex_unlock(&k_lock);
+            break;
+        case 0xB: // ReceiveNotification
+            pthread_mutex_lock(&k_lock);
+            cmdbuf[0] = IPC_MakeHeader(cmdid, 2, 0);
+            cmdbuf[1] = 0;
+            cmdbuf[2] = 0;
+            if (k_notification_count){
+                cmdbuf[2] = k_notifications[0];
+                memmove(k_notifications, k_notifications + 1, --k_notification_count * sizeof(u32));
+            }
+            pthread_mutex_unlock(&k_lock);
+            break;
+        case 0x3: // RegisterService
+            pthread_mutex_lock(&k_lock);
+            handle = new_obj(OBJ_PORT, NULL);
+            if (service_named(cmdbuf, "Loader")){
+                k_loader_port = handle;
+                k_report->registered_ms = standin_now_ms();
+                pthread_cond_broadcast(&k_cond);
+            }
+            cmdbuf[0] = IPC_MakeHeader(cmdid, 1, 2);
+            cmdbuf[1] = 0;
+            cmdbuf[2] = IPC_Desc_MoveHandles(1);
+            cmdbuf[3] = handle;
+            pthread_mutex_unlock(&k_lock);
+            break;
+        case 0x4: // UnregisterService
+            pthread_mutex_lock(&k_lock);
+            if (service_named(cmdbuf, "Loader")) k_loader_port = 0;
+            pthread_mutex_unlock(&k_lock);
+            reply(cmdbuf, cmdid, 0);
+            break;
+        case 0x5: // GetServiceHandle, waits for the service to come up
+            for (service = STANDIN_FSREG; service < STANDIN_SERVICE_COUNT && !service_named(cmdbuf, names[service]); service++);
+            if (service == STANDIN_SERVICE_COUNT){
+                reply(cmdbuf, cmdid, SRV_NOT_FOUND);
+                break;
+            }
+            sleep_until_us(k_cfg.ready_us[service]);
+            sleep_us(k_cfg.connect_us);
+            pthread_mutex_lock(&k_lock);
+            handle = new_obj(OBJ_SERVICE, &obj);
+            obj->service = service;
+            pthread_mutex_unlock(&k_lock);
+            cmdbuf[0] = IPC_MakeHeader(cmdid, 1, 2);
+            cmdbuf[1] = 0;
+            cmdbuf[2] = IPC_Desc_MoveHandles(1);
+            cmdbuf[3] = handle;
+            break;
+        default: // RegisterClient and the rest
+            reply(cmdbuf, cmdid, 0);
+            break;
+    }
+}
+
+Result svcConnectToPort(Handle *out, const char *portName){
+    kobj_t *obj;
+
+    k_report->srv_attempts++;
+    if (strcmp(portName, "srv:") || elapsed_us() < k_cfg.ready_us[STANDIN_SRV]){
+        return MAKERESULT(RL_PERMANENT, RS_NOTFOUND, RM_KERNEL, RD_NOT_FOUND);
+    }
+    pthread_mutex_lock(&k_lock);
+    *out = new_obj(OBJ_SERVICE, &obj);
+    obj->service = STANDIN_SRV;
+    pthread_mutex_unlock(&k_lock);
+    return 0;
+}
+
+Result svcSendSyncRequest(Handle session){
+    kobj_t *obj;
+    standin_service_t service;
+
+    pthread_mutex_lock(&k_lock);
+    obj = get_obj(session);
+    if (obj == NULL || (obj->type != OBJ_SERVICE && obj->type != OBJ_CLIENT_SESSION)){
+        pthread_mutex_unlock(&k_lock);
+        return KERNEL_INVALID_HANDLE;
+    }
+    if (obj->type == OBJ_CLIENT_SESSION){
+        pthread_mutex_unlock(&k_lock);
+        return standin_request(session, k_tls, NULL);
+    }
+    service = obj->service;
+    pthread_mutex_unlock(&k_lock);
+    switch (service){
+        case STANDIN_SRV: srv_request(k_tls); break;
+        case STANDIN_FSREG: fsreg_request(k_tls); break;
+        case STANDIN_FSLDR: fsldr_request(k_tls); break;
+        case STANDIN_PXIPM: pxipm_request(k_tls); break;
+        default: break;
+    }
+    return 0;
+}
+
+// pm
+
+Handle standin_connect(void){
+    kobj_t *port, *client;
+    session_t *s;
+    Handle handle;
+
+    s = calloc(1, sizeof(session_t));
+    s->client_open = 1;
+    pthread_mutex_lock(&k_lock);
+    while (k_loader_port == 0) pthread_cond_wait(&k_cond, &k_lock);
+    port = get_obj(k_loader_port);
+    if (port->tail) port->tail->next = s;
+    else port->session = s;
+    port->tail = s;
+    handle = new_obj(OBJ_CLIENT_SESSION, &client);
+    client->session = s;
+    pthread_cond_broadcast(&k_cond);
+    pthread_mutex_unlock(&k_lock);
+    return handle;
+}
+
+Result standin_request(Handle session, u32 *cmdbuf, void *static_buf){
+    kobj_t *obj;
+    session_t *s;
+    Result res = 0;
+
+    pthread_mutex_lock(&k_lock);
+    if ((obj = get_obj(session)) == NULL || obj->type != OBJ_CLIENT_SESSION){
+        pthread_mutex_unlock(&k_lock);
+        return KERNEL_INVALID_HANDLE;
+    }
+    s = obj->session;
+    s->request = cmdbuf;
+    s->static_buf = static_buf;
+    s->state = SESSION_SENT;
+    pthread_cond_broadcast(&k_cond);
+    // a session the loader has not accepted yet is still open, one it turned away is not
+    while (s->state != SESSION_REPLIED && (!s->accepted || s->server_open)) pthread_cond_wait(&k_cond, &k_lock);
+    if (s->state != SESSION_REPLIED) res = SESSION_CLOSED;
+    s->state = SESSION_IDLE;
+    pthread_mutex_unlock(&k_lock);
+    return res;
+}
+
+void standin_close(Handle handle){
+    svcCloseHandle(handle);
+}
+
+Result standin_register(Handle session, u64 progid, u64 *prog_handle){
+    u32 cmdbuf[64];
+    FS_ProgramInfo title;
+    Result res;
+
+    memset(&title, 0, sizeof(title));
+    title.programId = progid;
+    title.mediaType = MEDIATYPE_NAND;
+    cmdbuf[0] = IPC_MakeHeader(2, 8, 0);
+    memcpy(&cmdbuf[1], &title, sizeof(title));
+    memcpy(&cmdbuf[5], &title, sizeof(title));
+    if (R_FAILED(res = standin_request(session, cmdbuf, NULL))) return res;
+    *prog_handle = get_u64(&cmdbuf[2]);
+    return cmdbuf[1];
+}
+
+Result standin_unregister(Handle session, u64 prog_handle){
+    u32 cmdbuf[64];
+    Result res;
+
+    cmdbuf[0] = IPC_MakeHeader(3, 2, 0);
+    put_u64(&cmdbuf[1], prog_handle);
+    if (R_FAILED(res = standin_request(session, cmdbuf, NULL))) return res;
+    return cmdbuf[1];
+}
+
+Result standin_get_info(Handle session, u64 prog_handle, exheader_header *exheader){
+    u32 cmdbuf[64];
+    Result res;
+
+    cmdbuf[0] = IPC_MakeHeader(4, 2, 0);
+    put_u64(&cmdbuf[1], prog_handle);
+    if (R_FAILED(res = standin_request(session, cmdbuf, exheader))) return res;
+    return cmdbuf[1];
+}
+
+Result standin_load(Handle session, u64 prog_handle, Handle *process){
+    u32 cmdbuf[64];
+    Result res;
+
+    cmdbuf[0] = IPC_MakeHeader(1, 2, 0);
+    put_u64(&cmdbuf[1], prog_handle);
+    if (R_FAILED(res = standin_request(session, cmdbuf, NULL))) return res;
+    *process = cmdbuf[3];
+    return cmdbuf[1];
+}
+
+Result standin_load_batch(Handle session, const u64 *prog_handles, u32 count, Result *results, Handle *processes){
+    u32 cmdbuf[64];
+    Result res;
+    u32 i;
+
+    cmdbuf[0] = IPC_MakeHeader(0x102, 1 + 2 * count, 0);
+    cmdbuf[1] = count;
+    memcpy(&cmdbuf[2], prog_handles, count * sizeof(u64));
+    if (R_FAILED(res = standin_request(session, cmdbuf, NULL))) return res;
+    if (R_FAILED(cmdbuf[1])) return cmdbuf[1];
+    for (i = 0; i < count; i++){
+        results[i] = cmdbuf[3 + i];
+        processes[i] = cmdbuf[4 + count + i];
+    }
+    return 0;
+}
+
+Result standin_dry_run(Handle session, u64 prog_handle){
+    u32 cmdbuf[64];
+    Result res;
+
+    cmdbuf[0] = IPC_MakeHeader(0x104, 2, 0);
+    put_u64(&cmdbuf[1], prog_handle);
+    if (R_FAILED(res = standin_request(session, cmdbuf, NULL))) return res;
+    return cmdbuf[1];
+}
+
+// boots
+
+void standin_defaults(standin_config_t *cfg){
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->connect_us = 200;
+    cfg->unload_us = 2000;
+    cfg->storage_mib_s = 10;
+    cfg->storage_latency_us = 300;
+    cfg->storage_chunk = 0x10000;
+}
+
+void *standin_shared(size_t size){
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (p == MAP_FAILED) abort();
+    memset(p, 0, size);
+    return p;
+}
+
+int standin_boot(const standin_config_t *cfg, void (*pm)(void *arg), void *arg, standin_report_t *report){
+    standin_report_t *shared;
+    Handle loader;
+    pid_t pid;
+    int status, i;
+
+    shared = standin_shared(sizeof(standin_report_t));
+    fflush(stdout);
+    fflush(stderr);
+    clock_gettime(CLOCK_MONOTONIC, &k_start);
+    if ((pid = fork()) < 0) abort();
+    if (pid == 0){
+        k_cfg = *cfg;
+        k_report = shared;
+        pthread_mutex_lock(&k_lock);
+        loader = new_obj(OBJ_THREAD, NULL);
+        pthread_mutex_unlock(&k_lock);
+        spawn(loader, process_main, NULL);
+        pm(arg);
+
+        // pm is done: its sessions go away and the loader is told to terminate
+        pthread_mutex_lock(&k_lock);
+        for (i = 0; i < MAX_HANDLES; i++){
+            if (k_objs[i].type != OBJ_CLIENT_SESSION) continue;
+            k_objs[i].session->client_open = 0;
+            k_objs[i].type = OBJ_FREE;
+        }
+        notify(0x100);
+        while (!k_process_exited) pthread_cond_wait(&k_cond, &k_lock);
+        k_report->processes = k_processes;
+        k_report->stats = *g_stats;
+        pthread_mutex_unlock(&k_lock);
+        fflush(stdout);
+        _exit(0);
+    }
+    while (waitpid(pid, &status, 0) < 0);
+    if (WIFSIGNALED(status)) fprintf(stderr, "standin: the boot died with signal %d\n", WTERMSIG(status));
+    if (report) *report = *shared;
+    munmap(shared, sizeof(standin_report_t));
+    return !(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+// titles
+
+#define BLZ_MIN 3
+#define BLZ_MAX 18
+#define BLZ_WINDOW 0x1002
+#define BLZ_HASH_BITS 14
+#define BLZ_CHAIN 32
+
+static u32 blz_hash(const u8 *src, u32 p){
+    return ((src[p] | src[p - 1] << 8 | src[p - 2] << 16) * 2654435761u) >> (32 - BLZ_HASH_BITS);
+}
+
+// greedy tokens for src[raw, n), last byte first and in the order lzss_decompress reads them
+static u32 blz_tokens(const u8 *src, u32 n, u32 raw, u8 *out){
+    static s32 head[1 << BLZ_HASH_BITS];
+    s32 *prev, q;
+    u32 pos, p, len, best, dist, best_dist = 0, max, flag_at = 0, size = 0, i;
+    u8 bit = 0;
+    int depth;
+
+    prev = malloc(n * sizeof(s32));
+    memset(head, 0xFF, sizeof(head));
+    for (pos = n; pos > raw; pos -= best){
+        if (bit == 0){
+            flag_at = size;
+            out[size++] = 0;
+            bit = 0x80;
+        }
+        p = pos - 1;
+        best = 0;
+        max = pos - raw < BLZ_MAX ? pos - raw : BLZ_MAX;
+        for (q = p >= 2 ? head[blz_hash(src, p)] : -1, depth = 0; q >= 0 && depth < BLZ_CHAIN; q = prev[q], depth++){
+            dist = q - p;
+            if (dist > BLZ_WINDOW) break;
+            if (dist < BLZ_MIN) continue;
+            for (len = 0; len < max && src[p - len] == src[q - len]; len++);
+            if (len > best){
+                best = len;
+                best_dist = dist;
+                if (len == max) break;
+            }
+        }
+        if (best >= BLZ_MIN){
+            out[size++] = (best - BLZ_MIN) << 4 | (best_dist - BLZ_MIN) >> 8;
+            out[size++] = (best_dist - BLZ_MIN) & 0xFF;
+            out[flag_at] |= bit;
+        }
+        else{
+            best = 1;
+            out[size++] = src[p];
+        }
+        for (i = 0; i < best; i++){
+            if (p - i < 2) continue;
+            prev[p - i] = head[blz_hash(src, p - i)];
+            head[blz_hash(src, p - i)] = p - i;
+        }
+        bit >>= 1;
+    }
+    free(prev);
+    return size;
+}
+
+// lays src out the way .code is stored, 0 if it does not get smaller
+static u32 blz_compress(const u8 *src, u32 n, u8 *file){
+    u8 *tokens, *check;
+    u32 raw, count, pad, size, i, footer[2];
+
+    tokens = malloc(n + n / 8 + 16);
+    // a stream the decoder overran writes garbage, at most 9 bytes per byte read, below the image
+    check = malloc(10 * n);
+    size = 0;
+    // the loader expands .code in place, a raw prefix keeps the decoder behind its input
+    for (raw = 0; raw < n; raw += (n / 16 + 3) & ~3){
+        count = blz_tokens(src, n, raw, tokens);
+        pad = (4 - (raw + count) % 4) % 4;
+        size = raw + count + pad + 8;
+        if (size >= n){
+            size = 0;
+            break;
+        }
+        memcpy(file, src, raw);
+        for (i = 0; i < count; i++) file[raw + count - 1 - i] = tokens[i];
+        memset(file + raw + count, 0xFF, pad);
+        footer[0] = (8 + pad) << 24 | (count + pad + 8);
+        footer[1] = n - size;
+        memcpy(file + size - 8, footer, 8);
+        memcpy(check + 9 * n, file, size);
+        lzss_decompress(check + 9 * n + size, NULL, NULL);
+        if (!memcmp(check + 9 * n, src, n)) break;
+        size = 0;
+    }
+    free(tokens);
+    free(check);
+    return size;
+}
+
+static int write_file(const char *dir, u64 progid, const char *ext, const void *data, u32 size){
+    char path[4096];
+    FILE *f;
+    int ok;
+
+    snprintf(path, sizeof(path), "%s/%016llx.%s", dir, (unsigned long long)progid, ext);
+    if ((f = fopen(path, "wb")) == NULL) return 0;
+    ok = fwrite(data, 1, size, f) == size;
+    return !fclose(f) && ok;
+}
+
+u32 standin_write_title(const char *dir, u64 progid, u8 category, u32 image_size, int compressed){
+    static const u32 pages = 1; // rodata and data each
+    exheader_header exheader;
+    u32 dictionary[64], word, size, i;
+    u8 *image, *file;
+
+    image_size = (image_size + 0xFFF) & ~0xFFF;
+    if (image_size < 0x3000) image_size = 0x3000;
+    image = malloc(image_size);
+    file = malloc(image_size);
+    srand(progid ^ progid >> 32);
+    for (i = 0; i < 64; i++) dictionary[i] = 0xE0000000 | (rand() & 0x0FFFFFFF);
+    // half common instructions, some with another register, the rest literals and addresses
+    for (i = 0; i < image_size; i += 4){
+        word = rand() % 100;
+        if (word < 50) word = dictionary[rand() % 64];
+        else if (word < 80) word = dictionary[rand() % 64] ^ (rand() & 0xF) << 12;
+        else word = rand();
+        memcpy(image + i, &word, 4);
+    }
+
+    memset(&exheader, 0, sizeof(exheader));
+    memcpy(exheader.codesetinfo.name, "standin", 7);
+    exheader.codesetinfo.text.address = 0x00100000;
+    exheader.codesetinfo.text.codesize = image_size - 2 * (pages << 12);
+    exheader.codesetinfo.text.nummaxpages = exheader.codesetinfo.text.codesize >> 12;
+    exheader.codesetinfo.ro.address = exheader.codesetinfo.text.address + exheader.codesetinfo.text.codesize;
+    exheader.codesetinfo.ro.codesize = pages << 12;
+    exheader.codesetinfo.ro.nummaxpages = pages;
+    exheader.codesetinfo.data.address = exheader.codesetinfo.ro.address + (pages << 12);
+    exheader.codesetinfo.data.codesize = pages << 12;
+    exheader.codesetinfo.data.nummaxpages = pages;
+    exheader.codesetinfo.bsssize = 0x1000;
+    exheader.arm11systemlocalcaps.programid = progid;
+    exheader.arm11systemlocalcaps.resourcelimitcategory = category;
+    for (i = 0; i < 28; i++) exheader.arm11kernelcaps.descriptors[i] = 0xFFFFFFFF;
+    exheader.arm11kernelcaps.descriptors[0] = 0xFF000000 | 0x200; // kernel flags, memory type BASE
+
+    size = compressed ? blz_compress(image, image_size, file) : 0;
+    if (size) exheader.codesetinfo.flags.flag = 1;
+    else size = image_size;
+    if (!write_file(dir, progid, "exheader", &exheader, 0x400) ||
+        !write_file(dir, progid, "code", exheader.codesetinfo.flags.flag ? file : image, size)) size = 0;
+    free(image);
+    free(file);
+    return size;
+}
+
+char *standin_temp_dir(void){
+    char *dir = strdup("/tmp/standinXXXXXX");
+
+    if (mkdtemp(dir) == NULL) abort();
+    return dir;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw){
+    return remove(path);
+}
+
+void standin_remove_dir(const char *dir){
+    nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
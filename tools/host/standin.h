@@ -0,0 +1,108 @@
+#pragma once
+
+// Stand-in kernel and services that run the whole loader on a Linux host,
+// for the tools that measure it end to end. A tool plays pm: it boots the
+// loader, opens Loader sessions and sends it the commands pm would.
+//
+//   cc -O2 -pthread -no-pie -Itools/host -Wno-pointer-to-int-cast -Wno-int-to-pointer-cast
+//       -Wno-incompatible-pointer-types -o tool tools/tool.c tools/host/standin.c source/[!l]*.c
+//
+// standin.c builds source/loader.c itself, the glob is every other source.
+// The loader keeps 32 bit pointers like on the device, hence -no-pie, stacks
+// in the low 2 GiB and the cast warnings turned off.
+//
+// Each boot is a forked child, so every one starts from a clean loader the
+// way a device boot does. The loader runs __appInit, main and __appExit on
+// a thread of its own and creates its workers and prefetcher through the
+// stand-in kernel, which has sessions, ports, semaphores and threads but no
+// thread priorities, the host scheduler decides. srv, fs:REG, fs:LDR and
+// PxiPM answer in the calling thread:
+//
+// - srv: comes up ready_us[STANDIN_SRV] after the boot starts, connects before
+//   that fail the way they do on the device. GetServiceHandle blocks until
+//   the service is up and then takes connect_us.
+// - fs:REG and PxiPM: hand out prog_handles for titles in the titles
+//   directory, <progid>.exheader and <progid>.code, the way tracereplay
+//   expects them. Unloads take unload_us.
+// - fs:LDR: .code from the titles directory and SD files from the sd
+//   directory ("/rei/patches/patches.dat" is sd/rei/patches/patches.dat), no
+//   card if it is NULL.
+// - storage: every exheader, file read and write goes to one simulated
+//   device. A request costs storage_latency_us and then its size at
+//   storage_mib_s, served storage_chunk bytes at a time; after each chunk the
+//   device serves the most urgent request waiting, oldest first among
+//   equals. A file read is as urgent as the fs:LDR priority was when it was
+//   sent, or always 0 with pin_priority, which is how the loader ran before
+//   it picked a priority per load.
+//
+// The defaults are stand-in values, not device measurements; the tools
+// print what they used. The host CPU decompresses and patches many times
+// faster than the ARM11, so anything that overlaps CPU work with reads is
+// understated.
+
+#include <3ds.h>
+#include "../../source/exheader.h"
+#include "../../source/stats.h"
+
+typedef enum{
+    STANDIN_SRV = 0,
+    STANDIN_FSREG,
+    STANDIN_FSLDR,
+    STANDIN_PXIPM,
+    STANDIN_SERVICE_COUNT
+} standin_service_t;
+
+typedef struct{
+    const char *titles;
+    const char *sd;
+    u32 ready_us[STANDIN_SERVICE_COUNT]; // from the start of the boot
+    u32 connect_us;
+    u32 unload_us;
+    double storage_mib_s; // 0 makes storage free
+    u32 storage_latency_us;
+    u32 storage_chunk;
+    int pin_priority;
+} standin_config_t;
+
+// what the boot did, filled in by the child
+typedef struct{
+    double registered_ms; // "Loader" registered with srv
+    u32 srv_attempts; // connects to srv: until one went through
+    u32 set_priority_calls; // FSLDR_SetPriority
+    u32 storage_requests;
+    u64 storage_bytes;
+    u32 processes; // created and not yet closed by pm when the boot ended
+    loader_stats_t stats; // the loader's own block as it was at shutdown
+} standin_report_t;
+
+void standin_defaults(standin_config_t *cfg);
+
+// boots the loader with cfg and runs pm(arg) against it, then asks the
+// loader to terminate and waits for it; returns 0 if the loader exited
+// cleanly. Memory from standin_shared is how pm hands results back.
+int standin_boot(const standin_config_t *cfg, void (*pm)(void *arg), void *arg, standin_report_t *report);
+void *standin_shared(size_t size);
+
+// milliseconds since the boot started, also valid in the parent for timing
+double standin_now_ms(void);
+
+// the pm side, for use inside pm
+Handle standin_connect(void); // waits for "Loader"; requests on a session it turned away fail with 0xC920181A
+Result standin_request(Handle session, u32 *cmdbuf, void *static_buf); // cmdbuf is at least 64 words
+Result standin_register(Handle session, u64 progid, u64 *prog_handle);
+Result standin_unregister(Handle session, u64 prog_handle);
+Result standin_get_info(Handle session, u64 prog_handle, exheader_header *exheader);
+Result standin_load(Handle session, u64 prog_handle, Handle *process);
+Result standin_load_batch(Handle session, const u64 *prog_handles, u32 count, Result *results, Handle *processes);
+Result standin_dry_run(Handle session, u64 prog_handle);
+Result standin_storage_read(u32 priority, u32 size); // FS traffic from another process
+void standin_close(Handle handle);
+
+// writes <dir>/<progid>.exheader and .code for a title whose code, rodata
+// and data add up to image_size bytes of ARM-like words, lzss compressed
+// if compressed is set; returns the .code size or 0 on failure
+u32 standin_write_title(const char *dir, u64 progid, u8 category, u32 image_size, int compressed);
+
+// a fresh directory under /tmp, removed again by standin_remove_dir
+char *standin_temp_dir(void);
+void standin_remove_dir(const char *dir);
@@ -0,0 +1,3 @@
+#pragma once
+
+// source/loader.c includes this for newlib's devoptabs and uses none of it.
@@ -0,0 +1,242 @@
+// Stress benchmark for the multi-session Loader: throughput and tail
+// latency with 1 to 4 pm clients loading at once, see tools/host/standin.h.
+//
+//   cc -O2 -pthread -no-pie -Itools/host -Wno-pointer-to-int-cast -Wno-int-to-pointer-cast
+//       -Wno-incompatible-pointer-types -o loadstress tools/loadstress.c tools/host/standin.c source/[!l]*.c
+//   loadstress [-n loads per client] [-s title KiB] [-b storage MiB/s]
+//
+// Every client has a Loader session of its own and loops over its own
+// compressed titles: RegisterProgram, GetProgramInfo, LoadProcess, closing
+// the process, UnregisterProgram. Each configuration is a fresh boot. The
+// last ones add a client that only sends GetProgramInfo while the others
+// load, which is what the worker pool is there for: its latency should stay
+// near the idle figure instead of growing with the loads in front of it.
+//
+// Prints loads per second over the whole run and the median, 99th
+// percentile and worst latency of each command as pm sees it. Exits 1 if a
+// command failed or the loader did not shut down cleanly.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "host/standin.h"
+
+#define MAX_CLIENTS 4
+#define MAX_LOADS 1024
+#define TITLES_PER_CLIENT 4
+#define APP_PROGID 0x0004000000100000ULL
+
+typedef enum{
+    OP_REGISTER,
+    OP_GET_INFO,
+    OP_LOAD,
+    OP_UNREGISTER,
+    OP_COUNT
+} op_t;
+
+static const char *op_names[OP_COUNT] = {"RegisterProgram", "GetProgramInfo", "LoadProcess", "UnregisterProgram"};
+
+// written by the boot's child, read back by the parent
+typedef struct{
+    double samples[OP_COUNT][MAX_CLIENTS * MAX_LOADS];
+    u32 counts[OP_COUNT];
+    double query_samples[MAX_LOADS * 64];
+    u32 query_count;
+    double seconds;
+    u32 loads;
+    u32 failures;
+} results_t;
+
+typedef struct{
+    results_t *results;
+    u32 client;
+    u32 loaders; // clients that load
+    u32 loads;
+    volatile int *done;
+} client_t;
+
+static results_t *g_results;
+static u32 g_clients, g_loads, g_querier;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void record(op_t op, double start){
+    double ms = standin_now_ms() - start;
+
+    pthread_mutex_lock(&g_lock);
+    g_results->samples[op][g_results->counts[op]++] = ms;
+    pthread_mutex_unlock(&g_lock);
+}
+
+static void failed(void){
+    pthread_mutex_lock(&g_lock);
+    g_results->failures++;
+    pthread_mutex_unlock(&g_lock);
+}
+
+static void *loader_client(void *arg){
+    client_t *client = arg;
+    exheader_header exheader;
+    Handle session, process;
+    u64 prog_handle, progid;
+    double start;
+    u32 i;
+
+    session = standin_connect();
+    for (i = 0; i < client->loads; i++){
+        progid = APP_PROGID | (u64)(client->client * TITLES_PER_CLIENT + i % TITLES_PER_CLIENT) << 8;
+        start = standin_now_ms();
+        if (R_FAILED(standin_register(session, progid, &prog_handle))){
+            failed();
+            continue;
+        }
+        record(OP_REGISTER, start);
+        start = standin_now_ms();
+        if (R_FAILED(standin_get_info(session, prog_handle, &exheader))) failed();
+        else record(OP_GET_INFO, start);
+        start = standin_now_ms();
+        if (R_FAILED(standin_load(session, prog_handle, &process))) failed();
+        else{
+            record(OP_LOAD, start);
+            standin_close(process);
+            pthread_mutex_lock(&g_lock);
+            g_results->loads++;
+            pthread_mutex_unlock(&g_lock);
+        }
+        start = standin_now_ms();
+        if (R_FAILED(standin_unregister(session, prog_handle))) failed();
+        else record(OP_UNREGISTER, start);
+    }
+    standin_close(session);
+    return NULL;
+}
+
+// GetProgramInfo for a title it keeps registered, back to back until the loads are over
+static void *query_client(void *arg){
+    client_t *client = arg;
+    exheader_header exheader;
+    Handle session;
+    u64 prog_handle;
+    double start, ms;
+
+    session = standin_connect();
+    if (R_FAILED(standin_register(session, APP_PROGID | 0xFF00, &prog_handle))){
+        failed();
+        return NULL;
+    }
+    while (!*client->done && g_results->query_count < sizeof(g_results->query_samples) / sizeof(double)){
+        start = standin_now_ms();
+        if (R_FAILED(standin_get_info(session, prog_handle, &exheader))){
+            failed();
+            break;
+        }
+        ms = standin_now_ms() - start;
+        g_results->query_samples[g_results->query_count++] = ms;
+        usleep(500);
+    }
+    standin_unregister(session, prog_handle);
+    standin_close(session);
+    return NULL;
+}
+
+static void pm(void *arg){
+    pthread_t threads[MAX_CLIENTS + 1];
+    client_t clients[MAX_CLIENTS + 1];
+    volatile int done = 0;
+    double start;
+    u32 i;
+
+    start = standin_now_ms();
+    for (i = 0; i < g_clients + g_querier; i++){
+        clients[i].results = g_results;
+        clients[i].client = i;
+        clients[i].loaders = g_clients;
+        clients[i].loads = g_loads;
+        clients[i].done = &done;
+        pthread_create(&threads[i], NULL, i < g_clients ? loader_client : query_client, &clients[i]);
+    }
+    for (i = 0; i < g_clients; i++) pthread_join(threads[i], NULL);
+    if (g_clients == 0) usleep(200000);
+    g_results->seconds = (standin_now_ms() - start) / 1000;
+    done = 1;
+    if (g_querier) pthread_join(threads[g_clients], NULL);
+}
+
+static int compare(const void *a, const void *b){
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void print_latency(const char *name, double *samples, u32 count){
+    if (count == 0) return;
+    qsort(samples, count, sizeof(double), compare);
+    printf("    %-18s %6u %9.2f %9.2f %9.2f\n", name, count, samples[count / 2], samples[(count * 99) / 100],
+        samples[count - 1]);
+}
+
+static int run(const standin_config_t *cfg, u32 clients, int querier){
+    standin_report_t report;
+    u32 op;
+    int ok;
+
+    memset(g_results, 0, sizeof(results_t));
+    g_clients = clients;
+    g_querier = querier;
+    ok = !standin_boot(cfg, pm, NULL, &report) && g_results->failures == 0;
+    if (clients) printf("%u client%s%s: %6.1f loads/s over %u loads, %u deferred unregisters%s\n", clients,
+        clients > 1 ? "s" : "", querier ? " + GetProgramInfo" : "", g_results->loads / g_results->seconds, g_results->loads,
+        report.stats.unregisters_deferred, ok ? "" : "  FAILED");
+    else printf("GetProgramInfo alone%s\n", ok ? "" : "  FAILED");
+    printf("    %-18s %6s %9s %9s %9s\n", "ms", "count", "p50", "p99", "max");
+    for (op = 0; op < OP_COUNT; op++) print_latency(op_names[op], g_results->samples[op], g_results->counts[op]);
+    if (querier) print_latency("GetProgramInfo*", g_results->query_samples, g_results->query_count);
+    return ok;
+}
+
+int main(int argc, char **argv){
+    standin_config_t cfg;
+    char *dir;
+    u32 size = 512, i, clients;
+    int opt, ok = 1;
+
+    standin_defaults(&cfg);
+    g_loads = 32;
+    while ((opt = getopt(argc, argv, "n:s:b:")) != -1){
+        switch (opt){
+            case 'n': g_loads = strtoul(optarg, NULL, 0); break;
+            case 's': size = strtoul(optarg, NULL, 0); break;
+            case 'b': cfg.storage_mib_s = strtod(optarg, NULL); break;
+            default:
+                fprintf(stderr, "usage: %s [-n loads per client] [-s title KiB] [-b storage MiB/s]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (g_loads == 0 || g_loads > MAX_LOADS || size == 0){
+        fprintf(stderr, "%s: -n must be 1 to %u, -s at least 1\n", argv[0], MAX_LOADS);
+        return 2;
+    }
+
+    dir = standin_temp_dir();
+    cfg.titles = dir;
+    for (i = 0; i < MAX_CLIENTS * TITLES_PER_CLIENT; i++){
+        if (!standin_write_title(dir, APP_PROGID | (u64)i << 8, 0, size << 10, 1)) ok = 0;
+    }
+    if (!standin_write_title(dir, APP_PROGID | 0xFF00, 0, 0x3000, 1)) ok = 0;
+    if (!ok){
+        fprintf(stderr, "%s: could not write titles to %s\n", argv[0], dir);
+        standin_remove_dir(dir);
+        return 1;
+    }
+    g_results = standin_shared(sizeof(results_t));
+
+    printf("%u KiB compressed titles, %u loads per client, ", size, g_loads);
+    if (cfg.storage_mib_s > 0) printf("storage %.1f MiB/s + %u us per request\n", cfg.storage_mib_s, cfg.storage_latency_us);
+    else printf("storage free\n");
+    ok &= run(&cfg, 0, 1);
+    for (clients = 1; clients <= MAX_CLIENTS; clients++) ok &= run(&cfg, clients, 0);
+    // the loader takes MAX_SESSIONS sessions, the querier needs one of them
+    for (clients = 1; clients < MAX_CLIENTS; clients++) ok &= run(&cfg, clients, 1);
+    standin_remove_dir(dir);
+    return !ok;
+}
@@ -0,0 +1,307 @@
+// Host unit test for the exheader rewriting in source/overrides.c.
+//
+//   cc -O2 -Itools/host -o overridetest tools/overridetest.c
+//   overridetest
+//
+// Feeds override_patch_exheader known arm11systemlocalcaps.flags bytes and
+// kernel capability descriptors and checks every byte it writes, that the
+// bits around the overridden fields survive and that rejected overrides
+// leave the exheader exactly as it was. The last cases go through
+// overrides_apply with an in-memory overrides.dat, including titles with no
+// entry in it. Prints each failed check and exits 1 if there were any.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <3ds.h>
+#include "../source/stats.h"
+#include "../source/overrides.h"
+#define feof ifile_feof // ifile.h declares its own
+#include "../source/ifile.h"
+#undef feof
+
+static loader_stats_t stats;
+loader_stats_t *const g_stats = &stats;
+
+void statsRegisterFootprint(stats_module_id_t id, u32 size){}
+
+// overrides.dat as IFile_Read hands it out
+static u8 file_data[0x1000];
+static u32 file_size;
+static int file_present;
+
+Result IFile_Open(IFile *file, FS_ArchiveID archiveId, FS_Path archivePath, FS_Path filePath, u32 flags){
+    if (!file_present || strcmp(filePath.data, OVERRIDES_PATH)) return -1;
+    file->pos = 0;
+    file->size = file_size;
+    return 0;
+}
+
+Result IFile_Close(IFile *file){
+    return 0;
+}
+
+Result IFile_Read(IFile *file, u64 *total, void *buffer, u32 len){
+    if (len > file->size - file->pos) len = file->size - file->pos;
+    memcpy(buffer, file_data + file->pos, len);
+    file->pos += len;
+    *total = len;
+    return 0;
+}
+
+#include "../source/overrides.c"
+
+#define PROGID 0x0004000000055D00LL
+#define OTHER_PROGID 0x0004000000030800LL
+
+// a typical application: 268 MHz without L2, legacy New 3DS layout, prod
+// on Old 3DS with core 0 ideal and both cores allowed
+#define FLAGS_CPU 0x00
+#define FLAGS_N3DS 0x00
+#define FLAGS_O3DS 0x03
+#define DESC_MAPPING 0xFC00022C
+#define DESC_HANDLES 0xFE000200
+#define DESC_FLAGS 0xFF0001A0 // memory type 1, application
+
+static int checks;
+static int failures;
+
+#define CHECK(cond, ...) do{ \
+    checks++; \
+    if (!(cond)){ \
+        failures++; \
+        printf("%s:%d: ", __FILE__, __LINE__); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+    } \
+} while (0)
+
+static void make_exheader(exheader_header *exheader, u8 cpu, u8 n3ds, u8 o3ds, int with_flags_desc){
+    int i;
+
+    memset(exheader, 0, sizeof(*exheader));
+    exheader->arm11systemlocalcaps.programid = PROGID;
+    exheader->arm11systemlocalcaps.flags[FLAGS_N3DS_CPU] = cpu;
+    exheader->arm11systemlocalcaps.flags[FLAGS_N3DS_MODE] = n3ds;
+    exheader->arm11systemlocalcaps.flags[FLAGS_O3DS_MODE] = o3ds;
+    exheader->arm11systemlocalcaps.resourcelimitdescriptor[0] = 30;
+    for (i = 0; i < 28; i++) exheader->arm11kernelcaps.descriptors[i] = 0xFFFFFFFF; // unused
+    exheader->arm11kernelcaps.descriptors[0] = DESC_MAPPING;
+    exheader->arm11kernelcaps.descriptors[1] = DESC_HANDLES;
+    if (with_flags_desc) exheader->arm11kernelcaps.descriptors[2] = DESC_FLAGS;
+    // pm checks the process against the signed copy, overrides must leave it alone
+    exheader->accessdesc.arm11systemlocalcaps = exheader->arm11systemlocalcaps;
+    exheader->accessdesc.arm11kernelcaps = exheader->arm11kernelcaps;
+}
+
+static void set(override_t *ovr, u32 key, u16 value){
+    ovr->present |= 1 << key;
+    ovr->values[key] = value;
+}
+
+static u8 flag(const exheader_header *exheader, int i){
+    return exheader->arm11systemlocalcaps.flags[i];
+}
+
+// the bytes outside arm11systemlocalcaps.flags and the kernel descriptors
+static int same_elsewhere(const exheader_header *a, const exheader_header *b){
+    exheader_header x = *a, y = *b;
+
+    memset(x.arm11systemlocalcaps.flags, 0, sizeof(x.arm11systemlocalcaps.flags));
+    memset(y.arm11systemlocalcaps.flags, 0, sizeof(y.arm11systemlocalcaps.flags));
+    memset(x.arm11kernelcaps.descriptors, 0, sizeof(x.arm11kernelcaps.descriptors));
+    memset(y.arm11kernelcaps.descriptors, 0, sizeof(y.arm11kernelcaps.descriptors));
+    return memcmp(&x, &y, sizeof(x)) == 0;
+}
+
+static void test_clock_and_l2(void){
+    static const struct{
+        u8 before;
+        int l2, mhz; // -1 leaves it alone
+        u8 after;
+    } cases[] = {
+        {0x00, 1, -1, 0x01},
+        {0x00, -1, 1, 0x02},
+        {0x00, 1, 1, 0x03},
+        {0x03, 0, -1, 0x02},
+        {0x03, -1, 0, 0x01},
+        {0x03, 0, 0, 0x00},
+        {0xF0, 1, 1, 0xF3}, // reserved bits kept
+        {0xF3, 0, 0, 0xF0},
+        {0x02, 1, -1, 0x03},
+    };
+    exheader_header exheader, before;
+    override_t ovr;
+    u32 i;
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++){
+        make_exheader(&exheader, cases[i].before, FLAGS_N3DS, FLAGS_O3DS, 1);
+        before = exheader;
+        memset(&ovr, 0, sizeof(ovr));
+        if (cases[i].l2 >= 0) set(&ovr, OVERRIDE_L2_CACHE, cases[i].l2);
+        if (cases[i].mhz >= 0) set(&ovr, OVERRIDE_CPU_804MHZ, cases[i].mhz);
+        CHECK(override_patch_exheader(&exheader, &ovr) == 1, "clock case %u rejected", i);
+        CHECK(flag(&exheader, FLAGS_N3DS_CPU) == cases[i].after, "clock case %u: flags[4] %02x -> %02x, expected %02x", i,
+            cases[i].before, flag(&exheader, FLAGS_N3DS_CPU), cases[i].after);
+        CHECK(flag(&exheader, FLAGS_N3DS_MODE) == FLAGS_N3DS && flag(&exheader, FLAGS_O3DS_MODE) == FLAGS_O3DS,
+            "clock case %u changed the memory modes", i);
+        CHECK(same_elsewhere(&exheader, &before), "clock case %u changed other fields", i);
+    }
+}
+
+static void test_memory_modes(void){
+    exheader_header exheader, before;
+    override_t ovr;
+    u32 mode;
+
+    // New 3DS layout is the low nibble of flags[5], the high one is kept
+    for (mode = 0; mode <= 3; mode++){
+        make_exheader(&exheader, FLAGS_CPU, 0xA5, FLAGS_O3DS, 1);
+        memset(&ovr, 0, sizeof(ovr));
+        set(&ovr, OVERRIDE_N3DS_MODE, mode);
+        CHECK(override_patch_exheader(&exheader, &ovr) == 1, "n3ds mode %u rejected", mode);
+        CHECK(flag(&exheader, FLAGS_N3DS_MODE) == (0xA0 | mode), "n3ds mode %u: flags[5] %02x", mode, flag(&exheader, FLAGS_N3DS_MODE));
+    }
+
+    // Old 3DS layout is the high nibble of flags[6], ideal processor and affinity below it stay
+    for (mode = 0; mode <= 5; mode++){
+        make_exheader(&exheader, FLAGS_CPU, FLAGS_N3DS, 0x2B, 1);
+        before = exheader;
+        memset(&ovr, 0, sizeof(ovr));
+        set(&ovr, OVERRIDE_O3DS_MODE, mode);
+        if (mode == 1){
+            CHECK(override_patch_exheader(&exheader, &ovr) == 0, "o3ds mode 1 does not exist but was accepted");
+            CHECK(memcmp(&exheader, &before, sizeof(exheader)) == 0, "rejected o3ds mode changed the exheader");
+            continue;
+        }
+        CHECK(override_patch_exheader(&exheader, &ovr) == 1, "o3ds mode %u rejected", mode);
+        CHECK(flag(&exheader, FLAGS_O3DS_MODE) == (mode << 4 | 0x0B), "o3ds mode %u: flags[6] %02x", mode, flag(&exheader, FLAGS_O3DS_MODE));
+    }
+
+    // out of range values are refused whole, even next to good ones
+    make_exheader(&exheader, FLAGS_CPU, FLAGS_N3DS, FLAGS_O3DS, 1);
+    before = exheader;
+    memset(&ovr, 0, sizeof(ovr));
+    set(&ovr, OVERRIDE_L2_CACHE, 1);
+    set(&ovr, OVERRIDE_N3DS_MODE, 4);
+    CHECK(override_patch_exheader(&exheader, &ovr) == 0, "n3ds mode 4 accepted");
+    CHECK(memcmp(&exheader, &before, sizeof(exheader)) == 0, "rejected override changed the exheader");
+}
+
+static void test_kernel_descriptors(void){
+    exheader_header exheader, before;
+    override_t ovr;
+
+    // memory type is bits 8-11 of the kernel flags descriptor
+    make_exheader(&exheader, FLAGS_CPU, FLAGS_N3DS, FLAGS_O3DS, 1);
+    memset(&ovr, 0, sizeof(ovr));
+    set(&ovr, OVERRIDE_MEMORY_TYPE, 3);
+    CHECK(override_patch_exheader(&exheader, &ovr) == 1, "memory type 3 rejected");
+    CHECK(exheader.arm11kernelcaps.descriptors[2] == 0xFF0003A0, "kernel flags %08x", exheader.arm11kernelcaps.descriptors[2]);
+    CHECK(exheader.arm11kernelcaps.descriptors[0] == DESC_MAPPING && exheader.arm11kernelcaps.descriptors[1] == DESC_HANDLES,
+        "memory type touched other descriptors");
+    CHECK(exheader.accessdesc.arm11kernelcaps.descriptors[2] == DESC_FLAGS, "memory type touched the access descriptor");
+
+    // without a kernel flags descriptor there is nothing to rewrite
+    make_exheader(&exheader, FLAGS_CPU, FLAGS_N3DS, FLAGS_O3DS, 0);
+    before = exheader;
+    memset(&ovr, 0, sizeof(ovr));
+    set(&ovr, OVERRIDE_L2_CACHE, 1);
+    set(&ovr, OVERRIDE_MEMORY_TYPE, 2);
+    CHECK(override_patch_exheader(&exheader, &ovr) == 0, "memory type accepted without a kernel flags descriptor");
+    CHECK(memcmp(&exheader, &before, sizeof(exheader)) == 0, "rejected memory type changed the exheader");
+
+    make_exheader(&exheader, FLAGS_CPU, FLAGS_N3DS, FLAGS_O3DS, 1);
+    memset(&ovr, 0, sizeof(ovr));
+    set(&ovr, OVERRIDE_HANDLE_TABLE, 0x100);
+    CHECK(override_patch_exheader(&exheader, &ovr) == 1, "handle table 0x100 rejected");
+    CHECK(exheader.arm11kernelcaps.descriptors[1] == 0xFE000100, "handle table %08x", exheader.arm11kernelcaps.descriptors[1]);
+
+    make_exheader(&exheader, FLAGS_CPU, FLAGS_N3DS, FLAGS_O3DS, 1);
+    memset(&ovr, 0, sizeof(ovr));
+    set(&ovr, OVERRIDE_MEMORY_TYPE, 0);
+    CHECK(override_patch_exheader(&exheader, &ovr) == 0, "memory type 0 accepted");
+}
+
+static void test_resource_limits(void){
+    exheader_header exheader, before;
+    override_t ovr;
+
+    make_exheader(&exheader, FLAGS_CPU, FLAGS_N3DS, FLAGS_O3DS, 1);
+    memset(&ovr, 0, sizeof(ovr));
+    set(&ovr, OVERRIDE_CPU_TIME, 80);
+    CHECK(override_patch_exheader(&exheader, &ovr) == 1, "cpu time 80 rejected");
+    CHECK(exheader.arm11systemlocalcaps.resourcelimitdescriptor[0] == 80, "cpu time %u", exheader.arm11systemlocalcaps.resourcelimitdescriptor[0]);
+
+    // only applications have a core time limit
+    make_exheader(&exheader, FLAGS_CPU, FLAGS_N3DS, FLAGS_O3DS, 1);
+    before = exheader;
+    memset(&ovr, 0, sizeof(ovr));
+    set(&ovr, OVERRIDE_CPU_TIME, 80);
+    set(&ovr, OVERRIDE_RESLIMIT_CATEGORY, 1);
+    CHECK(override_patch_exheader(&exheader, &ovr) == 0, "cpu time accepted for a system applet");
+    CHECK(memcmp(&exheader, &before, sizeof(exheader)) == 0, "rejected cpu time changed the exheader");
+}
+
+static void write_file(const overrides_file_entry_t *entries, u16 count){
+    overrides_file_header_t header;
+
+    header.magic = OVERRIDES_MAGIC;
+    header.version = OVERRIDES_VERSION;
+    header.count = count;
+    memcpy(file_data, &header, sizeof(header));
+    memcpy(file_data + sizeof(header), entries, count * sizeof(entries[0]));
+    file_size = sizeof(header) + count * sizeof(entries[0]);
+    file_present = 1;
+}
+
+static void test_apply(void){
+    static const overrides_file_entry_t entries[] = {
+        {PROGID, OVERRIDE_L2_CACHE, 0, 1},
+        {PROGID, OVERRIDE_CPU_804MHZ, 0, 1},
+        {PROGID, OVERRIDE_N3DS_MODE, 0, 2},
+        {PROGID, OVERRIDE_KEY_COUNT, 0, 1}, // from a newer build, skipped
+        {PROGID + 0x100, OVERRIDE_O3DS_MODE, 0, 1}, // invalid, skipped
+    };
+    exheader_header exheader, before;
+
+    overridesInit();
+    write_file(entries, sizeof(entries) / sizeof(entries[0]));
+
+    make_exheader(&exheader, FLAGS_CPU, FLAGS_N3DS, FLAGS_O3DS, 1);
+    overrides_apply(&exheader);
+    CHECK(flag(&exheader, FLAGS_N3DS_CPU) == 0x03 && flag(&exheader, FLAGS_N3DS_MODE) == 0x02 && flag(&exheader, FLAGS_O3DS_MODE) == FLAGS_O3DS,
+        "applied flags %02x %02x %02x", flag(&exheader, FLAGS_N3DS_CPU), flag(&exheader, FLAGS_N3DS_MODE), flag(&exheader, FLAGS_O3DS_MODE));
+    CHECK(stats.overrides_applied == 1 && stats.overrides_rejected == 0, "applied %u rejected %u after a listed title",
+        stats.overrides_applied, stats.overrides_rejected);
+
+    // titles with no entry, including the one whose only entry was invalid, come out as they went in
+    make_exheader(&exheader, 0xF3, 0xA5, 0x2B, 1);
+    exheader.arm11systemlocalcaps.programid = OTHER_PROGID;
+    before = exheader;
+    overrides_apply(&exheader);
+    CHECK(memcmp(&exheader, &before, sizeof(exheader)) == 0, "title without an entry was changed");
+    make_exheader(&exheader, FLAGS_CPU, FLAGS_N3DS, FLAGS_O3DS, 1);
+    exheader.arm11systemlocalcaps.programid = PROGID + 0x100;
+    before = exheader;
+    overrides_apply(&exheader);
+    CHECK(memcmp(&exheader, &before, sizeof(exheader)) == 0, "title with only an invalid entry was changed");
+    CHECK(stats.overrides_applied == 1 && stats.overrides_rejected == 0, "applied %u rejected %u after unlisted titles",
+        stats.overrides_applied, stats.overrides_rejected);
+
+    // the file is read once, removing it later changes nothing
+    file_present = 0;
+    make_exheader(&exheader, FLAGS_CPU, FLAGS_N3DS, FLAGS_O3DS, 1);
+    overrides_apply(&exheader);
+    CHECK(flag(&exheader, FLAGS_N3DS_CPU) == 0x03, "overrides lost after the first load");
+}
+
+int main(void){
+    test_clock_and_l2();
+    test_memory_modes();
+    test_kernel_descriptors();
+    test_resource_limits();
+    test_apply();
+    printf("%d checks, %d failed\n", checks, failures);
+    return failures != 0;
+}
@@ -0,0 +1,416 @@
+// Checks that every search engine in source/patcher.c stays linear in the
+// image size on inputs built to make it compare as much as possible.
+//
+//   cc -O2 -Itools/host -o patchbound tools/patchbound.c
+//   patchbound [-v] [-e cases]
+//
+// Each case is an image and a pattern built to nearly match everywhere,
+// such as 00..0100 over zero padding or a run of NOPs over a NOP filled
+// image. boyer_moore (patch_code), horspool and kmp (the fused scan) search
+// the unaligned cases and aligned_search the aligned ones. Every case runs
+// with a 16 byte pattern and with the longest one a record can have, and
+// the time per byte of the two is compared: a linear search takes about
+// the same, one that compares the whole pattern at every position takes
+// up to 16 times longer with the long one. Any engine over GROWTH_LIMIT,
+// or disagreeing with boyer_moore on where the first match is, fails the
+// run with exit code 1. It then times an absent 8 byte ARM instruction
+// pair over 4 MiB of random words, aligned_search against the bytewise
+// searches the same record would get without an align flag.
+//
+// -e runs that many random titles (default 200000) through patch_code and
+// through the fused path instead, patch_prepare, patch_scan over chunks of
+// a random size top down and patch_apply, and fails on the first image the
+// two patch differently. A title is 1 to 4 patches copied from a synthetic
+// image of instruction-like words with a stray byte now and then, so some
+// match aligned, some only unaligned and some not at all, with random
+// alignments, bitmasks, offsets, counts and anchors. Every aligned pattern
+// is also checked against a plain compare at every aligned offset.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LOADER_FUSED_PATCH
+
+#include <3ds.h>
+#include "../source/stats.h"
+#include "../source/patchdb.h"
+
+#define IMAGE_SIZE (4 << 20)
+#define MAX_PATLEN 255 // patch records keep the length in a byte
+#define SHORT_PATLEN 16
+#define RUNS 3 // best of
+#define GROWTH_LIMIT 4.0 // masked patterns may still grow by PATCH_MAX_MASKED_LEN / SHORT_PATLEN
+
+static loader_stats_t stats;
+loader_stats_t *const g_stats = &stats;
+
+void statsRegisterFootprint(stats_module_id_t id, u32 size){}
+
+#define MAX_TITLE_PATCHES 4
+#define MAX_EQUIV_IMAGE 0x10000
+#define EQUIV_PROGID 0x0004000000100000ULL
+
+// the bound cases call the engines directly, -e serves the current title's patches from here
+static patch_t title_patches[MAX_TITLE_PATCHES];
+static int num_title_patches;
+
+patchdb_t *patchdb_acquire(void){ return NULL; }
+void patchdb_release(patchdb_t *db){}
+void patchdb_get(patchdb_t *db, u16 record, patch_t *patch){ *patch = title_patches[record]; }
+
+int patchdb_lookup(patchdb_t *db, u64 progid, u16 *records, int max){
+    int i;
+
+    for (i = 0; i < num_title_patches && i < max; i++) records[i] = i;
+    return i;
+}
+
+#include "../source/arena.c"
+#include "../source/patcher.c"
+
+typedef enum{
+    ENGINE_BOYER_MOORE,
+    ENGINE_HORSPOOL,
+    ENGINE_KMP,
+    ENGINE_ALIGNED,
+} engine_t;
+
+static const char *engine_names[] = {"boyer_moore", "horspool", "kmp", "aligned_search"};
+
+typedef struct{
+    const char *name;
+    u32 align; // 1 runs the three unaligned engines
+    int masked;
+    u32 max_patlen;
+} bound_case_t;
+
+static u8 image[IMAGE_SIZE];
+static u8 pattern[MAX_PATLEN];
+static u8 bitmask[MAX_PATLEN];
+static u32 patlen;
+static int verbose;
+
+static double now_ns(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void fill_words(u32 word, u32 align){
+    u32 i;
+
+    for (i = 0; i < IMAGE_SIZE; i += align) memcpy(image + i, &word, align);
+}
+
+static void fill_random(u32 alphabet){
+    u32 i;
+
+    for (i = 0; i < IMAGE_SIZE; i++) image[i] = rand() % alphabet;
+}
+
+// sets up image, pattern and bitmask for case n with a short or the
+// longest possible pattern, returns 0 past the last one
+static int make_case(int n, int longest, bound_case_t *c){
+    u32 i, word;
+
+    c->align = 1;
+    c->masked = 0;
+    c->max_patlen = (n == 7 || n == 8) ? PATCH_MAX_MASKED_LEN : MAX_PATLEN;
+    patlen = longest ? c->max_patlen : SHORT_PATLEN;
+    memset(pattern, 0, sizeof(pattern));
+    srand(n);
+    switch (n){
+    case 0:
+        c->name = "00..0100 over zeros";
+        memset(image, 0, IMAGE_SIZE);
+        pattern[patlen - 2] = 1;
+        return 1;
+    case 1:
+        c->name = "0100..00 over zeros";
+        memset(image, 0, IMAGE_SIZE);
+        pattern[0] = 1;
+        return 1;
+    case 2:
+        c->name = "00..0001 over zeros";
+        memset(image, 0, IMAGE_SIZE);
+        pattern[patlen - 1] = 1;
+        return 1;
+    case 3:
+        c->name = "(ab)..c over abab";
+        fill_words('a' | 'b' << 8, 2);
+        for (i = 0; i < patlen - 1; i++) pattern[i] = (i & 1) ? 'b' : 'a';
+        pattern[patlen - 1] = 'c';
+        return 1;
+    case 4:
+        c->name = "2 then random over two letters";
+        fill_random(2);
+        for (i = 1; i < patlen; i++) pattern[i] = rand() % 2;
+        pattern[0] = 2; // nothing matches, so every engine reads the whole image
+        return 1;
+    case 5:
+        c->name = "NOP..BX LR over NOPs";
+        c->align = 4;
+        patlen &= ~3;
+        fill_words(0xE1A00000, 4);
+        for (i = 0; i < patlen; i += 4){
+            word = (i == patlen - 4) ? 0xE12FFF1E : 0xE1A00000;
+            memcpy(pattern + i, &word, 4);
+        }
+        return 1;
+    case 6:
+        c->name = "Thumb NOP..BX LR over NOPs";
+        c->align = 2;
+        patlen &= ~1;
+        fill_words(0x46C0, 2);
+        for (i = 0; i < patlen; i += 2){
+            word = (i == patlen - 2) ? 0x4770 : 0x46C0;
+            memcpy(pattern + i, &word, 2);
+        }
+        return 1;
+    case 7:
+        c->name = "masked NOP..BX LR over NOPs";
+        c->align = 4;
+        c->masked = 1;
+        fill_words(0xE1A00000, 4);
+        for (i = 0; i < patlen; i += 4){
+            word = (i == patlen - 4) ? 0xE12FFF1E : 0xE1A00000;
+            memcpy(pattern + i, &word, 4);
+            word = 0xFFFFF0FF;
+            memcpy(bitmask + i, &word, 4);
+        }
+        return 1;
+    case 8:
+        c->name = "masked, only the last word compared";
+        c->align = 4;
+        c->masked = 1;
+        fill_words(0xE1A00000, 4);
+        memset(bitmask, 0, patlen);
+        word = 0xE12FFF1E;
+        memcpy(pattern + patlen - 4, &word, 4);
+        memset(bitmask + patlen - 4, 0xFF, 4);
+        return 1;
+    }
+    return 0;
+}
+
+static u8 *search(engine_t engine, u32 align, int masked){
+    int delta1[ALPHABET_LEN];
+    int delta2[MAX_PATLEN];
+    u8 skip[ALPHABET_LEN];
+    u8 *end = image + IMAGE_SIZE;
+
+    switch (engine){
+    case ENGINE_BOYER_MOORE:
+        make_delta1(delta1, pattern, patlen);
+        make_delta2(delta2, pattern, patlen);
+        return boyer_moore(image, IMAGE_SIZE, pattern, patlen, delta1, delta2);
+    case ENGINE_HORSPOOL:
+        make_skip(skip, pattern, patlen);
+        return horspool(image, end, pattern, patlen, skip);
+    case ENGINE_KMP:
+        return kmp(image, end, pattern, patlen);
+    case ENGINE_ALIGNED:
+        break;
+    }
+    return aligned_search(image, image, end, pattern, masked ? bitmask : NULL, patlen, align);
+}
+
+// best of RUNS, in ns per image byte
+static double time_search(engine_t engine, u32 align, int masked, u8 **found){
+    double best = 0, start, t;
+    int i;
+
+    for (i = 0; i < RUNS; i++){
+        start = now_ns();
+        *found = search(engine, align, masked);
+        t = now_ns() - start;
+        if (i == 0 || t < best) best = t;
+    }
+    return best / IMAGE_SIZE;
+}
+
+// aligned_search's answer the slow way, the first aligned offset where every masked unit is equal
+static u8 *plain_aligned(u8 *p, u8 *end, const u8 *pat, const u8 *mask, u32 len, u32 align){
+    u32 i;
+
+    for (p = image + ((p - image + align - 1) & ~(align - 1)); end - p >= (int)len; p += align){
+        for (i = 0; i < len && !((p[i] ^ pat[i]) & (mask ? mask[i] : 0xFF)); i++);
+        if (i == len) return p;
+    }
+    return NULL;
+}
+
+static u32 rand_word(const u32 *dictionary){
+    u32 r = rand() % 10;
+
+    if (r < 5) return dictionary[rand() % 16];
+    if (r < 8) return dictionary[rand() % 16] ^ (rand() & 0xF) << 12; // another register
+    return rand() ^ rand() << 16;
+}
+
+// instruction-like words, with a stray byte now and then to put some on odd offsets
+static u32 make_title(void){
+    u32 dictionary[16], size, word, i;
+
+    for (i = 0; i < 16; i++) dictionary[i] = 0xE0000000 | (rand() & 0x0FFFFFFF);
+    size = 0x100 + rand() % (MAX_EQUIV_IMAGE - 0x100);
+    for (i = 0; i < size; ){
+        if (rand() % 64 == 0){
+            image[i++] = rand();
+            continue;
+        }
+        word = rand_word(dictionary);
+        memcpy(image + i, &word, size - i < 4 ? size - i : 4);
+        i += 4;
+    }
+    return size;
+}
+
+static u8 title_bytes[MAX_TITLE_PATCHES][3][32]; // pattern, bitmask and replacement of each patch
+
+static void make_patches(u32 size){
+    patch_t *patch;
+    u32 aligns[3] = {1, 2, 4};
+    u32 i, from;
+    int n;
+
+    num_title_patches = 1 + rand() % MAX_TITLE_PATCHES;
+    for (n = 0; n < num_title_patches; n++){
+        patch = &title_patches[n];
+        patch->align = aligns[rand() % 3];
+        patch->patlen = patch->align * (1 + rand() % (24 / patch->align));
+        from = rand() % (size - patch->patlen); // often unaligned, so often absent where aligned
+        if (rand() % 8 == 0) for (i = 0; i < patch->patlen; i++) title_bytes[n][0][i] = rand();
+        else memcpy(title_bytes[n][0], image + from, patch->patlen);
+        patch->pattern = title_bytes[n][0];
+        patch->bitmask = NULL;
+        if (patch->align > 1 && rand() % 2){
+            for (i = 0; i < patch->patlen; i++) title_bytes[n][1][i] = (rand() % 3) ? 0xFF : rand();
+            patch->bitmask = title_bytes[n][1];
+        }
+        patch->replen = rand() % 9; // 0 only marks a place for anchors
+        for (i = 0; i < patch->replen; i++) title_bytes[n][2][i] = rand();
+        patch->replace = title_bytes[n][2];
+        patch->offset = rand() % 65 - 32;
+        patch->count = 1 + rand() % 4;
+        patch->anchor = (n > 0 && rand() % 4 == 0) ? rand() % n : PATCH_NO_ANCHOR;
+        patch->window = rand() % size;
+    }
+}
+
+static int equivalence(u32 cases){
+    static u8 direct[MAX_EQUIV_IMAGE], fused[MAX_EQUIV_IMAGE];
+    static u8 memory[ARENA_SCRATCH_SIZE];
+    static patch_set_t set;
+    arena_t scratch;
+    patch_t *patch;
+    u32 n, size, chunk, top, lo;
+    u8 *found;
+    int i;
+
+    arena_init(&scratch, memory, ARENA_SCRATCH_SIZE);
+    srand(1);
+    for (n = 0; n < cases; n++){
+        size = make_title();
+        make_patches(size);
+        for (i = 0; i < num_title_patches; i++){
+            patch = &title_patches[i];
+            if (patch->align == 1) continue;
+            found = aligned_search(image, image, image + size, patch->pattern, patch->bitmask, patch->patlen, patch->align);
+            if (found != plain_aligned(image, image + size, patch->pattern, patch->bitmask, patch->patlen, patch->align)){
+                printf("FAIL case %u: aligned_search and a plain compare disagree on patch %d\n", n, i);
+                return 1;
+            }
+        }
+        memcpy(direct, image, size);
+        memcpy(fused, image, size);
+        patch_code(EQUIV_PROGID, direct, size, &scratch);
+        chunk = 1 + rand() % 0x2000;
+        patch_prepare(&set, &scratch, EQUIV_PROGID, fused, size, fused + size);
+        for (top = size; top > 0; top = lo){
+            lo = top > chunk ? top - chunk : 0;
+            patch_scan(&set, fused + lo, fused + top);
+        }
+        patch_apply(&set);
+        if (memcmp(direct, fused, size)){
+            printf("FAIL case %u: patch_code and the fused path differ on a %u byte image with %d patches\n", n, size,
+                num_title_patches);
+            return 1;
+        }
+    }
+    printf("%u random titles patched the same by patch_code and the fused path\n", cases);
+    return 0;
+}
+
+// what the align flag buys on code that does not contain the pattern
+static void aligned_vs_bytewise(void){
+    u32 pair[2] = {0xE3A00001, 0xE12FFF1E}; // MOV R0, #1; BX LR
+    double ns[3];
+    u8 *found;
+    u32 i, word;
+    engine_t engines[3] = {ENGINE_ALIGNED, ENGINE_BOYER_MOORE, ENGINE_HORSPOOL};
+
+    srand(0);
+    for (i = 0; i < IMAGE_SIZE; i += 4){
+        word = rand() ^ rand() << 16;
+        if (word == pair[0]) word++;
+        memcpy(image + i, &word, 4);
+    }
+    patlen = 8;
+    memcpy(pattern, pair, 8);
+    for (i = 0; i < 3; i++){
+        ns[i] = time_search(engines[i], 4, 0, &found);
+        if (found) printf("an ARM pair turned up in random words\n");
+    }
+    printf("absent ARM pair over random words: aligned_search %.2f ns/B, boyer_moore %.2f, horspool %.2f\n", ns[0], ns[1], ns[2]);
+}
+
+int main(int argc, char **argv){
+    bound_case_t c;
+    double ns[2], growth, worst = 0;
+    u32 lens[2];
+    u8 *found, *first;
+    engine_t engine;
+    int failed = 0;
+    int n, longest, wrong;
+
+    for (n = 1; n < argc; n++){
+        if (!strcmp(argv[n], "-v")) verbose = 1;
+        else if (!strcmp(argv[n], "-e")) return equivalence(n + 1 < argc ? strtoul(argv[n + 1], NULL, 0) : 200000);
+        else{
+            fprintf(stderr, "usage: %s [-v] [-e cases]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    for (n = 0; make_case(n, 0, &c); n++){
+        for (engine = ENGINE_BOYER_MOORE; engine <= ENGINE_ALIGNED; engine++){
+            if ((engine == ENGINE_ALIGNED) != (c.align > 1)) continue;
+            wrong = 0;
+            for (longest = 0; longest < 2; longest++){
+                make_case(n, longest, &c);
+                lens[longest] = patlen;
+                ns[longest] = time_search(engine, c.align, c.masked, &found);
+                if (engine != ENGINE_ALIGNED && engine != ENGINE_BOYER_MOORE){
+                    time_search(ENGINE_BOYER_MOORE, 1, 0, &first);
+                    if (found != first) wrong = 1;
+                }
+            }
+            growth = ns[1] / ns[0];
+            if (growth > worst) worst = growth;
+            if (growth > GROWTH_LIMIT || wrong){
+                printf("FAIL %-36s %-14s %7.2f ns/B at %3u bytes, %7.2f at %3u, %5.1fx%s\n", c.name, engine_names[engine],
+                    ns[0], lens[0], ns[1], lens[1], growth, wrong ? ", different match" : "");
+                failed = 1;
+            }
+            else if (verbose) printf("ok   %-36s %-14s %7.2f ns/B at %3u bytes, %7.2f at %3u, %5.1fx\n", c.name, engine_names[engine],
+                ns[0], lens[0], ns[1], lens[1], growth);
+        }
+    }
+    printf("%s, worst growth %.1fx\n", failed ? "failed" : "all engines within bound", worst);
+    aligned_vs_bytewise();
+    return failed;
+}
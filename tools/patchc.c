@@ -0,0 +1,241 @@
+// Host compiler for /rei/patches/patches.dat.
+//
+//   cc -O2 -o patchc tools/patchc.c
+//   patchc patches.txt patches.dat
+//
+// One patch per line, '#' starts a comment:
+//
+//   <progid> <pattern hex> <replacement hex or -> [offset=N] [count=N]
+//       [mask=M | last=L] [anchor=I window=N] [align=2|4 [bits=B]]
+//
+// offset is where the replacement goes relative to the match (default 0),
+// count how many matches to patch (default 1). mask=M applies the patch to
+// every title whose progid equals this one in the bits set in M, so
+// 0004001000020000 with mask=FFFFFFFFFFFF0FFF covers MSET in every region.
+// last=L applies it to every progid from this one to L. anchor=I restricts
+// the search to the N bytes starting at the first match of the I-th patch
+// applied to the title, counting from 0 in file order, and cannot be
+// combined with mask or last, whose patches sit at a different index in
+// every title they cover. A '-' replacement writes nothing and is only
+// useful as an anchor. align=4 only matches ARM
+// instructions, at offsets into the image that are multiples of 4, align=2
+// Thumb halfwords; the pattern must be whole words or halfwords. bits=B, as
+// long as the pattern, only compares the pattern bits set in B, so
+// registers or immediates can be left open, such patterns are at most 32
+// bytes long.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+// must match source/patcher.h
+#define PATCH_FILE_MAGIC 0x54415052
+#define PATCH_FILE_VERSION 1
+#define PATCH_FLAG_ANCHORED 0x01
+#define PATCH_FLAG_MASKED 0x02
+#define PATCH_FLAG_RANGE 0x04
+#define PATCH_FLAG_ALIGN2 0x08
+#define PATCH_FLAG_ALIGN4 0x10
+#define PATCH_FLAG_BITMASK 0x20
+#define PATCH_MAX_MASKED_LEN 32
+#define PATCH_MAX_ANCHORS 32
+
+#define MAX_TITLES 256
+#define MAX_KEYED 1024
+
+typedef struct{
+    uint64_t progid;
+    unsigned patches;
+} title_t;
+
+// a mask= or last= patch
+typedef struct{
+    uint64_t progid;
+    int range;
+    uint64_t mask;
+    uint64_t last;
+} keyed_t;
+
+static title_t titles[MAX_TITLES];
+static unsigned ntitles;
+static keyed_t keyed[MAX_KEYED];
+static unsigned nkeyed;
+
+static int parse_hex(const char *s, uint8_t *out, unsigned *len){
+    unsigned n = 0;
+    char byte[3] = {0};
+
+    if (!strcmp(s, "-")){
+        *len = 0;
+        return 0;
+    }
+    if (strlen(s) % 2) return -1;
+    for (; *s; s += 2){
+        if (!isxdigit((unsigned char)s[0]) || !isxdigit((unsigned char)s[1]) || n == 0xFF) return -1;
+        byte[0] = s[0];
+        byte[1] = s[1];
+        out[n++] = strtoul(byte, NULL, 16);
+    }
+    *len = n;
+    return 0;
+}
+
+// patches seen so far for progid, this one included
+static unsigned count_patch(uint64_t progid){
+    unsigned i;
+
+    for (i = 0; i < ntitles && titles[i].progid != progid; i++);
+    if (i == ntitles){
+        if (ntitles == MAX_TITLES) return 0;
+        titles[ntitles].progid = progid;
+        titles[ntitles++].patches = 0;
+    }
+    return ++titles[i].patches;
+}
+
+// mask= and last= patches so far that progid gets besides its own, in file order they come before it
+static unsigned count_keyed(uint64_t progid){
+    unsigned i, n = 0;
+
+    for (i = 0; i < nkeyed; i++){
+        if (keyed[i].progid == progid) continue; // count_patch has these
+        if (keyed[i].range ? progid >= keyed[i].progid && progid <= keyed[i].last
+                           : (progid & keyed[i].mask) == (keyed[i].progid & keyed[i].mask)) n++;
+    }
+    return n;
+}
+
+int main(int argc, char **argv){
+    FILE *in, *out;
+    char line[1024];
+    char *tok, *end;
+    uint8_t pattern[0xFF], replace[0xFF], bits[0xFF], fields[5], anchor[5];
+    unsigned patlen, replen, bitslen, lineno, index, records;
+    uint64_t progid, mask, last;
+    int has_mask, has_last;
+    long offset, count, anchor_index, window, align;
+    uint32_t header[2];
+
+    if (argc != 3){
+        fprintf(stderr, "usage: %s patches.txt patches.dat\n", argv[0]);
+        return 2;
+    }
+    if ((in = fopen(argv[1], "r")) == NULL){
+        perror(argv[1]);
+        return 1;
+    }
+    if ((out = fopen(argv[2], "wb")) == NULL){
+        perror(argv[2]);
+        return 1;
+    }
+    header[0] = PATCH_FILE_MAGIC;
+    header[1] = PATCH_FILE_VERSION;
+    fwrite(header, sizeof(header), 1, out);
+
+    records = 0;
+    for (lineno = 1; fgets(line, sizeof(line), in); lineno++){
+        if ((end = strchr(line, '#')) != NULL) *end = '\0';
+        if ((tok = strtok(line, " \t\r\n")) == NULL) continue;
+
+        progid = strtoull(tok, &end, 16);
+        if (*end) goto bad;
+        if ((tok = strtok(NULL, " \t\r\n")) == NULL || parse_hex(tok, pattern, &patlen) || patlen == 0) goto bad;
+        if ((tok = strtok(NULL, " \t\r\n")) == NULL || parse_hex(tok, replace, &replen)) goto bad;
+
+        offset = 0;
+        count = 1;
+        anchor_index = -1;
+        window = -1;
+        align = 1;
+        bitslen = 0;
+        has_mask = has_last = 0;
+        while ((tok = strtok(NULL, " \t\r\n")) != NULL){
+            if (!strncmp(tok, "mask=", 5)){
+                mask = strtoull(tok + 5, &end, 16);
+                has_mask = 1;
+            }
+            else if (!strncmp(tok, "last=", 5)){
+                last = strtoull(tok + 5, &end, 16);
+                has_last = 1;
+            }
+            else if (!strncmp(tok, "offset=", 7)) offset = strtol(tok + 7, &end, 0);
+            else if (!strncmp(tok, "count=", 6)) count = strtol(tok + 6, &end, 0);
+            else if (!strncmp(tok, "anchor=", 7)) anchor_index = strtol(tok + 7, &end, 0);
+            else if (!strncmp(tok, "window=", 7)) window = strtol(tok + 7, &end, 0);
+            else if (!strncmp(tok, "align=", 6)) align = strtol(tok + 6, &end, 0);
+            else if (!strncmp(tok, "bits=", 5)){
+                if (parse_hex(tok + 5, bits, &bitslen) || bitslen == 0) goto bad;
+                continue;
+            }
+            else goto bad;
+            if (*end) goto bad;
+        }
+        if (offset < -128 || offset > 127 || count < 0 || count > 127) goto bad;
+        if ((anchor_index < 0) != (window < 0)) goto bad;
+        if ((has_mask && has_last) || (has_last && last < progid)) goto bad;
+        if ((align != 1 && align != 2 && align != 4) || patlen % align) goto bad;
+        if (bitslen && (align == 1 || bitslen != patlen || patlen > PATCH_MAX_MASKED_LEN)) goto bad;
+        if (anchor_index >= 0 && (has_mask || has_last)){
+            fprintf(stderr, "%s:%u: anchor cannot be used with mask or last\n", argv[1], lineno);
+            return 1;
+        }
+
+        index = count_patch(progid);
+        if (index == 0){
+            fprintf(stderr, "%s:%u: too many titles\n", argv[1], lineno);
+            return 1;
+        }
+        // this patch's index among the title's patches is index - 1 plus the keyed ones before it
+        if (anchor_index >= 0 && (anchor_index >= index - 1 + count_keyed(progid) || anchor_index >= PATCH_MAX_ANCHORS)){
+            fprintf(stderr, "%s:%u: anchor must be one of the title's first %u earlier patches\n", argv[1], lineno, PATCH_MAX_ANCHORS);
+            return 1;
+        }
+        if (has_mask || has_last){
+            if (nkeyed == MAX_KEYED){
+                fprintf(stderr, "%s:%u: too many mask or last patches\n", argv[1], lineno);
+                return 1;
+            }
+            keyed[nkeyed].progid = progid;
+            keyed[nkeyed].range = has_last;
+            keyed[nkeyed].mask = mask;
+            keyed[nkeyed++].last = last;
+        }
+
+        fields[0] = patlen;
+        fields[1] = replen;
+        fields[2] = (uint8_t)offset;
+        fields[3] = (uint8_t)count;
+        fields[4] = (anchor_index >= 0 ? PATCH_FLAG_ANCHORED : 0) | (has_mask ? PATCH_FLAG_MASKED : 0) | (has_last ? PATCH_FLAG_RANGE : 0) |
+            (align == 2 ? PATCH_FLAG_ALIGN2 : 0) | (align == 4 ? PATCH_FLAG_ALIGN4 : 0) | (bitslen ? PATCH_FLAG_BITMASK : 0);
+        fwrite(&progid, 8, 1, out);
+        fwrite(fields, sizeof(fields), 1, out);
+        if (anchor_index >= 0){
+            anchor[0] = anchor_index;
+            anchor[1] = window;
+            anchor[2] = window >> 8;
+            anchor[3] = window >> 16;
+            anchor[4] = window >> 24;
+            fwrite(anchor, sizeof(anchor), 1, out);
+        }
+        if (has_mask) fwrite(&mask, 8, 1, out);
+        if (has_last) fwrite(&last, 8, 1, out);
+        fwrite(pattern, patlen, 1, out);
+        fwrite(bits, bitslen, 1, out);
+        fwrite(replace, replen, 1, out);
+        records++;
+        continue;
+
+    bad:
+        fprintf(stderr, "%s:%u: bad patch line\n", argv[1], lineno);
+        return 1;
+    }
+    fclose(in);
+    if (fclose(out)){
+        perror(argv[2]);
+        return 1;
+    }
+    printf("%u patches for %u titles\n", records, ntitles);
+    return 0;
+}
@@ -0,0 +1,420 @@
+// Runs a patches.dat against a directory of decompressed code images with
+// the loader's own patcher, see source/patcher.c and source/patchdb.c.
+//
+//   cc -O2 -pthread -Itools/host -o patchrun tools/patchrun.c
+//   patchrun [-j threads] [-r runs] [-o report.json] patches.dat images
+//
+// Images are the decompressed .code of a title, named after its progid in
+// hex with anything after the first 16 digits ignored, so several builds
+// of one title can sit side by side (0004001000021000-11.4.bin). Every
+// image is patched by both engines, patch_code and the fused scan the
+// loader uses with LOADER_FUSED_PATCH, and their output is compared. The
+// images are decoded already, so the fused time is the chunked scan and
+// patch_apply alone, without lzss_decompress running in between; it
+// checks the two agree, tools/fusedbench.c compares what they cost.
+//
+// Prints which records matched which images, the records that never
+// applied anywhere and the time each engine took, the best of -r runs
+// (default 1). Use -j 1 when comparing engines. -o writes the same as
+// JSON. Linux only, the database lives at its device address like on the
+// 3DS.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define LOADER_FUSED_PATCH
+#define LZSS_CHUNK_SIZE 0x2000 // must match source/loader.c
+
+#include <3ds.h>
+#include "../source/stats.h"
+#define feof ifile_feof // ifile.h declares its own
+#include "../source/ifile.h"
+#undef feof
+
+static loader_stats_t stats;
+loader_stats_t *const g_stats = &stats;
+
+static FILE *patches_file;
+static __thread int current_record; // patchdb record handed out last on this thread, -1 for built-in patches
+
+void statsRegisterFootprint(stats_module_id_t id, u32 size){}
+
+Result IFile_Open(IFile *file, FS_ArchiveID archiveId, FS_Path archivePath, FS_Path filePath, u32 flags){
+    rewind(patches_file);
+    file->pos = 0;
+    return 0;
+}
+
+Result IFile_Close(IFile *file){
+    return 0;
+}
+
+Result IFile_GetSize(IFile *file, u64 *size){
+    fseek(patches_file, 0, SEEK_END);
+    *size = file->size = ftell(patches_file);
+    return 0;
+}
+
+Result IFile_Read(IFile *file, u64 *total, void *buffer, u32 len){
+    fseek(patches_file, file->pos, SEEK_SET);
+    *total = fread(buffer, 1, len, patches_file);
+    file->pos += *total;
+    return 0;
+}
+
+// patchdb keeps 32 bit pointers, so its memory has to sit where it does on the device
+Result svcControlMemory(u32 *addr_out, u32 addr0, u32 addr1, u32 size, u32 op, u32 perm){
+    void *p;
+
+    if (op == MEMOP_FREE) return munmap((void *)(uintptr_t)addr0, size) ? -1 : 0;
+    p = mmap((void *)(uintptr_t)addr0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (p == MAP_FAILED) return -1;
+    *addr_out = addr0;
+    return 0;
+}
+
+#include "../source/patchdb.c"
+#include "../source/arena.c"
+
+static void traced_patchdb_get(patchdb_t *db, u16 record, patch_t *patch){
+    current_record = record;
+    patchdb_get(db, record, patch);
+}
+
+#define patchdb_get traced_patchdb_get
+#include "../source/patcher.c"
+#undef patchdb_get
+
+typedef struct{
+    int record;
+    u32 applied;
+    u32 matches; // every occurrence in the unpatched image, whatever count says
+} image_patch_t;
+
+typedef struct{
+    char name[256];
+    u64 progid;
+    u32 size;
+    double direct_ms;
+    double fused_ms;
+    int identical;
+    int failed;
+    int num_patches;
+    image_patch_t patches[PATCHDB_MAX_MATCHES + 1];
+} image_t;
+
+static image_t *images;
+static int num_images;
+static int next_image;
+static const char *images_dir;
+static int num_runs = 1;
+static u32 *record_applied;
+static u32 *record_images;
+
+static double now_ms(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static u32 count_matches(u8 *code, u32 size, const patch_t *patch){
+    int delta1[ALPHABET_LEN];
+    int delta2[ALPHABET_LEN];
+    u8 *p, *end = code + size;
+    u32 n = 0;
+
+    if (patch->patlen == 0) return 0;
+    if (patch->align > 1){
+        for (p = code; (p = aligned_search(code, p, end, patch->pattern, patch->bitmask, patch->patlen, patch->align)) != NULL; p += patch->patlen) n++;
+        return n;
+    }
+    make_delta1(delta1, patch->pattern, patch->patlen);
+    make_delta2(delta2, patch->pattern, patch->patlen);
+    for (p = code; (p = boyer_moore(p, end - p, patch->pattern, patch->patlen, delta1, delta2)) != NULL; p += patch->patlen) n++;
+    return n;
+}
+
+typedef struct{
+    patch_direct_t direct;
+    image_t *image;
+    u8 *original;
+} attribute_t;
+
+// apply_direct, noting what each patch did
+static void attribute(void *arg, const patch_t *patch){
+    attribute_t *attr = arg;
+    image_patch_t *ip = &attr->image->patches[attr->image->num_patches++];
+    int before = attr->direct.applied;
+
+    apply_direct(&attr->direct, patch);
+    ip->record = current_record;
+    ip->applied = attr->direct.applied - before;
+    ip->matches = count_matches(attr->original, attr->direct.size, patch);
+    current_record = -1; // the next one is built in unless patchdb hands it out
+}
+
+static void run_image(image_t *image, patch_set_t *set, arena_t *scratch){
+    char path[4096];
+    u8 *original, *direct, *fused;
+    attribute_t attr;
+    FILE *f;
+    double start, ms;
+    u32 top, lo;
+    int i, run;
+
+    snprintf(path, sizeof(path), "%s/%s", images_dir, image->name);
+    if ((f = fopen(path, "rb")) == NULL){
+        image->failed = 1;
+        return;
+    }
+    fseek(f, 0, SEEK_END);
+    image->size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    original = malloc(image->size + 1);
+    direct = malloc(image->size + 1);
+    fused = malloc(image->size + 1);
+    if (fread(original, 1, image->size, f) != image->size) image->failed = 1;
+    fclose(f);
+    if (image->failed) goto done;
+
+    for (run = 0; run < num_runs; run++){
+        memcpy(direct, original, image->size);
+        start = now_ms();
+        patch_code(image->progid, direct, image->size, scratch);
+        ms = now_ms() - start;
+        if (run == 0 || ms < image->direct_ms) image->direct_ms = ms;
+
+        // chunks top down, the order lzss_decompress finishes them in, but none of the decoding
+        memcpy(fused, original, image->size);
+        start = now_ms();
+        patch_prepare(set, scratch, image->progid, fused, image->size, fused + image->size);
+        for (top = image->size; top > 0; top = lo){
+            lo = top > LZSS_CHUNK_SIZE ? top - LZSS_CHUNK_SIZE : 0;
+            patch_scan(set, fused + lo, fused + top);
+        }
+        patch_apply(set);
+        ms = now_ms() - start;
+        if (run == 0 || ms < image->fused_ms) image->fused_ms = ms;
+    }
+    image->identical = memcmp(direct, fused, image->size) == 0;
+
+    memcpy(direct, original, image->size);
+    attr.direct.code = direct;
+    attr.direct.size = image->size;
+    attr.direct.scratch = scratch;
+    attr.direct.applied = 0;
+    attr.direct.num_patches = 0;
+    attr.image = image;
+    attr.original = original;
+    current_record = -1;
+    for_each_patch(image->progid, attribute, &attr);
+    for (i = 0; i < image->num_patches; i++){
+        if (image->patches[i].record < 0 || image->patches[i].applied == 0) continue;
+        __atomic_fetch_add(&record_applied[image->patches[i].record], image->patches[i].applied, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&record_images[image->patches[i].record], 1, __ATOMIC_RELAXED);
+    }
+
+    done:
+    free(original);
+    free(direct);
+    free(fused);
+}
+
+static void *worker(void *arg){
+    patch_set_t *set = malloc(sizeof(patch_set_t));
+    void *memory = malloc(ARENA_SCRATCH_SIZE);
+    arena_t scratch;
+    int i;
+
+    arena_init(&scratch, memory, ARENA_SCRATCH_SIZE);
+    while ((i = __atomic_fetch_add(&next_image, 1, __ATOMIC_RELAXED)) < num_images) run_image(&images[i], set, &scratch);
+    free(memory);
+    free(set);
+    return NULL;
+}
+
+// which titles a record is for, the way patchc takes it
+static void describe_record(patchdb_t *db, u32 record, char *out, size_t len){
+    u32 i;
+
+    for (i = 0; i < db->num_keys; i++){
+        if (db->keys[i].record != record) continue;
+        if (db->groups[db->keys[i].group].mask == ~0ULL) snprintf(out, len, "%016llx", (unsigned long long)db->keys[i].value);
+        else snprintf(out, len, "%016llx mask=%016llx", (unsigned long long)db->keys[i].value,
+            (unsigned long long)db->groups[db->keys[i].group].mask);
+        return;
+    }
+    for (i = 0; i < db->num_ranges; i++){
+        if (db->ranges[i].record != record) continue;
+        snprintf(out, len, "%016llx last=%016llx", (unsigned long long)db->ranges[i].first, (unsigned long long)db->ranges[i].last);
+        return;
+    }
+    snprintf(out, len, "?");
+}
+
+static void json_string(FILE *out, const char *s){
+    fputc('"', out);
+    for (; *s; s++){
+        if (*s == '"' || *s == '\\') fputc('\\', out);
+        if ((unsigned char)*s < 0x20) fprintf(out, "\\u%04x", *s);
+        else fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+static void write_report(FILE *out, patchdb_t *db, double direct_ms, double fused_ms){
+    char key[64];
+    image_t *image;
+    u32 r;
+    int i, j;
+
+    fprintf(out, "{\n  \"records\": [\n");
+    for (r = 0; r < db->num_records; r++){
+        describe_record(db, r, key, sizeof(key));
+        fprintf(out, "    {\"record\": %u, \"key\": \"%s\", \"applied\": %u, \"images\": %u}%s\n", r, key, record_applied[r],
+            record_images[r], r + 1 < db->num_records ? "," : "");
+    }
+    fprintf(out, "  ],\n  \"images\": [\n");
+    for (i = 0; i < num_images; i++){
+        image = &images[i];
+        fprintf(out, "    {\"name\": ");
+        json_string(out, image->name);
+        fprintf(out, ", \"progid\": \"%016llx\", \"size\": %u, \"failed\": %s, \"direct_ms\": %.3f, \"fused_ms\": %.3f, \"identical\": %s, \"patches\": [",
+            (unsigned long long)image->progid, image->size, image->failed ? "true" : "false", image->direct_ms, image->fused_ms,
+            image->identical ? "true" : "false");
+        for (j = 0; j < image->num_patches; j++){
+            if (image->patches[j].record < 0) fprintf(out, "%s{\"record\": \"builtin\"", j ? ", " : "");
+            else fprintf(out, "%s{\"record\": %d", j ? ", " : "", image->patches[j].record);
+            fprintf(out, ", \"applied\": %u, \"matches\": %u}", image->patches[j].applied, image->patches[j].matches);
+        }
+        fprintf(out, "]}%s\n", i + 1 < num_images ? "," : "");
+    }
+    fprintf(out, "  ],\n  \"direct_ms\": %.3f,\n  \"fused_ms\": %.3f\n}\n", direct_ms, fused_ms);
+}
+
+static int parse_name(const char *name, u64 *progid){
+    char hex[17];
+    int i;
+
+    for (i = 0; i < 16; i++){
+        if (!isxdigit((unsigned char)name[i])) return -1;
+        hex[i] = name[i];
+    }
+    hex[16] = '\0';
+    *progid = strtoull(hex, NULL, 16);
+    return 0;
+}
+
+static int cmp_image(const void *a, const void *b){
+    return strcmp(((const image_t *)a)->name, ((const image_t *)b)->name);
+}
+
+int main(int argc, char **argv){
+    pthread_t *threads;
+    const char *report = NULL, *db_path = NULL;
+    struct dirent *entry;
+    patchdb_t *db;
+    image_t *image;
+    DIR *dir;
+    FILE *out;
+    char key[64];
+    double direct_ms = 0, fused_ms = 0;
+    int num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int cap = 64, unmatched = 0, differing = 0, failed = 0;
+    int i, j;
+    u32 r;
+
+    for (i = 1; i < argc; i++){
+        if (!strcmp(argv[i], "-j") && i + 1 < argc) num_threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-r") && i + 1 < argc) num_runs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc) report = argv[++i];
+        else if (db_path == NULL) db_path = argv[i];
+        else images_dir = argv[i];
+    }
+    if (images_dir == NULL || num_threads < 1 || num_runs < 1){
+        fprintf(stderr, "usage: %s [-j threads] [-r runs] [-o report.json] patches.dat images\n", argv[0]);
+        return 2;
+    }
+    if ((patches_file = fopen(db_path, "rb")) == NULL){
+        perror(db_path);
+        return 1;
+    }
+    if ((dir = opendir(images_dir)) == NULL){
+        perror(images_dir);
+        return 1;
+    }
+    images = calloc(cap, sizeof(image_t));
+    while ((entry = readdir(dir)) != NULL){
+        if (strlen(entry->d_name) >= sizeof(images[0].name) || parse_name(entry->d_name, &images[num_images].progid)) continue;
+        strcpy(images[num_images].name, entry->d_name);
+        if (++num_images == cap){
+            cap *= 2;
+            images = realloc(images, cap * sizeof(image_t));
+            memset(images + num_images, 0, (cap - num_images) * sizeof(image_t));
+        }
+    }
+    closedir(dir);
+    qsort(images, num_images, sizeof(image_t), cmp_image);
+
+    patchdbInit();
+    db = patchdb_acquire(); // load it before the threads race for it
+    if (db->num_records == 0){
+        fprintf(stderr, "%s: no patches, or the database could not be mapped at 0x%08x\n", db_path, PATCHDB_ADDR);
+        return 1;
+    }
+    record_applied = calloc(db->num_records, sizeof(u32));
+    record_images = calloc(db->num_records, sizeof(u32));
+
+    threads = malloc(num_threads * sizeof(pthread_t));
+    for (i = 0; i < num_threads; i++) pthread_create(&threads[i], NULL, worker, NULL);
+    for (i = 0; i < num_threads; i++) pthread_join(threads[i], NULL);
+
+    for (i = 0; i < num_images; i++){
+        image = &images[i];
+        if (image->failed){
+            printf("%s: could not be read\n", image->name);
+            failed++;
+            continue;
+        }
+        direct_ms += image->direct_ms;
+        fused_ms += image->fused_ms;
+        if (!image->identical) differing++;
+        printf("%s: %u bytes, direct %.3f ms, fused %.3f ms%s\n", image->name, image->size, image->direct_ms, image->fused_ms,
+            image->identical ? "" : ", ENGINES DIFFER");
+        for (j = 0; j < image->num_patches; j++){
+            if (image->patches[j].record < 0) printf("  builtin");
+            else printf("  record %d", image->patches[j].record);
+            printf(": applied %u, %u matches\n", image->patches[j].applied, image->patches[j].matches);
+        }
+    }
+
+    printf("\n");
+    for (r = 0; r < db->num_records; r++){
+        if (record_images[r]) continue;
+        describe_record(db, r, key, sizeof(key));
+        printf("record %u (%s) applied to no image\n", r, key);
+        unmatched++;
+    }
+    printf("%d images, %u records, %d never applied, direct %.3f ms, fused %.3f ms\n", num_images, db->num_records, unmatched,
+        direct_ms, fused_ms);
+
+    if (report){
+        if ((out = fopen(report, "w")) == NULL){
+            perror(report);
+            return 1;
+        }
+        write_report(out, db, direct_ms, fused_ms);
+        fclose(out);
+    }
+    patchdb_release(db);
+    patchdbExit();
+    return differing || failed;
+}
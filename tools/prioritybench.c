@@ -0,0 +1,212 @@
+// Measures application launch latency while other loads keep the storage
+// busy, with the fs:LDR priority picked per load against the single
+// priority the loader used before, see tools/host/standin.h.
+//
+//   cc -O2 -pthread -no-pie -Itools/host -Wno-pointer-to-int-cast -Wno-int-to-pointer-cast
+//       -Wno-incompatible-pointer-types -o prioritybench tools/prioritybench.c tools/host/standin.c source/[!l]*.c
+//   prioritybench [-n launches] [-c background clients] [-s app KiB] [-b storage MiB/s]
+//
+// In every scenario pm launches an application (resourcelimitcategory 0)
+// -n times (default 16): RegisterProgram, LoadProcess, closing the process,
+// UnregisterProgram, then a pause of 10 ms. Meanwhile -c clients (default
+// 2) loop over 1 MiB titles of their own on sessions of their own:
+//
+//   idle         no background clients, the baseline
+//   dry run      DryRun (0x104), which reads at FSLDR_PRIORITY_BACKGROUND
+//   sysmodules   LoadProcess of category OTHER titles, FSLDR_PRIORITY_SYSTEM
+//
+// Each scenario with background load runs twice, once as the loader runs
+// now and once with pin_priority, where every read is as urgent as any
+// other like it was before. Prints the median and worst LoadProcess
+// latency of the application and how much the background clients got
+// done. Exits 1 if a command failed.
+//
+// The loader issues all of its reads on one fs:LDR session whose priority
+// is that of the most urgent load in progress, so a background read sent
+// while an application loads is as urgent as the application's reads, and
+// the next launch can still queue behind it.
+//
+// On a device: build with `make LOADER_TRACE=1`, launch the same
+// application a few times from the home menu with nothing else running,
+// then again while a homebrew client loops DryRun on large titles, and
+// compare the READ stage of its loads in /rei/trace.bin with tracedump -t.
+// Repeat with a build where fsldr_priority_begin does nothing for the
+// single-priority figures.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "host/standin.h"
+
+#define MAX_LAUNCHES 256
+#define MAX_BACKGROUND 3 // the loader takes MAX_SESSIONS sessions, pm's launches need one
+#define APP_PROGID 0x0004000000100000ULL
+#define SYSMODULE_PROGID 0x0004013000002000ULL
+
+typedef enum{
+    SCENARIO_IDLE,
+    SCENARIO_DRYRUN,
+    SCENARIO_SYSMODULES,
+    SCENARIO_COUNT
+} scenario_t;
+
+static const char *scenario_names[SCENARIO_COUNT] = {"idle", "dry run", "sysmodules"};
+
+// written by the boot's child, read back by the parent
+typedef struct{
+    double launch_ms[MAX_LAUNCHES];
+    u32 background_ops;
+    Result failed; // the first failure
+} pm_result_t;
+
+static pm_result_t *g_result;
+static scenario_t g_scenario;
+static u32 g_launches, g_background;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void fail(Result res){
+    pthread_mutex_lock(&g_lock);
+    if (g_result->failed == 0) g_result->failed = res;
+    pthread_mutex_unlock(&g_lock);
+}
+
+static void *background_client(void *arg){
+    volatile int *done = arg;
+    static u32 next_client;
+    Handle session, process;
+    u64 prog_handle, progid;
+    Result res;
+    u32 client;
+
+    pthread_mutex_lock(&g_lock);
+    client = next_client++;
+    pthread_mutex_unlock(&g_lock);
+    progid = (g_scenario == SCENARIO_DRYRUN ? APP_PROGID : SYSMODULE_PROGID) | (u64)(client + 1) << 8;
+    session = standin_connect();
+    if (R_FAILED(res = standin_register(session, progid, &prog_handle))){
+        fail(res);
+        return NULL;
+    }
+    while (!*done){
+        if (g_scenario == SCENARIO_DRYRUN) res = standin_dry_run(session, prog_handle);
+        else if (R_SUCCEEDED(res = standin_load(session, prog_handle, &process))) standin_close(process);
+        if (R_FAILED(res)){
+            fail(res);
+            break;
+        }
+        pthread_mutex_lock(&g_lock);
+        g_result->background_ops++;
+        pthread_mutex_unlock(&g_lock);
+    }
+    standin_unregister(session, prog_handle);
+    standin_close(session);
+    return NULL;
+}
+
+static void pm(void *arg){
+    pthread_t threads[MAX_BACKGROUND];
+    volatile int done = 0;
+    Handle session, process;
+    u64 prog_handle;
+    double start;
+    Result res;
+    u32 i, clients;
+
+    clients = g_scenario == SCENARIO_IDLE ? 0 : g_background;
+    for (i = 0; i < clients; i++) pthread_create(&threads[i], NULL, background_client, (void *)&done);
+    session = standin_connect();
+    usleep(20000); // let the background loads get going
+    for (i = 0; i < g_launches && !g_result->failed; i++){
+        if (R_FAILED(res = standin_register(session, APP_PROGID, &prog_handle))){
+            fail(res);
+            break;
+        }
+        start = standin_now_ms();
+        if (R_FAILED(res = standin_load(session, prog_handle, &process))) fail(res);
+        else{
+            g_result->launch_ms[i] = standin_now_ms() - start;
+            standin_close(process);
+        }
+        standin_unregister(session, prog_handle);
+        usleep(10000);
+    }
+    done = 1;
+    for (i = 0; i < clients; i++) pthread_join(threads[i], NULL);
+    standin_close(session);
+}
+
+static int compare(const void *a, const void *b){
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static int run(const standin_config_t *cfg, const char *name){
+    standin_report_t report;
+
+    memset(g_result, 0, sizeof(pm_result_t));
+    if (standin_boot(cfg, pm, NULL, &report) || g_result->failed){
+        printf("  %-24s failed %08x\n", name, (u32)g_result->failed);
+        return 0;
+    }
+    qsort(g_result->launch_ms, g_launches, sizeof(double), compare);
+    printf("  %-24s %9.2f %9.2f %11u %11u\n", name, g_result->launch_ms[g_launches / 2],
+        g_result->launch_ms[g_launches - 1], g_result->background_ops, report.set_priority_calls);
+    return 1;
+}
+
+int main(int argc, char **argv){
+    standin_config_t cfg;
+    char name[32];
+    char *dir;
+    u32 size = 256, i;
+    int opt, ok = 1, pin;
+
+    standin_defaults(&cfg);
+    g_launches = 16;
+    g_background = 2;
+    while ((opt = getopt(argc, argv, "n:c:s:b:")) != -1){
+        switch (opt){
+            case 'n': g_launches = strtoul(optarg, NULL, 0); break;
+            case 'c': g_background = strtoul(optarg, NULL, 0); break;
+            case 's': size = strtoul(optarg, NULL, 0); break;
+            case 'b': cfg.storage_mib_s = strtod(optarg, NULL); break;
+            default:
+                fprintf(stderr, "usage: %s [-n launches] [-c background clients] [-s app KiB] [-b storage MiB/s]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (g_launches == 0 || g_launches > MAX_LAUNCHES || g_background == 0 || g_background > MAX_BACKGROUND || size == 0){
+        fprintf(stderr, "%s: -n must be 1 to %u, -c 1 to %u, -s at least 1\n", argv[0], MAX_LAUNCHES, MAX_BACKGROUND);
+        return 2;
+    }
+
+    dir = standin_temp_dir();
+    cfg.titles = dir;
+    if (!standin_write_title(dir, APP_PROGID, 0, size << 10, 1)) ok = 0;
+    for (i = 1; i <= MAX_BACKGROUND; i++){
+        if (!standin_write_title(dir, APP_PROGID | (u64)i << 8, 0, 0x100000, 1) ||
+            !standin_write_title(dir, SYSMODULE_PROGID | (u64)i << 8, 3, 0x100000, 1)) ok = 0;
+    }
+    if (!ok){
+        fprintf(stderr, "%s: could not write titles to %s\n", argv[0], dir);
+        standin_remove_dir(dir);
+        return 1;
+    }
+    g_result = standin_shared(sizeof(pm_result_t));
+
+    printf("%u KiB application, %u launches, %u background clients, ", size, g_launches, g_background);
+    if (cfg.storage_mib_s > 0) printf("storage %.1f MiB/s + %u us per request\n", cfg.storage_mib_s, cfg.storage_latency_us);
+    else printf("storage free\n");
+    printf("  %-24s %9s %9s %11s %11s\n", "LoadProcess ms", "p50", "max", "background", "SetPriority");
+    for (g_scenario = 0; g_scenario < SCENARIO_COUNT; g_scenario++){
+        for (pin = 0; pin <= (g_scenario != SCENARIO_IDLE); pin++){
+            cfg.pin_priority = pin;
+            snprintf(name, sizeof(name), "%s%s", scenario_names[g_scenario], pin ? ", one priority" : "");
+            ok &= run(&cfg, name);
+        }
+    }
+    standin_remove_dir(dir);
+    return !ok;
+}
@@ -0,0 +1,183 @@
+// Host decoder for the LoadProcess stage trace written with LOADER_TRACE.
+//
+//   cc -O2 -o tracedump tools/tracedump.c
+//   tracedump [-t] trace.bin
+//
+// Prints one line per load with the time spent in each stage, followed by
+// percentiles for every stage. -t adds the same summary per title. Command
+// records are left to tracereplay.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+// must match source/trace.h
+#define TRACE_MAGIC 0x4352544C
+#define TRACE_VERSION 2
+
+enum{
+    TRACE_STAGE_BEGIN = 0,
+    TRACE_STAGE_GETPROGRAMINFO,
+    TRACE_STAGE_ALLOCATE,
+    TRACE_STAGE_READ,
+    TRACE_STAGE_DECOMPRESS,
+    TRACE_STAGE_PATCH,
+    TRACE_STAGE_CREATECODESET,
+    TRACE_STAGE_CREATEPROCESS,
+    TRACE_STAGE_COUNT,
+    TRACE_COMMAND = 0x100
+};
+
+static const char *stage_names[TRACE_STAGE_COUNT] = {
+    "begin", "exheader", "alloc", "read", "lzss", "patch", "codeset", "process"
+};
+
+typedef struct{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint64_t ticks_per_sec;
+} __attribute__((packed)) trace_file_header_t;
+
+typedef struct{
+    uint64_t progid;
+    uint64_t tick;
+    uint32_t seq;
+    uint16_t stage;
+    uint16_t cmdid;
+    uint64_t prog_handle;
+    uint32_t result;
+    uint32_t size;
+    uint32_t ticks;
+    uint32_t reserved;
+} __attribute__((packed)) trace_record_t;
+
+typedef struct{
+    uint64_t progid;
+    uint32_t seq;
+    double stage_ms[TRACE_STAGE_COUNT]; // stage_ms[TRACE_STAGE_BEGIN] holds the total
+} load_t;
+
+static int cmp_record(const void *a, const void *b){
+    const trace_record_t *x = a, *y = b;
+    if (x->seq != y->seq) return x->seq < y->seq ? -1 : 1;
+    if (x->tick != y->tick) return x->tick < y->tick ? -1 : 1;
+    return 0;
+}
+
+static int cmp_double(const void *a, const void *b){
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(double *sorted, size_t n, double p){
+    size_t i;
+    if (n == 0) return 0;
+    i = (size_t)(p * (n - 1) + 0.5);
+    return sorted[i];
+}
+
+static void print_summary(const char *title, load_t *loads, size_t nloads, uint64_t progid, int filter){
+    double *values;
+    size_t n, i;
+    int stage;
+
+    values = malloc(sizeof(double) * (nloads ? nloads : 1));
+    printf("\n%s\n%-9s %6s %9s %9s %9s %9s\n", title, "stage", "n", "p50 ms", "p90 ms", "p99 ms", "max ms");
+    for (stage = 0; stage < TRACE_STAGE_COUNT; stage++){
+        n = 0;
+        for (i = 0; i < nloads; i++){
+            if (filter && loads[i].progid != progid) continue;
+            values[n++] = loads[i].stage_ms[stage];
+        }
+        qsort(values, n, sizeof(double), cmp_double);
+        printf("%-9s %6zu %9.3f %9.3f %9.3f %9.3f\n", stage == TRACE_STAGE_BEGIN ? "total" : stage_names[stage],
+            n, percentile(values, n, 0.50), percentile(values, n, 0.90), percentile(values, n, 0.99), n ? values[n - 1] : 0);
+    }
+    free(values);
+}
+
+int main(int argc, char **argv){
+    FILE *f;
+    trace_file_header_t header;
+    trace_record_t *recs;
+    load_t *loads;
+    size_t nrecs, cap, nloads, i, j;
+    double ms_per_tick;
+    int per_title = 0;
+    const char *path = NULL;
+    char title[64];
+    int stage;
+
+    for (i = 1; i < (size_t)argc; i++){
+        if (!strcmp(argv[i], "-t")) per_title = 1;
+        else path = argv[i];
+    }
+    if (path == NULL){
+        fprintf(stderr, "usage: %s [-t] trace.bin\n", argv[0]);
+        return 2;
+    }
+    if ((f = fopen(path, "rb")) == NULL){
+        perror(path);
+        return 1;
+    }
+    if (fread(&header, sizeof(header), 1, f) != 1 || header.magic != TRACE_MAGIC ||
+        header.version != TRACE_VERSION || header.record_size != sizeof(trace_record_t)){
+        fprintf(stderr, "%s: not a loader trace\n", path);
+        return 1;
+    }
+    ms_per_tick = 1000.0 / (double)header.ticks_per_sec;
+
+    cap = 1024;
+    nrecs = 0;
+    recs = malloc(cap * sizeof(trace_record_t));
+    while (fread(&recs[nrecs], sizeof(trace_record_t), 1, f) == 1){
+        if (recs[nrecs].stage == TRACE_COMMAND) continue;
+        if (++nrecs == cap){
+            cap *= 2;
+            recs = realloc(recs, cap * sizeof(trace_record_t));
+        }
+    }
+    fclose(f);
+
+    // workers interleave their records, regroup them per load
+    qsort(recs, nrecs, sizeof(trace_record_t), cmp_record);
+    loads = calloc(nrecs ? nrecs : 1, sizeof(load_t));
+    nloads = 0;
+    for (i = 0; i < nrecs; i = j){
+        load_t *load = &loads[nloads];
+        for (j = i + 1; j < nrecs && recs[j].seq == recs[i].seq; j++){
+            if (recs[j].stage < TRACE_STAGE_COUNT)
+                load->stage_ms[recs[j].stage] += (recs[j].tick - recs[j - 1].tick) * ms_per_tick;
+            if (recs[j].progid) load->progid = recs[j].progid;
+        }
+        if (recs[i].stage != TRACE_STAGE_BEGIN) continue; // head of this load was dropped
+        load->seq = recs[i].seq;
+        load->stage_ms[TRACE_STAGE_BEGIN] = (recs[j - 1].tick - recs[i].tick) * ms_per_tick;
+        nloads++;
+    }
+
+    printf("%-6s %-16s", "seq", "progid");
+    for (stage = 0; stage < TRACE_STAGE_COUNT; stage++) printf(" %9s", stage == TRACE_STAGE_BEGIN ? "total" : stage_names[stage]);
+    printf("\n");
+    for (i = 0; i < nloads; i++){
+        printf("%-6u %016llx", loads[i].seq, (unsigned long long)loads[i].progid);
+        for (stage = 0; stage < TRACE_STAGE_COUNT; stage++) printf(" %9.3f", loads[i].stage_ms[stage]);
+        printf("\n");
+    }
+
+    print_summary("all titles", loads, nloads, 0, 0);
+    if (per_title){
+        for (i = 0; i < nloads; i++){
+            for (j = 0; j < i && loads[j].progid != loads[i].progid; j++);
+            if (j != i) continue; // already summarized
+            snprintf(title, sizeof(title), "%016llx", (unsigned long long)loads[i].progid);
+            print_summary(title, loads, nloads, loads[i].progid, 1);
+        }
+    }
+
+    free(loads);
+    free(recs);
+    return 0;
+}
@@ -0,0 +1,373 @@
+// Host replayer for the Loader commands recorded with LOADER_TRACE.
+//
+//   cc -O2 -pthread -no-pie -Itools/host -Wno-pointer-to-int-cast -Wno-int-to-pointer-cast
+//       -Wno-incompatible-pointer-types -o tracereplay tools/tracereplay.c tools/host/standin.c source/[!l]*.c
+//   tracereplay [-s speed] trace.bin [titles]
+//
+// Without a titles directory it prints the command timeline in arrival
+// order and the reply latency of every command. With one it boots the
+// loader in the stand-in harness (tools/host/standin.h) with the titles
+// from titles/<progid>.exheader and titles/<progid>.code and replays the
+// timeline against it as pm: each command is sent at its recorded arrival
+// time (divided by speed, 0 sends them back to back), and commands that
+// overlapped on the device go out on separate sessions, up to the
+// loader's four. prog_handles from the trace are mapped to the ones the
+// harness hands out for the same RegisterProgram; a title registered before
+// the trace started is registered on its first command. Batched loads and
+// GetLaunchOrder do not record their prog_handles and are not replayed.
+//
+// Prints the device and the host reply latency of every command and the
+// host result where it differs. Each load's .code size is checked against
+// the bytes the device read, unless the boot prefetcher had it already.
+// Exits 1 if a title is missing, a .code differs or a replayed command got
+// a different result.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "host/standin.h"
+
+#define MAX_LANES 4 // MAX_SESSIONS in source/loader.c
+
+// must match source/trace.h
+#define TRACE_MAGIC 0x4352544C
+#define TRACE_VERSION 2
+#define TRACE_COMMAND 0x100
+
+typedef struct{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint64_t ticks_per_sec;
+} __attribute__((packed)) trace_file_header_t;
+
+typedef struct{
+    uint64_t progid;
+    uint64_t tick;
+    uint32_t seq;
+    uint16_t stage;
+    uint16_t cmdid;
+    uint64_t prog_handle;
+    uint32_t result;
+    uint32_t size;
+    uint32_t ticks;
+    uint32_t reserved;
+} __attribute__((packed)) trace_record_t;
+
+typedef struct{
+    uint16_t cmdid;
+    const char *name;
+} command_name_t;
+
+static const command_name_t command_names[] = {
+    {1, "LoadProcess"}, {2, "RegisterProgram"}, {3, "UnregisterProgram"}, {4, "GetProgramInfo"},
+    {0x100, "GetStatsHandle"}, {0x101, "GetMemoryStats"}, {0x102, "LoadProcessBatch"},
+    {0x103, "GetLaunchOrder"}, {0x104, "DryRun"}, {0x105, "ReloadPatches"}
+};
+
+static const char *command_name(uint16_t cmdid){
+    size_t i;
+
+    for (i = 0; i < sizeof(command_names) / sizeof(command_names[0]); i++){
+        if (command_names[i].cmdid == cmdid) return command_names[i].name;
+    }
+    return "?";
+}
+
+static uint64_t received(const trace_record_t *rec){
+    return rec->tick - rec->ticks;
+}
+
+static int cmp_received(const void *a, const void *b){
+    uint64_t x = received(a), y = received(b);
+    return (x > y) - (x < y);
+}
+
+typedef enum{
+    REPLAY_SKIPPED = 0, // not replayable
+    REPLAY_MISSING, // its title is not in the directory
+    REPLAY_DONE
+} replay_status_t;
+
+// one per record, written by the boot's child
+typedef struct{
+    replay_status_t status;
+    Result result;
+    double ms;
+    u64 prog_handle; // what the harness handed out for the record's prog_handle
+    int done;
+} replay_t;
+
+static trace_record_t *g_recs;
+static replay_t *g_replay;
+static size_t g_nrecs;
+static long *g_dep; // the RegisterProgram record a command's prog_handle came from, -1 if none
+static int *g_lane;
+static double g_ms_per_tick, g_speed, g_start;
+static uint64_t g_first;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_cond = PTHREAD_COND_INITIALIZER;
+
+static int replayable(const trace_record_t *rec){
+    switch (rec->cmdid){
+        case 1: case 2: case 3: case 4: case 0x104: return rec->progid != 0;
+        case 0x100: case 0x101: case 0x105: return 1;
+        default: return 0;
+    }
+}
+
+static int title_file(const char *dir, uint64_t progid, const char *ext, long *size){
+    char path[4096];
+    struct stat st;
+
+    snprintf(path, sizeof(path), "%s/%016llx.%s", dir, (unsigned long long)progid, ext);
+    if (stat(path, &st)) return 0;
+    if (size) *size = st.st_size;
+    return 1;
+}
+
+// commands that overlapped on the device get different lanes, each lane is a session
+static void assign(void){
+    uint64_t free_at[MAX_LANES] = {0};
+    size_t i, j;
+    int lane, l;
+
+    for (i = 0; i < g_nrecs; i++){
+        g_dep[i] = -1;
+        g_lane[i] = -1;
+        if (g_replay[i].status != REPLAY_DONE) continue;
+        lane = 0;
+        for (l = 0; l < MAX_LANES; l++){
+            if (free_at[l] <= received(&g_recs[i])){
+                lane = l;
+                break;
+            }
+            if (free_at[l] < free_at[lane]) lane = l;
+        }
+        g_lane[i] = lane;
+        free_at[lane] = g_recs[i].tick;
+        if (g_recs[i].cmdid == 2 || g_recs[i].prog_handle == 0) continue;
+        // the latest successful register of the handle before this command, or
+        // the first command that used it if it was registered before the trace
+        for (j = i; j-- > 0;){
+            if (g_recs[j].prog_handle != g_recs[i].prog_handle || g_replay[j].status != REPLAY_DONE) continue;
+            if (g_recs[j].cmdid == 2){
+                if (g_recs[j].result == 0) g_dep[i] = j;
+                break;
+            }
+            if (g_dep[j] < 0) g_dep[i] = j;
+        }
+    }
+}
+
+static void finish(size_t i, Result result, double ms, u64 prog_handle){
+    pthread_mutex_lock(&g_lock);
+    g_replay[i].result = result;
+    g_replay[i].ms = ms;
+    g_replay[i].prog_handle = prog_handle;
+    g_replay[i].done = 1;
+    pthread_cond_broadcast(&g_cond);
+    pthread_mutex_unlock(&g_lock);
+}
+
+static Result send(Handle session, const trace_record_t *rec, u64 prog_handle, u64 *out){
+    exheader_header exheader;
+    u32 cmdbuf[64];
+    Handle process;
+    Result res;
+
+    *out = 0;
+    switch (rec->cmdid){
+        case 1:
+            res = standin_load(session, prog_handle, &process);
+            if (R_SUCCEEDED(res)) standin_close(process);
+            return res;
+        case 2:
+            return standin_register(session, rec->progid, out);
+        case 3:
+            return standin_unregister(session, prog_handle);
+        case 4:
+            return standin_get_info(session, prog_handle, &exheader);
+        case 0x104:
+            return standin_dry_run(session, prog_handle);
+        default: // no arguments, and a reply the replay does not look at
+            cmdbuf[0] = IPC_MakeHeader(rec->cmdid, 0, 0);
+            if (R_FAILED(res = standin_request(session, cmdbuf, NULL))) return res;
+            if (rec->cmdid == 0x100) standin_close(cmdbuf[4]);
+            return cmdbuf[1];
+    }
+}
+
+static void *lane_main(void *arg){
+    int lane = (int)(intptr_t)arg;
+    Handle session;
+    u64 prog_handle, out;
+    double at;
+    size_t i;
+    Result res;
+
+    session = standin_connect();
+    for (i = 0; i < g_nrecs; i++){
+        if (g_lane[i] != lane) continue;
+        prog_handle = 0;
+        if (g_dep[i] >= 0){
+            pthread_mutex_lock(&g_lock);
+            while (!g_replay[g_dep[i]].done) pthread_cond_wait(&g_cond, &g_lock);
+            prog_handle = g_replay[g_dep[i]].prog_handle;
+            pthread_mutex_unlock(&g_lock);
+        }
+        else if (g_recs[i].cmdid != 2 && g_recs[i].prog_handle){
+            // registered before the trace started, the later commands on it reuse this one
+            standin_register(session, g_recs[i].progid, &prog_handle);
+        }
+        if (g_speed > 0){
+            at = g_start + (received(&g_recs[i]) - g_first) * g_ms_per_tick / g_speed;
+            while (standin_now_ms() < at) usleep((at - standin_now_ms()) * 1000);
+        }
+        at = standin_now_ms();
+        res = send(session, &g_recs[i], prog_handle, &out);
+        finish(i, res, standin_now_ms() - at, g_recs[i].cmdid == 2 ? out : prog_handle);
+    }
+    standin_close(session);
+    return NULL;
+}
+
+static void pm(void *arg){
+    pthread_t lanes[MAX_LANES];
+    int l;
+
+    g_start = standin_now_ms(); // all lanes count from the same moment
+    for (l = 0; l < MAX_LANES; l++) pthread_create(&lanes[l], NULL, lane_main, (void *)(intptr_t)l);
+    for (l = 0; l < MAX_LANES; l++) pthread_join(lanes[l], NULL);
+}
+
+int main(int argc, char **argv){
+    FILE *f;
+    trace_file_header_t header;
+    trace_record_t *recs, rec;
+    standin_config_t cfg;
+    size_t nrecs, cap, i;
+    const char *path = NULL, *dir = NULL;
+    char *end;
+    double ms_per_tick, speed = 1;
+    long code_size;
+    uint64_t first;
+    int missing = 0, mismatched = 0, differing = 0, skipped = 0, failed = 0;
+
+    for (i = 1; i < (size_t)argc; i++){
+        if (!strcmp(argv[i], "-s") && i + 1 < (size_t)argc){
+            speed = strtod(argv[++i], &end);
+            if (*end || speed < 0){
+                path = NULL;
+                break;
+            }
+        }
+        else if (path == NULL) path = argv[i];
+        else dir = argv[i];
+    }
+    if (path == NULL){
+        fprintf(stderr, "usage: %s [-s speed] trace.bin [titles]\n", argv[0]);
+        return 2;
+    }
+    if ((f = fopen(path, "rb")) == NULL){
+        perror(path);
+        return 1;
+    }
+    if (fread(&header, sizeof(header), 1, f) != 1 || header.magic != TRACE_MAGIC ||
+        header.version != TRACE_VERSION || header.record_size != sizeof(trace_record_t)){
+        fprintf(stderr, "%s: not a loader trace\n", path);
+        return 1;
+    }
+    ms_per_tick = 1000.0 / (double)header.ticks_per_sec;
+
+    cap = 1024;
+    nrecs = 0;
+    recs = malloc(cap * sizeof(trace_record_t));
+    while (fread(&rec, sizeof(rec), 1, f) == 1){
+        if (rec.stage != TRACE_COMMAND) continue; // LoadProcess stages are tracedump's
+        recs[nrecs] = rec;
+        if (++nrecs == cap){
+            cap *= 2;
+            recs = realloc(recs, cap * sizeof(trace_record_t));
+        }
+    }
+    fclose(f);
+    if (nrecs == 0){
+        fprintf(stderr, "%s: no commands recorded\n", path);
+        return 1;
+    }
+
+    // records are written as replies go out, replay them as the requests came in
+    qsort(recs, nrecs, sizeof(trace_record_t), cmp_received);
+    first = received(&recs[0]);
+
+    if (dir){
+        g_recs = recs;
+        g_nrecs = nrecs;
+        g_first = first;
+        g_ms_per_tick = ms_per_tick;
+        g_speed = speed;
+        g_replay = standin_shared(nrecs * sizeof(replay_t));
+        g_dep = malloc(nrecs * sizeof(long));
+        g_lane = malloc(nrecs * sizeof(int));
+        for (i = 0; i < nrecs; i++){
+            if (!replayable(&recs[i])) g_replay[i].status = REPLAY_SKIPPED;
+            else if (recs[i].progid && (!title_file(dir, recs[i].progid, "exheader", NULL) || ((recs[i].cmdid == 1 ||
+                recs[i].cmdid == 0x104) && !title_file(dir, recs[i].progid, "code", NULL)))) g_replay[i].status = REPLAY_MISSING;
+            else g_replay[i].status = REPLAY_DONE;
+        }
+        assign();
+        standin_defaults(&cfg);
+        cfg.titles = dir;
+        printf("replayed in the stand-in harness, storage %.1f MiB/s + %u us per request\n", cfg.storage_mib_s,
+            cfg.storage_latency_us);
+        if (standin_boot(&cfg, pm, NULL, NULL)){
+            fprintf(stderr, "%s: the loader did not shut down cleanly\n", argv[0]);
+            failed = 1;
+        }
+    }
+
+    printf("%10s %-18s %-16s %-16s %8s %9s %9s", "at ms", "command", "progid", "prog_handle", "result", "size", "device ms");
+    if (dir) printf(" %9s", "host ms");
+    printf("\n");
+    for (i = 0; i < nrecs; i++){
+        printf("%10.3f %-18s %016llx %016llx %08x %9u %9.3f", (received(&recs[i]) - first) * ms_per_tick, command_name(recs[i].cmdid),
+            (unsigned long long)recs[i].progid, (unsigned long long)recs[i].prog_handle, recs[i].result, recs[i].size,
+            recs[i].ticks * ms_per_tick);
+        if (dir){
+            if (g_replay[i].status == REPLAY_SKIPPED){
+                printf(" %9s", "skipped");
+                skipped++;
+            }
+            else if (g_replay[i].status == REPLAY_MISSING){
+                printf(" %9s", "missing");
+                missing++;
+            }
+            else{
+                printf(" %9.3f", g_replay[i].ms);
+                if ((u32)g_replay[i].result != recs[i].result){
+                    printf(" host %08x", (u32)g_replay[i].result);
+                    differing++;
+                }
+                // a failed load may have stopped before reading .code, a prefetched one reads nothing
+                if ((recs[i].cmdid == 1 || recs[i].cmdid == 0x104) && recs[i].result == 0 && recs[i].size &&
+                    title_file(dir, recs[i].progid, "code", &code_size) && recs[i].size != (uint32_t)code_size){
+                    printf(" .code is %ld bytes", code_size);
+                    mismatched++;
+                }
+            }
+        }
+        printf("\n");
+    }
+
+    if (dir) printf("\n%zu commands, %d not replayable, %d with missing files, %d with a different .code, %d with a different result\n",
+        nrecs, skipped, missing, mismatched, differing);
+    free(recs);
+    return failed || missing || mismatched || differing;
+}
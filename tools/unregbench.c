@@ -0,0 +1,159 @@
+// Measures UnregisterProgram (3) as pm sees it now that the teardown runs
+// after the reply, see tools/host/standin.h.
+//
+//   cc -O2 -pthread -no-pie -Itools/host -Wno-pointer-to-int-cast -Wno-int-to-pointer-cast
+//       -Wno-incompatible-pointer-types -o unregbench tools/unregbench.c tools/host/standin.c source/[!l]*.c
+//   unregbench [-n unregisters] [-u fs:REG unload us]
+//
+// Each scenario is a fresh boot in which pm registers -n titles (default
+// 16) and then unregisters them:
+//
+//   spaced       one unregister every 3 unload times, the loader always
+//                has a free teardown slot
+//   burst        all of them back to back; once MAX_TEARDOWNS are pending
+//                the loader only answers after the unload, queued on the
+//                workers behind the pending ones, which is the baseline
+//   re-register  RegisterProgram of the same title right after each
+//                unregister, which has to wait for the teardown
+//
+// Prints the latency of each command, split into the replies that came
+// before an unload could have run (no wait) and the rest, and the
+// loader's unregisters_deferred and registers_delayed counters. Exits 1 if
+// a command failed.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "host/standin.h"
+
+#define MAX_TITLES 32 // MAX_REGISTRATIONS in source/loader.c
+#define APP_PROGID 0x0004000000100000ULL
+
+typedef enum{
+    SCENARIO_SPACED,
+    SCENARIO_BURST,
+    SCENARIO_REREGISTER,
+    SCENARIO_COUNT
+} scenario_t;
+
+static const char *scenario_names[SCENARIO_COUNT] = {"spaced", "burst", "re-register"};
+
+typedef struct{
+    double unregister_ms[MAX_TITLES];
+    double register_ms[MAX_TITLES];
+    Result failed;
+} pm_result_t;
+
+static pm_result_t *g_result;
+static scenario_t g_scenario;
+static u32 g_titles, g_unload_us;
+
+static void fail(Result res){
+    if (g_result->failed == 0) g_result->failed = res;
+}
+
+static void pm(void *arg){
+    u64 prog_handles[MAX_TITLES];
+    Handle session;
+    double start;
+    Result res;
+    u32 i;
+
+    session = standin_connect();
+    for (i = 0; i < g_titles; i++){
+        if (R_FAILED(res = standin_register(session, APP_PROGID | (u64)i << 8, &prog_handles[i]))) fail(res);
+    }
+    for (i = 0; i < g_titles && !g_result->failed; i++){
+        start = standin_now_ms();
+        if (R_FAILED(res = standin_unregister(session, prog_handles[i]))) fail(res);
+        g_result->unregister_ms[i] = standin_now_ms() - start;
+        if (g_scenario == SCENARIO_REREGISTER){
+            start = standin_now_ms();
+            if (R_FAILED(res = standin_register(session, APP_PROGID | (u64)i << 8, &prog_handles[i]))) fail(res);
+            g_result->register_ms[i] = standin_now_ms() - start;
+            if (R_FAILED(res = standin_unregister(session, prog_handles[i]))) fail(res);
+        }
+        if (g_scenario != SCENARIO_BURST) usleep(3 * g_unload_us);
+    }
+}
+
+static int compare(const void *a, const void *b){
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+// the replies faster than half an unload did not wait for one
+static void print_latency(const char *name, double *samples, u32 count){
+    double fast[MAX_TITLES], slow[MAX_TITLES];
+    u32 fast_count = 0, slow_count = 0, i;
+
+    for (i = 0; i < count; i++){
+        if (samples[i] * 1000 < g_unload_us / 2) fast[fast_count++] = samples[i];
+        else slow[slow_count++] = samples[i];
+    }
+    qsort(fast, fast_count, sizeof(double), compare);
+    qsort(slow, slow_count, sizeof(double), compare);
+    printf("    %-18s %9u", name, fast_count);
+    if (fast_count) printf(" %9.3f %9.3f", fast[fast_count / 2], fast[fast_count - 1]);
+    else printf(" %9s %9s", "-", "-");
+    printf(" %9u", slow_count);
+    if (slow_count) printf(" %9.3f %9.3f", slow[slow_count / 2], slow[slow_count - 1]);
+    printf("\n");
+}
+
+int main(int argc, char **argv){
+    standin_config_t cfg;
+    standin_report_t report;
+    char *dir;
+    u32 i;
+    int opt, ok = 1;
+
+    standin_defaults(&cfg);
+    g_titles = 16;
+    while ((opt = getopt(argc, argv, "n:u:")) != -1){
+        switch (opt){
+            case 'n': g_titles = strtoul(optarg, NULL, 0); break;
+            case 'u': cfg.unload_us = strtoul(optarg, NULL, 0); break;
+            default:
+                fprintf(stderr, "usage: %s [-n unregisters] [-u fs:REG unload us]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (g_titles == 0 || g_titles > MAX_TITLES){
+        fprintf(stderr, "%s: -n must be 1 to %u\n", argv[0], MAX_TITLES);
+        return 2;
+    }
+    g_unload_us = cfg.unload_us;
+
+    dir = standin_temp_dir();
+    cfg.titles = dir;
+    for (i = 0; i < g_titles; i++){
+        if (!standin_write_title(dir, APP_PROGID | (u64)i << 8, 0, 0x3000, 0)) ok = 0;
+    }
+    if (!ok){
+        fprintf(stderr, "%s: could not write titles to %s\n", argv[0], dir);
+        standin_remove_dir(dir);
+        return 1;
+    }
+    g_result = standin_shared(sizeof(pm_result_t));
+
+    printf("%u titles, fs:REG unload %u us, storage %.1f MiB/s + %u us per request\n", g_titles, cfg.unload_us,
+        cfg.storage_mib_s, cfg.storage_latency_us);
+    for (g_scenario = 0; g_scenario < SCENARIO_COUNT; g_scenario++){
+        memset(g_result, 0, sizeof(pm_result_t));
+        if (standin_boot(&cfg, pm, NULL, &report) || g_result->failed){
+            printf("%s: failed %08x\n", scenario_names[g_scenario], (u32)g_result->failed);
+            ok = 0;
+            continue;
+        }
+        printf("%s: %u unregisters deferred, %u registers delayed\n", scenario_names[g_scenario],
+            report.stats.unregisters_deferred, report.stats.registers_delayed);
+        printf("    %-18s %9s %9s %9s %9s %9s %9s\n", "ms", "no wait", "p50", "max", "waited", "p50", "max");
+        print_latency("UnregisterProgram", g_result->unregister_ms, g_titles);
+        if (g_scenario == SCENARIO_REREGISTER) print_latency("RegisterProgram", g_result->register_ms, g_titles);
+    }
+    standin_remove_dir(dir);
+    return !ok;
+}